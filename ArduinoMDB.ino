@@ -1,28 +1,64 @@
-#include <SoftwareSerial.h>
 #include "BillValidator.h"
+#include "CashlessReader.h"
 #include "CoinChanger.h"
+#include "CoinHopper.h"
 #include "MDBSerial.h"
+#include "MDBBus.h"
+#include "Audit.h"
+#include "Memory.h"
+#include "Power.h"
+#include "Recorder.h"
+#include "Remote.h"
 
 MDBSerial mdb(1);
+MDBBus bus(mdb);
 CoinChanger changer(mdb);
 BillValidator validator(mdb);
+CoinHopper hopper1(mdb, HOPPER_1);
+CoinHopper hopper2(mdb, HOPPER_2);
+CashlessReader reader1(mdb, CASHLESS_1);
+CashlessReader reader2(mdb, CASHLESS_2);
+MDBDevice *devices[] = { &changer, &validator, &hopper1, &hopper2, &reader1, &reader2 };
 
-SoftwareSerial serial(0, 1);
+//USART0 on pins 0/1 carries the log text and the frames of the host controller,
+//interrupt driven so printing never blocks the MDB receive path on USART1
+UART serial(0);
+Remote remote(serial, changer, validator, &mdb);
 
 void setup()
 {
-  serial.begin(9600);
+  serial.begin(115200);
+  Logger::SetUART(&serial);
+  if (MDBTimer::Lost())
+    error << F("MDB_TIMERS TOO SMALL, LOST ") << MDBTimer::Lost() << endl;
+  recorder.Begin();
+  mdb.begin();
   serial.println("test");
-  changer.Reset();
-  validator.Reset();
+  audit.Load();
+  validator.SetChanger(changer);
+  //hoppers that are there pay big change together with the changer
+  changer.SetHopper(hopper1);
+  changer.SetHopper(hopper2);
+  //only one of the readers has a session at a time
+  reader1.SetPeer(reader2);
+  //a device joins the bus once its address answers, unplugged at boot or not,
+  //more than MDB_BUS_DEVICES are never polled
+  for (unsigned int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+    if (!bus.Register(*devices[i]))
+      error << F("BUS FULL, ") << devices[i]->GetAddress() << F(" NOT REGISTERED") << endl;
+  bus.HardReset();
+  bus.Discover();
+  MDBBus::EnableWatchdog();
   serial.println("VMC###############");
 }
 
+//nothing in here waits for the bus, the devices are polled every POLL_INTERVAL
+//and the CPU sleeps in between
 void loop()
 {
-  unsigned long change;
-  changer.Update(change);
-  validator.Update(change);
-  delay(200);
+  bus.Update();
+  remote.Update();
+  audit.Update();
+  memory.Update();
+  MDBBus::Sleep();
 }
-
@@ -0,0 +1,225 @@
+#include "Audit.h"
+#include "Logger.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+
+Audit audit;
+
+Audit::Audit()
+{
+	memset(&m_counters, 0, sizeof(m_counters));
+	for (int i = 0; i < AUDIT_TYPES; i++)
+	{
+		m_coin_value[i] = 0;
+		m_bill_value[i] = 0;
+	}
+	m_sequence = 0;
+	m_slot = AUDIT_EEPROM_SLOTS - 1;
+	m_events = 0;
+	m_last_flush = 0;
+}
+
+uint16_t Audit::checksum(const Slot &slot)
+{
+	uint16_t crc = 0xFFFF;
+	const uint8_t *data = (const uint8_t *)&slot;
+	for (unsigned int i = 0; i < sizeof(Slot) - sizeof(slot.crc); i++)
+		crc = _crc16_update(crc, data[i]);
+	return crc;
+}
+
+//the slot with the highest valid sequence number holds the latest counters
+bool Audit::Load()
+{
+	Slot slot;
+	bool found = false;
+	for (int i = 0; i < AUDIT_EEPROM_SLOTS; i++)
+	{
+		EEPROM.get(AUDIT_EEPROM_START + i * sizeof(Slot), slot);
+		if (slot.crc != checksum(slot))
+			continue;
+		if (!found || slot.sequence > m_sequence)
+		{
+			m_sequence = slot.sequence;
+			m_slot = i;
+			m_counters = slot.counters;
+			found = true;
+		}
+	}
+	m_events = 0;
+	m_last_flush = millis();
+	if (!found)
+		warning << F("AUDIT: NO VALID RECORD") << endl;
+	return found;
+}
+
+//batches the EEPROM writes, should be called from the main loop
+void Audit::Update()
+{
+	if (m_events == 0)
+		return;
+	if (m_events >= AUDIT_FLUSH_EVENTS || (millis() - m_last_flush) >= AUDIT_FLUSH_INTERVAL)
+		Flush();
+}
+
+//writes the counters to the next slot, EEPROM.put only touches changed bytes
+void Audit::Flush()
+{
+	Slot slot;
+	slot.sequence = ++m_sequence;
+	slot.counters = m_counters;
+	slot.crc = checksum(slot);
+	m_slot = (m_slot + 1) % AUDIT_EEPROM_SLOTS;
+	EEPROM.put(AUDIT_EEPROM_START + m_slot * sizeof(Slot), slot);
+	m_events = 0;
+	m_last_flush = millis();
+}
+
+void Audit::Clear()
+{
+	memset(&m_counters, 0, sizeof(m_counters));
+	Flush();
+}
+
+void Audit::SetCoinValue(int type, unsigned int value)
+{
+	m_coin_value[type % AUDIT_TYPES] = value;
+}
+
+void Audit::SetBillValue(int type, unsigned int value)
+{
+	m_bill_value[type % AUDIT_TYPES] = value;
+}
+
+//a coin the changer does not know takes the highest free type
+int Audit::CoinType(unsigned int value)
+{
+	int free = -1;
+	for (int i = 0; i < AUDIT_TYPES; i++)
+	{
+		if (m_coin_value[i] == value)
+			return i;
+		if (m_coin_value[i] == 0)
+			free = i;
+	}
+	if (free >= 0)
+		m_coin_value[free] = value;
+	return free;
+}
+
+void Audit::CoinIn(int type, int routing)
+{
+	type %= AUDIT_TYPES;
+	if (routing == ROUTING_CASHBOX)
+		m_counters.coin_value_to_cashbox += m_coin_value[type];
+	else if (routing == ROUTING_TUBES)
+		m_counters.coin_value_to_tubes += m_coin_value[type];
+	else
+	{
+		CoinRejected();
+		return;
+	}
+	m_counters.coins_in[type]++;
+	changed();
+}
+
+void Audit::CoinOut(int type, int count, bool manual)
+{
+	type %= AUDIT_TYPES;
+	m_counters.coins_out[type] += count;
+	if (manual)
+		m_counters.coin_value_manual_out += (unsigned long)m_coin_value[type] * count;
+	else
+		m_counters.coin_value_out += (unsigned long)m_coin_value[type] * count;
+	changed();
+}
+
+void Audit::BillIn(int type)
+{
+	type %= AUDIT_TYPES;
+	m_counters.bills_in[type]++;
+	m_counters.bill_value_in += m_bill_value[type];
+	changed();
+}
+
+void Audit::BillOut(int type, int count)
+{
+	type %= AUDIT_TYPES;
+	m_counters.bills_out[type] += count;
+	m_counters.bill_value_out += (unsigned long)m_bill_value[type] * count;
+	changed();
+}
+
+void Audit::Vend(unsigned long value)
+{
+	m_counters.vends++;
+	m_counters.vend_value += value;
+	changed();
+}
+
+void Audit::line(uint16_t *crc, const char *str)
+{
+	for (const char *c = str; *c; c++)
+		*crc = _crc16_update(*crc, *c);
+	console << str << endl;
+}
+
+//prints the counters as DEX/UCS like records, G85 holds the CRC of all lines before it
+uint16_t Audit::Export()
+{
+	const AuditCounters &c = m_counters;
+	uint16_t crc = 0;
+	int lines = 0;
+	char str[48];
+
+	line(&crc, "DXS*ARDUINOMDB*VA*V1/1*1");
+	line(&crc, "ST*001*0001");
+	lines++;
+
+	sprintf(str, "VA1*%lu*%lu", c.vend_value, c.vends);
+	line(&crc, str);
+	lines++;
+
+	sprintf(str, "CA3*%lu*%lu*%lu*%lu", c.coin_value_to_cashbox + c.coin_value_to_tubes + c.bill_value_in,
+			c.coin_value_to_cashbox, c.coin_value_to_tubes, c.bill_value_in);
+	line(&crc, str);
+	lines++;
+
+	sprintf(str, "CA4*%lu*%lu", c.coin_value_out, c.coin_value_manual_out);
+	line(&crc, str);
+	lines++;
+
+	for (int i = 0; i < AUDIT_TYPES; i++)
+	{
+		if (c.coins_in[i] == 0 && c.coins_out[i] == 0)
+			continue;
+		sprintf(str, "CA11*%u*%lu*%lu", m_coin_value[i], c.coins_in[i], c.coins_out[i]);
+		line(&crc, str);
+		lines++;
+	}
+
+	for (int i = 0; i < AUDIT_TYPES; i++)
+	{
+		if (c.bills_in[i] == 0 && c.bills_out[i] == 0)
+			continue;
+		sprintf(str, "CA14*%u*%lu*%lu", m_bill_value[i], c.bills_in[i], c.bills_out[i]);
+		line(&crc, str);
+		lines++;
+	}
+
+	sprintf(str, "MA5*REJECTS*%lu*%lu", c.coins_rejected, c.bills_rejected);
+	line(&crc, str);
+	sprintf(str, "MA5*SLUGS*%lu", c.slugs);
+	line(&crc, str);
+	sprintf(str, "MA5*DISABLED*%lu", c.disabled_attempts);
+	line(&crc, str);
+	lines += 3;
+
+	sprintf(str, "G85*%04X", crc);
+	console << str << endl;
+	lines++;
+	sprintf(str, "SE*%d*0001", lines + 1);
+	console << str << endl;
+	console << F("DXE*1*1") << endl;
+	return crc;
+}
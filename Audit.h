@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Arduino.h>
+
+//EEPROM area used for the audit log, every flush goes to the next slot
+#define AUDIT_EEPROM_START 		0
+#define AUDIT_EEPROM_SLOTS 		8
+
+//counters are written to EEPROM after this many events or ms
+#define AUDIT_FLUSH_EVENTS 		32
+#define AUDIT_FLUSH_INTERVAL 	600000UL
+
+#define AUDIT_TYPES 			16
+
+//coin routing as reported by the changer
+#define ROUTING_CASHBOX 		0
+#define ROUTING_TUBES 			1
+#define ROUTING_REJECT 			3
+
+struct AuditCounters
+{
+	unsigned long coins_in[AUDIT_TYPES];
+	unsigned long coins_out[AUDIT_TYPES];
+	unsigned long bills_in[AUDIT_TYPES];
+	unsigned long bills_out[AUDIT_TYPES];
+
+	unsigned long coin_value_to_cashbox;
+	unsigned long coin_value_to_tubes;
+	unsigned long coin_value_out;
+	unsigned long coin_value_manual_out;
+	unsigned long bill_value_in;
+	unsigned long bill_value_out;
+
+	unsigned long vend_value;
+	unsigned long vends;
+	unsigned long coins_rejected;
+	unsigned long bills_rejected;
+	unsigned long slugs;
+	unsigned long disabled_attempts;
+};
+
+class Audit
+{
+public:
+	Audit();
+
+	bool Load();
+	void Update();
+	void Flush();
+	void Clear();
+	//prints the counters on the console, returns the crc of the G85 record
+	uint16_t Export();
+
+	void SetCoinValue(int type, unsigned int value);
+	void SetBillValue(int type, unsigned int value);
+	//type of a coin by its value for devices without the changer's types,
+	//-1 if every type is taken
+	int CoinType(unsigned int value);
+
+	void CoinIn(int type, int routing);
+	void CoinOut(int type, int count, bool manual = false);
+	void BillIn(int type);
+	void BillOut(int type, int count);
+	void Vend(unsigned long value);
+
+	inline void CoinRejected() { m_counters.coins_rejected++; changed(); }
+	inline void BillRejected() { m_counters.bills_rejected++; changed(); }
+	inline void Slugs(int count) { m_counters.slugs += count; changed(); }
+	inline void DisabledAttempts(int count) { m_counters.disabled_attempts += count; changed(); }
+
+	inline const AuditCounters &GetCounters() { return m_counters; }
+
+private:
+	inline void changed() { m_events++; }
+	void line(uint16_t *crc, const char *str);
+
+	struct Slot
+	{
+		unsigned long sequence;
+		AuditCounters counters;
+		uint16_t crc;
+	};
+
+	static uint16_t checksum(const Slot &slot);
+
+	AuditCounters m_counters;
+
+	unsigned int m_coin_value[AUDIT_TYPES];
+	unsigned int m_bill_value[AUDIT_TYPES];
+
+	unsigned long m_sequence;
+	int m_slot;
+	int m_events;
+	unsigned long m_last_flush;
+};
+
+extern Audit audit;
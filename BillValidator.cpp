@@ -1,107 +1,420 @@
 #include "BillValidator.h"
+#include "Audit.h"
 #include <Arduino.h>
 
 
 BillValidator::BillValidator(MDBSerial &mdb) : MDBDevice(mdb)
 {
 	ADDRESS = 0x30;
-	SECURITY = 0x02;
-	ESCROW = 0x05;
-	STACKER = 0x06;
 	
 	m_resetCount = 0;
 	
 	m_credit = 0;
 	m_full = false;
+	m_bills_in_stacker = 0;
+	m_enabled = true;
+	m_manual_escrow = false;
 	m_bill_in_escrow = false;
+	m_escrow_type = 0;
 	m_bill_scaling_factor = 0;
 	m_decimal_places = 0;
 	m_stacker_capacity = 0;
 	m_security_levels = 0;
 	m_can_escrow = 0;
 	for (int i = 0; i < 16; i++)
+	{
 		m_bill_type_credit[i] = 0;
+		m_recycler_count[i] = 0;
+	}
+
+	m_enabled_features = 0;
+	m_recycler_supported = false;
+	m_payout_busy = false;
+	m_recycler_routing = 0;
+	m_dispenser_full = 0;
+	m_recycler_change = 0;
+	m_dispensed_value = 0;
+	m_update_count = 0;
+
+	m_poll_step = STEP_IDLE;
+	m_escrow_accept = false;
 }
 
+//runs one poll cycle, on an MDBBus the bus runs it
 bool BillValidator::Update(unsigned long cc_change)
 {
-	poll();
-	stacker();
+	run();
+	m_policy.SetChange(cc_change);
+	cycle();
+	run();
+	return true;
+}
+
+bool BillValidator::Reset()
+{
+	run();
+	reset();
+	run();
+	return m_result;
+}
 
-	int b = 0x00;
+void BillValidator::reset()
+{
+	m_resetCount = 0;
+	m_bus_reset = false;
+	health(DEVICE_RECOVERING);
+	step(BV_PROBE);
+}
 
-	if (cc_change > 2500) //more than 25€
-		bitSet(b, 2); //enable 20€ bill
-	if (cc_change > 1500) //more than 15€
-		bitSet(b, 1); //enable 10€ bill
-	if (cc_change > 500) //more than 5€
-		bitSet(b, 0); //enable 5€ bill
-	
-	int bills[] = { 0x00, b, 0x00, 0x00 };
-	if (m_bill_in_escrow)
+//the bus reset is over, the validator only has to report JUST RESET
+void BillValidator::restart()
+{
+	m_resetCount = 0;
+	m_bus_reset = true;
+	health(DEVICE_RECOVERING);
+	step(BV_JUST_RESET);
+}
+
+void BillValidator::cycle()
+{
+	step(BV_POLL);
+}
+
+bool BillValidator::request()
+{
+	switch (m_step)
 	{
-		escrow(true);
+	case BV_PROBE:
+	case BV_CHECK:
+	case BV_JUST_RESET:
+	case BV_POLL:
+		memset(m_buffer, 0, sizeof(m_buffer));
+		command(BV_CMD_POLL);
+		break;
+	case BV_RESET:
+		command(BV_CMD_RESET);
+		break;
+	case BV_SETUP:
+		memset(m_buffer, 0, sizeof(m_buffer));
+		command(BV_CMD_SETUP);
+		break;
+	case BV_SECURITY:
+	{
+		uint8_t out[] = { 0xff, 0xff };
+		command(BV_CMD_SECURITY, out);
+		break;
+	}
+	//level 1 validators have no option bits
+	case BV_IDENTIFICATION:
+		command(m_feature_level >= 2 ? BV_CMD_IDENTIFICATION_OPTIONS : BV_CMD_IDENTIFICATION);
+		break;
+	//only the features the validator offers and this library supports are enabled
+	case BV_FEATURE_ENABLE:
+	{
+		unsigned long features = m_optional_features & OPTION_RECYCLER;
+		uint8_t out[] = { uint8_t(features >> 24), uint8_t(features >> 16), uint8_t(features >> 8), uint8_t(features) };
+		command(BV_CMD_FEATURE_ENABLE, out);
+		break;
+	}
+	case BV_RECYCLER_SETUP:
+		command(BV_CMD_RECYCLER_SETUP);
+		break;
+	//enables recycling and manual dispense for every bill type routed to the recycler
+	case BV_RECYCLER_ENABLE:
+	{
+		uint8_t out[18];
+		out[0] = m_recycler_routing >> 8;
+		out[1] = m_recycler_routing & 0xff;
+		for (int i = 0; i < 16; i++)
+			out[2 + i] = bitRead(m_recycler_routing, i) ? RECYCLER_ENABLED : 0x00;
+		command(BV_CMD_RECYCLER_ENABLE, out);
+		break;
+	}
+	case BV_INIT_RECYCLER:
+	case BV_RECYCLER:
+		command(BV_CMD_DISPENSE_STATUS);
+		break;
+	case BV_ESCROW:
+	{
+		uint8_t data[] = { uint8_t(m_escrow_accept ? 0x01 : 0x00) };
+		command(BV_CMD_ESCROW, data);
+		break;
+	}
+	case BV_STACKER:
+		command(BV_CMD_STACKER);
+		break;
+	case BV_TYPE:
+	{
+		unsigned int b = m_enabled ? m_policy.GetEnableMask() : 0x0000;
+		unsigned int e = m_can_escrow ? b : 0x00; //let the bills wait in escrow if the validator can hold them
+		uint8_t bills[] = { uint8_t(b >> 8), uint8_t(b & 0xff), uint8_t(e >> 8), uint8_t(e & 0xff) };
+		command(BV_CMD_TYPE, bills);
+		break;
+	}
+	default:
+		return false;
 	}
-	else
-		type(bills);
 	return true;
 }
 
-bool BillValidator::Reset()
+void BillValidator::response(int answer)
 {
-	int count = 0;
-	//wait for BV to response
-	while (poll() < 0)
+	switch (m_step)
 	{
-		if (count > MAX_RESET_POLL)
+	case BV_PROBE:
+	case BV_CHECK:
+	case BV_JUST_RESET:
+	case BV_POLL:
+	{
+		int result = parse_poll(answer);
+		if (result == JUST_RESET)
 		{
-			debug << F("BV: NOT CONNECTED") << endl;
-			return false;
+			//the poll counts once the validator is set up again
+			m_poll_step = m_step;
+			step(BV_SETUP);
 		}
-		delay(100);
-		count++;
+		else
+			polled(m_step, result);
+		break;
 	}
-	
-	count = 0;
-	
-	//wait for BV to power up
-	while (poll() > 0 && count < MAX_RESET_POLL)
+
+	case BV_RESET:
+		if (answer == ACK)
+		{
+			m_resetCount = 0;
+			step(BV_JUST_RESET);
+		}
+		else
+		{
+			m_resetCount++;
+			step(BV_CHECK, 100);
+		}
+		break;
+
+	case BV_SETUP:
+		if (parse_setup(answer))
+			step(BV_SECURITY);
+		else if (!retry())
+		{
+			error << F("BV: SETUP ERROR") << endl;
+			initialized(false);
+		}
+		break;
+
+	case BV_SECURITY:
+		if (answer == ACK)
+			step(BV_IDENTIFICATION);
+		else if (!retry())
+		{
+			warning << F("BV: SECURITY FAILED") << endl;
+			step(BV_IDENTIFICATION);
+		}
+		break;
+
+	case BV_IDENTIFICATION:
+		if (!parse_identification(answer))
+		{
+			if (retry())
+				break;
+			error << F("BV: EXP ID ERROR") << endl;
+		}
+		if (m_feature_level >= 2)
+			step(BV_FEATURE_ENABLE);
+		else
+			recycler_init();
+		break;
+
+	case BV_FEATURE_ENABLE:
+		if (answer == ACK)
+			m_enabled_features = m_optional_features & OPTION_RECYCLER;
+		else if (retry())
+			break;
+		else
+		{
+			m_enabled_features = 0;
+			error << F("BV: EXP FEATURE ENABLE ERROR") << endl;
+		}
+		recycler_init();
+		break;
+
+	case BV_RECYCLER_SETUP:
+		if (parse_recycler_setup(answer))
+			step(BV_RECYCLER_ENABLE);
+		else if (!retry())
+		{
+			debug << F("BV: NO RECYCLER") << endl;
+			initialized(true);
+		}
+		break;
+
+	case BV_RECYCLER_ENABLE:
+		if (answer == ACK)
+			step(BV_INIT_RECYCLER);
+		else if (!retry())
+		{
+			warning << F("BV: RECYCLER ENABLE ERROR") << endl;
+			step(BV_INIT_RECYCLER);
+		}
+		break;
+
+	case BV_INIT_RECYCLER:
+	case BV_RECYCLER:
+		if (!parse_recycler_status(answer))
+		{
+			if (retry())
+				break;
+			warning << F("BV: RECYCLER STATUS ERROR") << endl;
+		}
+		if (m_step == BV_INIT_RECYCLER)
+			initialized(true);
+		else
+		{
+			m_update_count++;
+			step(BV_TYPE);
+		}
+		break;
+
+	case BV_ESCROW:
+		if (answer == ACK)
+			m_bill_in_escrow = false;
+		else if (retry())
+			break;
+		else
+			error << F("BV: ESCROW ERROR") << endl;
+		step(STEP_IDLE);
+		break;
+
+	case BV_STACKER:
+		if (!parse_stacker(answer))
+		{
+			if (retry())
+				break;
+			warning << F("BV: STACKER ERROR") << endl;
+		}
+		if (m_recycler_supported && (m_update_count % RECYCLER_STATUS_UPDATES) == 0)
+		{
+			m_update_count = 0;
+			step(BV_RECYCLER);
+		}
+		else
+		{
+			m_update_count++;
+			step(BV_TYPE);
+		}
+		break;
+
+	case BV_TYPE:
+		if (answer != ACK && retry())
+			break;
+		if (answer != ACK)
+			warning << F("BV: TYPE ERROR") << endl;
+		step(STEP_IDLE);
+		break;
+	}
+}
+
+uint8_t BillValidator::priority()
+{
+	switch (m_step)
 	{
-		m_mdb->SendCommand(ADDRESS, RESET);
-		if (m_mdb->GetResponse() == ACK)
+	case BV_ESCROW:
+		return PRIORITY_URGENT;
+	case BV_STACKER:
+	case BV_RECYCLER:
+		return PRIORITY_BACKGROUND;
+	default:
+		return PRIORITY_POLL;
+	}
+}
+
+//what a poll answer means depends on the step that sent it
+void BillValidator::polled(uint8_t from, int result)
+{
+	switch (from)
+	{
+	//wait for BV to response
+	case BV_PROBE:
+		if (result >= 0)
+		{
+			m_resetCount = 0;
+			step(BV_CHECK);
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("BV: NOT CONNECTED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(BV_PROBE, 100);
+		}
+		break;
+
+	//wait for BV to power up
+	case BV_CHECK:
+		if (result > 0 && m_resetCount < MAX_RESET_POLL)
+			step(BV_RESET);
+		else
+		{
+			debug << F("BV: RESET FAILED") << endl;
+			done(false);
+		}
+		break;
+
+	case BV_JUST_RESET:
+		if (result == JUST_RESET)
 		{
-			int count2 = 0;
-			while(poll() != JUST_RESET)
-			{
-				if (count2 > MAX_RESET_POLL)
-				{
-					debug << F("BV: NO JUST RESET RECEIVED") << endl;
-					return false;
-				}
-				delay(100);
-				count2++;
-			}
 			debug << F("BV: RESET COMPLETED") << endl;
-			return true;
+			done(true);
 		}
-		count++;
-		delay(100);
+		else if (m_resetCount > MAX_RESET_POLL && m_bus_reset)
+		{
+			warning << F("BV: NO JUST RESET AFTER BUS RESET") << endl;
+			reset();
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("BV: NO JUST RESET RECEIVED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(BV_JUST_RESET, 100);
+		}
+		break;
+
+	//the customer is waiting, decide before anything else is sent
+	case BV_POLL:
+		if (m_bill_in_escrow && !m_manual_escrow)
+		{
+			m_escrow_accept = m_policy.Accept(m_escrow_type);
+			step(BV_ESCROW);
+		}
+		else
+			step(BV_STACKER);
+		break;
 	}
-	debug << F("BV: RESET FAILED") << endl;
-	return false;
 }
 
-bool BillValidator::init()
+void BillValidator::recycler_init()
 {
-	if (!setup())
-		return false;
-	security();
-	//Expansion(0x00); //ID
-	//Expansion(0x01); //Feature
-	//Expansion(0x05); //Status
-	Print();
-	debug << F("BV: INIT COMPLETED") << endl;
-	return true;
+	if (m_enabled_features & OPTION_RECYCLER)
+		step(BV_RECYCLER_SETUP);
+	else
+		initialized(true);
+}
+
+//end of the init after JUST RESET, back to the step that polled
+void BillValidator::initialized(bool ok)
+{
+	if (ok)
+	{
+		Print();
+		debug << F("BV: INIT COMPLETED") << endl;
+	}
+	polled(m_poll_step, ok ? JUST_RESET : 1);
 }
 
 void BillValidator::Print()
@@ -115,69 +428,99 @@ void BillValidator::Print()
 	debug << F("decimal places: ") << (int)m_decimal_places << endl;
 	debug << F("capacity: ") << m_stacker_capacity << endl;
 	debug << F("security levels: ") << m_security_levels << endl;
+	debug << F("can escrow: ") << (bool)m_can_escrow << endl;
+	print_identification();
+	debug << F("enabled features: ") << m_enabled_features << endl;
+	debug << F("recycler supported: ") << (bool)m_recycler_supported << endl;
+	if (m_recycler_supported)
+	{
+		debug << F("recycler routing: ") << m_recycler_routing << endl;
+		debug << F("dispenser full: ") << m_dispenser_full << endl;
+		debug << F("bills in recycler: ");
+		for (int i = 0; i < 16; i++)
+		{
+			debug << m_recycler_count[i] << " ";
+		}
+		debug << endl;
+		debug << F("recycler change: ") << m_recycler_change << endl;
+	}
 	debug << F("###") << endl;;
 }
 
-int BillValidator::poll()
+//returns JUST_RESET if the validator has to be set up again
+int BillValidator::parse_poll(int answer)
 {
-	int response_size = 16;
 	bool reset = false;
-	for (int i = 0; i < 64; i++)
-		m_buffer[i] = 0;
-	m_mdb->SendCommand(ADDRESS, POLL);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
 	if (answer == ACK)
 	{
 		return 1;
 	}
-
-	if (answer > 0 && m_count > 0)
-		m_mdb->Ack();
-	else
+	if (!accepted(BV_CMD_POLL, answer))
 		return -1;
 	
-	//max of 16 bytes as response
-	for (int i = 0; i < m_count && i < response_size; i++)
+	for (int i = 0; i < m_count; i++)
 	{
 		//bill status
 		if (m_buffer[i] & 0b10000000)
 		{
 			int routing = (m_buffer[i] & 0b01110000) >> 4;
 			int type = m_buffer[i] & 0b00001111;
+			unsigned long value = (unsigned long)m_bill_type_credit[type] * m_bill_scaling_factor;
 
 			if (routing == 0)
 			{
 				debug << F("BV: bill credited") << endl;
-				m_credit += (m_bill_type_credit[type] * m_bill_scaling_factor);
+				m_credit += value;
+				audit.BillIn(type);
+				event(EVENT_BILL_STACKED, type, routing, value);
 			}
 			else if (routing == 1)
 			{
 				debug << F("BV: escrow position") << endl;
 				m_bill_in_escrow = true;
+				m_escrow_type = type;
+				event(EVENT_BILL_ESCROWED, type, routing, value);
 			}
 			else if (routing == 2)
 			{
 				debug << F("BV: bill returned") << endl;
+				event(EVENT_BILL_RETURNED, type, routing, value);
 			}
 			else if (routing == 3)
 			{
 				debug << F("BV: bill to recycler") << endl;
+				m_credit += value;
+				audit.BillIn(type);
+				event(EVENT_BILL_TO_RECYCLER, type, routing, value);
+				m_recycler_count[type]++;
+				recycler_changed();
 			}
 			else if (routing == 4)
 			{
 				debug << F("BV: disabled bill rejected") << endl;
+				audit.BillRejected();
+				event(EVENT_BILL_REJECTED, type, routing, value);
 			}
 			else if (routing == 5)
 			{
 				debug << F("BV: bill to recycler - manual fill") << endl;
+				m_recycler_count[type]++;
+				recycler_changed();
 			}
 			else if (routing == 6)
 			{
 				debug << F("BV: manual dispense") << endl;
+				audit.BillOut(type, 1);
+				if (m_recycler_count[type] > 0)
+					m_recycler_count[type]--;
+				recycler_changed();
 			}
 			else if (routing == 7)
 			{
 				debug << F("BV: transferred from recycler to cashbox") << endl;
+				if (m_recycler_count[type] > 0)
+					m_recycler_count[type]--;
+				recycler_changed();
 			}
 			else
 				debug << F("BV: routing error") << endl;
@@ -186,6 +529,7 @@ int BillValidator::poll()
 		else if (m_buffer[i] & 0b01000000)
 		{
 			int number = m_buffer[i] & 0b00011111;
+			audit.DisabledAttempts(number);
 		}
 		// bill recycler only
 		else if (m_buffer[i] & 0b00100000)
@@ -198,21 +542,25 @@ int BillValidator::poll()
 				break;
 			case 2:
 				debug << F("BV: payout busy") << endl;
+				m_payout_busy = true;
 				break;
 			case 3:
 				debug << F("BV: dispenser busy") << endl;
 				break;
 			case 4:
-				debug << F("BV: defective dispenser sensor") << endl;
+				warning << F("BV: defective dispenser sensor") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 5:
 				//not used
 				break;
 			case 6:
-				debug << F("BV: dispenser did not start / motor problem") << endl;
+				warning << F("BV: dispenser did not start / motor problem") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 7:
-				debug << F("BV: dispenser jam") << endl;
+				warning << F("BV: dispenser jam") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 8:
 				debug << F("BV: ROM checksum error") << endl;
@@ -241,21 +589,26 @@ int BillValidator::poll()
 			{
 			case 1:
 				warning << F("BV: defective motor") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 2:
 				warning << F("BV: sensor problem") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 3:
 				debug << F("BV: validator busy") << endl;
 				break;
 			case 4:
 				warning << F("BV: ROM Checksum error") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 5:
 				warning << F("BV: validator jammed") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 6:
 				debug << F("BV: just reset") << endl;
+				event(EVENT_RESET);
 				reset = true;
 				break;
 			case 7:
@@ -263,6 +616,7 @@ int BillValidator::poll()
 				break;
 			case 8:
 				warning << F("BV: cash box out of position") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 9:
 				debug << F("BV: validator disabled") << endl;
@@ -272,6 +626,8 @@ int BillValidator::poll()
 				break;
 			case 11:
 				debug << F("BV: bill rejected") << endl;
+				audit.BillRejected();
+				event(EVENT_BILL_REJECTED);
 				break;
 			case 12:
 				warning << F("BV: possible credited bill removal") << endl;
@@ -279,21 +635,15 @@ int BillValidator::poll()
 			}
 		}
 	}
-	if (reset && init())
+	if (reset)
 		return JUST_RESET;
 	return 1;
 }
 
-bool BillValidator::setup(int it)
+bool BillValidator::parse_setup(int answer)
 {
-	int response_size = 27;
-	for (int i = 0; i < 64; i++)
-		m_buffer[i] = 0;
-	m_mdb->SendCommand(ADDRESS, SETUP);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer > 0 && m_count == response_size)
+	if (accepted(BV_CMD_SETUP, answer))
 	{	
-		m_mdb->Ack();
 		m_feature_level = m_buffer[0];
 		m_country = m_buffer[1] << 8 | m_buffer[2];
 		m_bill_scaling_factor = m_buffer[3] << 8 | m_buffer[4];
@@ -304,86 +654,259 @@ bool BillValidator::setup(int it)
 		for (int i = 0; i < 16; i++)
 		{
 			m_bill_type_credit[i] = m_buffer[11 + i];
+			audit.SetBillValue(i, m_bill_type_credit[i] * m_bill_scaling_factor);
 		}
+		m_policy.SetBills(m_bill_type_credit, m_bill_scaling_factor);
+		return true;
+	}
+	return false;
+}
+
+bool BillValidator::parse_stacker(int answer)
+{
+	if (accepted(BV_CMD_STACKER, answer))
+	{
+		if (m_buffer[0] & 0b10000000)
+		{
+			m_full = true;
+		}
+		else
+			m_full = false;
+		m_bills_in_stacker = (m_buffer[0] & 0b01111111) << 8 | m_buffer[1];
+		return true;
+	}
+	return false;
+}
+
+bool BillValidator::Escrow(bool accept)
+{
+	if (!m_bill_in_escrow)
+		return false;
+	return escrow(accept);
+}
+
+bool BillValidator::escrow(bool accept, int it)
+{
+	uint8_t data[] = { 0x00 };
+	if (accept)
+		data[0] = 0x01;
+	if (transact(BV_CMD_ESCROW, data) == ACK)
+	{
+		m_bill_in_escrow = false;
 		return true;
 	}
 	if (it < MAX_RESET)
 	{
-		delay(50);
-		return setup(++it);
+		wait(50);
+		return escrow(accept, ++it);
 	}
-	error << F("BV: SETUP ERROR") << endl;
+	error << F("BV: ESCROW ERROR") << endl;
 	return false;
 }
 
-void BillValidator::security(int it)
+bool BillValidator::parse_identification(int answer)
 {
-	int out[] = { 0xff, 0xff };
-	m_mdb->SendCommand(ADDRESS, SECURITY, out, 2);
-	if (m_mdb->GetResponse() != ACK)
+	if (accepted(m_feature_level >= 2 ? BV_CMD_IDENTIFICATION_OPTIONS : BV_CMD_IDENTIFICATION, answer))
 	{
-		if (it < MAX_RESET)
-		{
-			delay(50);
-			return security(++it);
-		}
-		warning << F("BV: SECURITY FAILED") << endl;
+		identification();
+		return true;
+	}
+	return false;
+}
+
+//manufacturer specific diagnostics, response has to hold DATA_MAX bytes,
+//returns the length of the response or -1
+int BillValidator::Diagnostics(int data[], int count, uint8_t response[])
+{
+	MDBCommand c = BV_CMD_DIAGNOSTICS;
+	uint8_t out[DATA_MAX];
+	for (c.request = 0; c.request < count && c.request < DATA_MAX - 2; c.request++)
+		out[c.request] = data[c.request];
+	int answer = transact(c, out);
+	if (answer == ACK)
+		return 0;
+	if (!accepted(c, answer))
+	{
+		warning << F("BV: DIAGNOSTICS FAILED") << endl;
+		return -1;
+	}
+	memcpy(response, m_buffer, m_count);
+	return m_count;
+}
+
+//bill types the validator routes to the recycler
+bool BillValidator::parse_recycler_setup(int answer)
+{
+	if (accepted(BV_CMD_RECYCLER_SETUP, answer))
+	{
+		m_recycler_routing = (unsigned int)m_buffer[0] << 8 | m_buffer[1];
+		m_recycler_supported = true;
+		return true;
+	}
+	return false;
+}
+
+void BillValidator::recycler_status(int it)
+{
+	if (parse_recycler_status(transact(BV_CMD_DISPENSE_STATUS)))
+		return;
+	if (it < MAX_RESET)
+	{
+		wait(50);
+		return recycler_status(++it);
 	}
+	warning << F("BV: RECYCLER STATUS ERROR") << endl;
 }
 
-void BillValidator::type(int bills[], int it)
+//dispenser full flags and number of bills of each type in the recycler
+bool BillValidator::parse_recycler_status(int answer)
 {
-	m_mdb->SendCommand(ADDRESS, TYPE, bills, 4);
-	if (m_mdb->GetResponse() != ACK)
+	if (accepted(BV_CMD_DISPENSE_STATUS, answer))
 	{
-		if (it < MAX_RESET)
+		m_dispenser_full = (unsigned int)m_buffer[0] << 8 | m_buffer[1];
+		for (int i = 0; i < 16; i++)
 		{
-			delay(50);
-			return type(bills, ++it);
+			m_recycler_count[i] = (unsigned int)m_buffer[2 + i * 2] << 8 | m_buffer[3 + i * 2];
 		}
-		warning << F("BV: TYPE ERROR") << endl;
+		recycler_changed();
+		return true;
 	}
+	return false;
 }
 
-void BillValidator::stacker(int it)
+void BillValidator::recycler_changed()
 {
-	int response_size = 2;
-	m_mdb->SendCommand(ADDRESS, STACKER);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer > 0 && m_count == response_size)
+	m_recycler_change = 0;
+	for (int i = 0; i < 16; i++)
 	{
-		m_mdb->Ack();
-		if (m_buffer[0] & 0b10000000)
+		m_recycler_change += (unsigned long)m_recycler_count[i] * m_bill_type_credit[i] * m_bill_scaling_factor;
+	}
+	m_policy.SetNotes(m_recycler_count);
+}
+
+//pays as much of value as possible with recycled notes, returns the value paid out
+unsigned long BillValidator::Dispense(unsigned long value)
+{
+	if (!m_recycler_supported || m_bill_scaling_factor == 0)
+		return 0;
+	recycler_status(); //to get the actual notes in the recycler
+
+	unsigned long payable = 0;
+	for (int i = 15; i >= 0; i--)
+	{
+		unsigned long bill = (unsigned long)m_bill_type_credit[i] * m_bill_scaling_factor;
+		if (bill == 0)
+			continue;
+		unsigned long count = min((value - payable) / bill, (unsigned long)m_recycler_count[i]);
+		payable += count * bill;
+	}
+	if (payable == 0)
+		return 0;
+
+	unsigned int scaled = payable / m_bill_scaling_factor;
+	uint8_t out[] = { uint8_t(scaled >> 8), uint8_t(scaled & 0xff) };
+	if (transact(BV_CMD_DISPENSE_VALUE, out) != ACK)
+	{
+		warning << F("BV: DISPENSE VALUE FAILED") << endl;
+		return 0;
+	}
+	m_payout_busy = true;
+	unsigned long before = m_dispensed_value;
+	recycler_payout_value_poll(payable);
+	unsigned long paid = m_dispensed_value - before;
+	event(EVENT_PAYOUT_COMPLETE, 0, 0, paid);
+	debug << F("BV: dispense: ") << payable << " -> " << paid << endl;
+	return paid;
+}
+
+bool BillValidator::DispenseBill(int type, unsigned int count)
+{
+	if (!m_recycler_supported || !bitRead(m_recycler_routing, type % 16))
+		return false;
+	uint8_t out[] = { uint8_t(type % 16), uint8_t(count >> 8), uint8_t(count & 0xff) };
+	if (transact(BV_CMD_DISPENSE_BILL, out) != ACK)
+	{
+		warning << F("BV: DISPENSE BILL FAILED") << endl;
+		return false;
+	}
+	m_payout_busy = true;
+	unsigned long before = m_dispensed_value;
+	recycler_payout_value_poll((unsigned long)count * m_bill_type_credit[type % 16] * m_bill_scaling_factor);
+	event(EVENT_PAYOUT_COMPLETE, type % 16, 0, m_dispensed_value - before);
+	return true;
+}
+
+//scaled value paid out since the last poll, ACK once the payout is finished.
+//the payout status counts the notes in the end, even after a poll failed.
+//without it the value of the polls counts, and without that the whole
+//requested value: notes may be out, paying them again loses money
+void BillValidator::recycler_payout_value_poll(unsigned long requested)
+{
+	unsigned long paid = 0;
+	int it = 0;
+	for (; it < MAX_PAYOUT_POLL; it++)
+	{
+		int answer = transact(BV_CMD_PAYOUT_VALUE_POLL);
+		if (answer == ACK) //payout finished
+			break;
+		if (!accepted(BV_CMD_PAYOUT_VALUE_POLL, answer))
 		{
-			m_full = true;
+			warning << F("BV: PAYOUT POLL FAILED") << endl;
+			break;
 		}
-		else
-			m_full = false;
-		m_bills_in_stacker = m_buffer[0] & 0b01111111;
-		return;
+		paid += ((unsigned int)m_buffer[0] << 8 | m_buffer[1]) * (unsigned long)m_bill_scaling_factor;
+		event(EVENT_PAYOUT_PROGRESS, 0, 0, paid);
+		wait(50);
 	}
-	if (it < MAX_RESET)
+	if (it == MAX_PAYOUT_POLL)
+		warning << F("BV: PAYOUT POLL TIMEOUT") << endl;
+	if (recycler_payout_status())
+		return;
+
+	m_payout_busy = false;
+	if (paid > 0)
 	{
-		delay(50);
-		return stacker(++it);
+		warning << F("BV: PAYOUT STATUS FAILED, ") << paid << F(" from the polls") << endl;
+		m_dispensed_value += paid;
+		return;
 	}
-	warning << F("BV: STACKER ERROR") << endl;
+	error << F("BV: PAYOUT UNKNOWN, ") << requested << F(" counted as paid") << endl;
+	event(EVENT_FAULT);
+	m_dispensed_value += requested;
 }
 
-void BillValidator::escrow(bool accept, int it)
+//number of bills of each type paid out since the last dispense command,
+//false if the validator does not tell
+bool BillValidator::recycler_payout_status(int it)
 {
-	int data[] = { 0x00 };
-	if (accept)
-		data[0] = 0x01;
-	m_mdb->SendCommand(ADDRESS, ESCROW, data, 1);
-	if (m_mdb->GetResponse() == ACK)
+	int answer = transact(BV_CMD_PAYOUT_STATUS);
+	if (answer == ACK)
 	{
-		m_bill_in_escrow = false;
+		debug << F("BV: payout busy") << endl;
+		if (it < MAX_RESET_POLL)
+		{
+			wait(500);
+			return recycler_payout_status(++it);
+		}
+		return false;
 	}
-	if (it < MAX_RESET)
+	if (accepted(BV_CMD_PAYOUT_STATUS, answer))
 	{
-		delay(50);
-		return escrow(accept, ++it);
+		debug << F("BV: paid out: ");
+		for (int i = 0; i < m_count / 2; i++)
+		{
+			unsigned int count = (unsigned int)m_buffer[i * 2] << 8 | m_buffer[i * 2 + 1];
+			debug << count << " ";
+			if (count == 0)
+				continue;
+			m_dispensed_value += (unsigned long)m_bill_type_credit[i] * m_bill_scaling_factor * count;
+			audit.BillOut(i, count);
+			m_recycler_count[i] -= min(count, m_recycler_count[i]);
+		}
+		debug << endl;
+		recycler_changed();
+		m_payout_busy = false;
+		return true;
 	}
-	error << F("BV: ESCROW ERROR") << endl;
+	return false;
 }
\ No newline at end of file
@@ -1,6 +1,72 @@
 #pragma once
 
 #include "MDBDevice.h"
+#include "EscrowPolicy.h"
+
+#define SECURITY 					0x02
+#define ESCROW 						0x05
+#define STACKER 					0x06
+
+//expansion commands, level 1 identification has no option bits
+#define IDENTIFICATION_OPTIONS 		0x02
+
+//option bits of level 2+ validators
+#define OPTION_FTL 					0x01
+#define OPTION_RECYCLER 			0x02
+
+//expansion commands of level 2 validators with bill recycler
+#define RECYCLER_SETUP 				0x03
+#define RECYCLER_ENABLE 			0x04
+#define BILL_DISPENSE_STATUS 		0x05
+#define DISPENSE_BILL 				0x06
+#define DISPENSE_VALUE 				0x07
+#define BILL_PAYOUT_STATUS 			0x08
+#define BILL_PAYOUT_VALUE_POLL 		0x09
+#define BILL_PAYOUT_CANCEL 			0x0A
+
+//recycler enable value for bill types routed to the recycler
+#define RECYCLER_ENABLED 			0x03
+
+#define RECYCLER_STATUS_UPDATES 	50
+
+//steps of the validator, see MDBDevice::request()
+#define BV_PROBE 					1 	//Reset(): poll until the validator answers
+#define BV_CHECK 					2 	//Reset(): poll before RESET
+#define BV_RESET 					3
+#define BV_JUST_RESET 				4 	//Reset(): poll until JUST RESET
+#define BV_SETUP 					5 	//init after JUST RESET
+#define BV_SECURITY 				6
+#define BV_IDENTIFICATION 			7
+#define BV_FEATURE_ENABLE 			8
+#define BV_RECYCLER_SETUP 			9
+#define BV_RECYCLER_ENABLE 			10
+#define BV_INIT_RECYCLER 			11
+#define BV_POLL 					12 	//poll cycle of Update()
+#define BV_ESCROW 					13
+#define BV_STACKER 					14
+#define BV_RECYCLER 				15
+#define BV_TYPE 					16
+
+//the commands of the validator: command, subcommand, data bytes sent and the
+//answer lengths and flags, see MDBCommand. the data of DIAGNOSTICS is up to the caller
+constexpr MDBCommand BV_CMD_RESET 					= { RESET, NO_SUB, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_SETUP 					= { SETUP, NO_SUB, 0, 27, 27, 0 };
+constexpr MDBCommand BV_CMD_SECURITY 				= { SECURITY, NO_SUB, 2, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_POLL 					= { POLL, NO_SUB, 0, 1, 16, ANSWER_ACK | WINDOW_POLL };
+constexpr MDBCommand BV_CMD_TYPE 					= { TYPE, NO_SUB, 4, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_ESCROW 					= { ESCROW, NO_SUB, 1, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_STACKER 				= { STACKER, NO_SUB, 0, 2, 2, 0 };
+constexpr MDBCommand BV_CMD_IDENTIFICATION 			= { EXPANSION, IDENTIFICATION, 0, 29, 29, 0 };
+constexpr MDBCommand BV_CMD_FEATURE_ENABLE 			= { EXPANSION, FEATURE_ENABLE, 4, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_IDENTIFICATION_OPTIONS 	= { EXPANSION, IDENTIFICATION_OPTIONS, 0, 33, 33, 0 };
+constexpr MDBCommand BV_CMD_RECYCLER_SETUP 			= { EXPANSION, RECYCLER_SETUP, 0, 2, 2, 0 };
+constexpr MDBCommand BV_CMD_RECYCLER_ENABLE 		= { EXPANSION, RECYCLER_ENABLE, 18, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_DISPENSE_STATUS 		= { EXPANSION, BILL_DISPENSE_STATUS, 0, 34, 34, 0 };
+constexpr MDBCommand BV_CMD_DISPENSE_BILL 			= { EXPANSION, DISPENSE_BILL, 3, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_DISPENSE_VALUE 			= { EXPANSION, DISPENSE_VALUE, 2, 0, 0, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_PAYOUT_STATUS 			= { EXPANSION, BILL_PAYOUT_STATUS, 0, 1, 32, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_PAYOUT_VALUE_POLL 		= { EXPANSION, BILL_PAYOUT_VALUE_POLL, 0, 2, 2, ANSWER_ACK };
+constexpr MDBCommand BV_CMD_DIAGNOSTICS 			= { EXPANSION, DIAGNOSTICS, 0, 1, ANSWER_ANY, ANSWER_ACK };
 
 class BillValidator : public MDBDevice
 {
@@ -12,22 +78,58 @@ public:
 	bool Reset();
 	void Print();
 
+	unsigned long Dispense(unsigned long value);
+	bool DispenseBill(int type, unsigned int count);
+	int Diagnostics(int data[], int count, uint8_t response[]);
+
+	//with manual escrow a bill waits in escrow until Escrow() is called,
+	//otherwise the escrow policy decides in Update()
+	bool Escrow(bool accept);
+	inline void SetManualEscrow(bool manual) { m_manual_escrow = manual; }
+	inline bool IsManualEscrow() { return m_manual_escrow; }
+	inline int GetEscrowType() { return m_bill_in_escrow ? m_escrow_type : -1; }
+
+	inline void Enable(bool enable) { m_enabled = enable; }
+	inline bool IsEnabled() { return m_enabled; }
+
 	inline unsigned long GetCredit() { return m_credit; }
 	inline void ClearCredit() { m_credit = 0; }
+	inline unsigned long GetChange() { return m_recycler_change; }
+	inline unsigned long GetDispensedValue() { unsigned long val = m_dispensed_value; m_dispensed_value = 0; return val; }
+	inline bool HasRecycler() { return m_recycler_supported; }
+
+	//bills are enabled and accepted by the change the changer can pay out
+	inline void SetChanger(CoinChanger &changer) { m_policy.SetChanger(&changer); }
+	inline void SetMinPrice(unsigned long price) { m_policy.SetMinPrice(price); }
 
 private:
-	bool init();
-	int poll();
-	bool setup(int it = 0);
-	void security(int it = 0);
-	void type(int bills[], int it = 0);
-	void stacker(int it = 0);
-	void escrow(bool accept, int it = 0);
-
-	int ADDRESS;
-	int SECURITY;
-	int ESCROW;
-	int STACKER;
+	template <class... Devices> friend class BusMaster;
+
+	void reset();
+	void restart();
+	void cycle();
+	bool request();
+	void response(int answer);
+	uint8_t priority();
+	void polled(uint8_t from, int result);
+	void recycler_init();
+	void initialized(bool ok);
+
+	//the parsers ACK good answers and return false for anything else, the
+	//lengths come from the BV_CMD_ commands
+	int parse_poll(int answer);
+	bool parse_setup(int answer);
+	bool parse_stacker(int answer);
+	bool parse_identification(int answer);
+	bool parse_recycler_setup(int answer);
+	bool parse_recycler_status(int answer);
+
+	//blocking, for escrow and payout
+	bool escrow(bool accept, int it = 0);
+	void recycler_status(int it = 0);
+	bool recycler_payout_status(int it = 0);
+	void recycler_payout_value_poll(unsigned long requested);
+	void recycler_changed();
 
 	unsigned long m_change;
 	unsigned long m_credit;
@@ -35,12 +137,31 @@ private:
 	bool m_full;
 	int m_bills_in_stacker;
 	
+	bool m_enabled;
+	bool m_manual_escrow;
 	bool m_bill_in_escrow;
+	int m_escrow_type;
+	EscrowPolicy m_policy;
 
-	char m_bill_scaling_factor;
-	char m_decimal_places;
+	unsigned int m_bill_scaling_factor;
+	uint8_t m_decimal_places;
 	unsigned int m_stacker_capacity;
 	unsigned int m_security_levels;
-	char m_can_escrow;
-	char m_bill_type_credit[16];
-};
+	uint8_t m_can_escrow;
+	uint8_t m_bill_type_credit[16];
+
+	unsigned long m_enabled_features;
+
+	bool m_recycler_supported;
+	bool m_payout_busy;
+	unsigned int m_recycler_routing;
+	unsigned int m_dispenser_full;
+	unsigned int m_recycler_count[16];
+	unsigned long m_recycler_change;
+	unsigned long m_dispensed_value;
+
+	int m_update_count;
+
+	uint8_t m_poll_step; 	//step whose poll answer waits for the init
+	bool m_escrow_accept;
+};
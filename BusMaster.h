@@ -0,0 +1,298 @@
+#pragma once
+
+#include "MDBDevice.h"
+#include "MDBSerial.h"
+#include "CoinChanger.h"
+#include "BillValidator.h"
+#include <limits.h>
+
+//the devices of a BusMaster, one member per type
+template <class... Devices>
+struct BusDevices
+{
+	explicit
+	BusDevices(MDBSerial &) {}
+};
+
+template <class D, class... Rest>
+struct BusDevices<D, Rest...>
+{
+	explicit
+	BusDevices(MDBSerial &mdb) : device(mdb), rest(mdb) {}
+
+	D device;
+	BusDevices<Rest...> rest;
+};
+
+//the device of type T in the list, a type that is not there does not compile
+template <class T, class List>
+struct BusFind;
+
+template <class T, class... Rest>
+struct BusFind<T, BusDevices<T, Rest...> >
+{
+	static T &get(BusDevices<T, Rest...> &list) { return list.device; }
+};
+
+template <class T, class D, class... Rest>
+struct BusFind<T, BusDevices<D, Rest...> >
+{
+	static T &get(BusDevices<D, Rest...> &list) { return BusFind<T, BusDevices<Rest...> >::get(list.rest); }
+};
+
+template <class T, class... Devices>
+struct BusHas
+{
+	static const bool value = false;
+};
+
+template <class T, class D, class... Rest>
+struct BusHas<T, D, Rest...>
+{
+	static const bool value = BusHas<T, Rest...>::value;
+};
+
+template <class T, class... Rest>
+struct BusHas<T, T, Rest...>
+{
+	static const bool value = true;
+};
+
+template <bool>
+struct BusTag {};
+
+//an MDB bus whose devices are known at compile time:
+//
+//  BusMaster<CoinChanger, BillValidator> bus(mdb);
+//  bus.Get<CoinChanger>().Dispense(100);
+//
+//the devices live in the BusMaster, nothing comes from the heap, and every
+//step is called on the class of its device, the loop has no virtual calls.
+//what a missing device would need is not compiled: a changer without a
+//validator has no escrow policy to link, Dispense() has no recycler. a
+//CoinHopper is the one at HOPPER_1 and pays with the changer.
+//it schedules like MDBBus, by priority and deadline, and resets offline
+//devices after their backoff, without the pipeline and the bus reset.
+//one BusMaster per sketch, in place of MDBBus
+template <class... Devices>
+class BusMaster
+{
+public:
+	static const uint8_t COUNT = sizeof...(Devices);
+	static_assert(COUNT > 0 && COUNT <= 8, "BusMaster: 1 to 8 devices");
+
+	explicit
+	BusMaster(MDBSerial &mdb) : m_mdb(&mdb), m_devices(mdb)
+	{
+		m_current = -1;
+		m_next = 0;
+		m_interval = POLL_INTERVAL;
+		m_cycles = 0;
+		s_master = this;
+		MDBSerial::s_idle = idle;
+		add(m_devices);
+		link(BusTag<Has<CoinChanger>() && Has<BillValidator>()>());
+		hopper(BusTag<Has<CoinChanger>() && Has<CoinHopper>()>());
+	}
+
+	template <class T>
+	static constexpr bool Has() { return BusHas<T, Devices...>::value; }
+
+	template <class T>
+	inline T &Get() { return BusFind<T, BusDevices<Devices...> >::get(m_devices); }
+
+	//resets every device side by side, without waiting
+	void Reset() { reset(m_devices); }
+
+	//collects the answer of the running transaction, parses it and starts
+	//the most urgent step of all devices
+	void Update()
+	{
+		if (m_current >= 0)
+		{
+			int answer = m_mdb->Update();
+			if (answer == MDB_BUSY)
+				return;
+			uint8_t current = m_current;
+			m_current = -1;
+			respond(m_devices, current, answer);
+		}
+		//a blocking command has the bus
+		if (m_mdb->IsBlocked() || m_mdb->Busy())
+			return;
+
+		Pick pick = { -1, 0, 0, 0 };
+		offer(m_devices, millis(), &pick);
+		if (pick.index < 0)
+			return;
+		send(m_devices, pick.index);
+		m_current = pick.index;
+		m_next = (pick.index + 1) % COUNT;
+	}
+
+	//change from the recycler first, the changer pays the rest
+	unsigned long Dispense(unsigned long value)
+	{
+		unsigned long paid = recycle(value, BusTag<Has<BillValidator>()>());
+		if (paid < value)
+			paid += payout(value - paid, BusTag<Has<CoinChanger>()>());
+		return paid;
+	}
+
+	inline void SetPollInterval(unsigned int ms) { m_interval = ms; }
+	inline MDBSerial &GetSerial() { return *m_mdb; }
+	inline unsigned long GetCycles() { return m_cycles; }
+	void Print() { print(m_devices); }
+
+private:
+	//the step that goes next
+	struct Pick
+	{
+		int8_t index;
+		uint8_t priority;
+		uint8_t rank; 	//devices after the last one sent come first
+		long slack;
+	};
+
+	//runs the buses while a blocking call waits
+	static void idle()
+	{
+		if (s_master)
+			s_master->Update();
+	}
+
+	template <class D, class... Rest>
+	void add(BusDevices<D, Rest...> &list)
+	{
+		list.device.m_on_bus = true;
+		list.device.m_bus = 0;
+		add(list.rest);
+	}
+	void add(BusDevices<> &) {}
+
+	void link(BusTag<true>) { Get<BillValidator>().SetChanger(Get<CoinChanger>()); }
+	void link(BusTag<false>) {}
+
+	void hopper(BusTag<true>) { Get<CoinChanger>().SetHopper(Get<CoinHopper>()); }
+	void hopper(BusTag<false>) {}
+
+	unsigned long recycle(unsigned long value, BusTag<true>) { return Get<BillValidator>().Dispense(value); }
+	unsigned long recycle(unsigned long, BusTag<false>) { return 0; }
+
+	unsigned long payout(unsigned long value, BusTag<true>)
+	{
+		CoinChanger &changer = Get<CoinChanger>();
+		changer.Dispense(value);
+		return changer.GetPayoutValue();
+	}
+	unsigned long payout(unsigned long, BusTag<false>) { return 0; }
+
+	template <class D, class... Rest>
+	void reset(BusDevices<D, Rest...> &list)
+	{
+		list.device.m_reset_pending = true;
+		reset(list.rest);
+	}
+	void reset(BusDevices<> &) {}
+
+	//an idle device starts its reset or poll cycle, then a ready step is
+	//weighed against the best one so far, as in MDBBus::pick()
+	template <class D, class... Rest>
+	void offer(BusDevices<D, Rest...> &list, unsigned long now, Pick *pick, uint8_t i = 0)
+	{
+		D &device = list.device;
+		if (device.m_step == STEP_IDLE)
+		{
+			if (device.m_reset_pending)
+			{
+				device.m_reset_pending = false;
+				device.D::reset();
+			}
+			else if (device.m_health == DEVICE_OFFLINE)
+			{
+				if (now - device.m_offline_time >= device.m_backoff)
+				{
+					device.m_recoveries++;
+					device.D::reset();
+				}
+			}
+			else if (now - device.m_cycle_time >= m_interval)
+			{
+				device.m_cycle_time = now;
+				device.D::cycle();
+				m_cycles++;
+			}
+		}
+		if (device.ready())
+		{
+			if (!device.D::request())
+				device.m_step = STEP_IDLE;
+			else
+			{
+				uint8_t priority = device.D::priority();
+				uint8_t rank = (i + COUNT - m_next) % COUNT;
+				long slack = LONG_MAX;
+				if (priority == PRIORITY_URGENT)
+					slack = (long)(device.m_step_time + device.m_step_wait + DEADLINE_URGENT - now);
+				else if (priority == PRIORITY_POLL)
+					slack = (long)(device.m_step_time + device.m_step_wait + DEADLINE_POLL - now);
+				if (pick->index < 0 || priority > pick->priority || (priority == pick->priority
+						&& (slack < pick->slack || (slack == pick->slack && rank < pick->rank))))
+				{
+					pick->index = i;
+					pick->priority = priority;
+					pick->rank = rank;
+					pick->slack = slack;
+				}
+			}
+		}
+		offer(list.rest, now, pick, i + 1);
+	}
+	void offer(BusDevices<> &, unsigned long, Pick *, uint8_t = 0) {}
+
+	template <class D, class... Rest>
+	void send(BusDevices<D, Rest...> &list, int8_t index)
+	{
+		if (index > 0)
+			send(list.rest, index - 1);
+		else
+			m_mdb->Start(list.device.m_command, list.device.m_command_count, list.device.m_descriptor);
+	}
+	void send(BusDevices<> &, int8_t) {}
+
+	template <class D, class... Rest>
+	void respond(BusDevices<D, Rest...> &list, uint8_t index, int answer)
+	{
+		if (index > 0)
+		{
+			respond(list.rest, index - 1, answer);
+			return;
+		}
+		D &device = list.device;
+		device.m_count = answer == 1 ? m_mdb->GetCount() : 0;
+		memcpy(device.m_buffer, m_mdb->GetData(), device.m_count);
+		device.D::response(answer);
+		device.track(answer);
+	}
+	void respond(BusDevices<> &, uint8_t, int) {}
+
+	template <class D, class... Rest>
+	void print(BusDevices<D, Rest...> &list)
+	{
+		list.device.D::Print();
+		print(list.rest);
+	}
+	void print(BusDevices<> &) {}
+
+	MDBSerial *m_mdb;
+	BusDevices<Devices...> m_devices;
+	int8_t m_current; 		//device of the running transaction, -1 for none
+	uint8_t m_next;
+	unsigned int m_interval;
+	unsigned long m_cycles;
+
+	static BusMaster *s_master;
+};
+
+template <class... Devices>
+BusMaster<Devices...> *BusMaster<Devices...>::s_master = 0;
@@ -0,0 +1,602 @@
+#include "CashlessReader.h"
+#include "Audit.h"
+#include <Arduino.h>
+
+CashlessReader::CashlessReader(MDBSerial &mdb, uint8_t address) : MDBDevice(mdb)
+{
+	ADDRESS = address;
+
+	m_resetCount = 0;
+
+	m_peer = 0;
+
+	m_enabled = true;
+	m_inhibited = false;
+	m_reader_enabled = false;
+
+	m_scale_factor = 0;
+	m_decimal_places = 0;
+	m_max_response = 0;
+	m_options = 0;
+
+	m_session = SESSION_NONE;
+	m_request = STEP_IDLE;
+	m_refuse = false;
+	m_price = 0;
+	m_item = 0;
+	m_vend_time = 0;
+	m_funds = 0;
+	m_approved = 0;
+
+	m_poll_step = STEP_IDLE;
+}
+
+void CashlessReader::Update()
+{
+	run();
+	cycle();
+	run();
+}
+
+bool CashlessReader::Reset()
+{
+	run();
+	reset();
+	run();
+	return m_result;
+}
+
+void CashlessReader::reset()
+{
+	m_resetCount = 0;
+	m_bus_reset = false;
+	m_reader_enabled = false;
+	end_session();
+	health(DEVICE_RECOVERING);
+	step(CL_PROBE);
+}
+
+//the bus reset is over, the reader only has to report JUST RESET
+void CashlessReader::restart()
+{
+	m_resetCount = 0;
+	m_bus_reset = true;
+	m_reader_enabled = false;
+	end_session();
+	health(DEVICE_RECOVERING);
+	step(CL_JUST_RESET);
+}
+
+//the reader is told first when it has to change its enable, then polled
+void CashlessReader::cycle()
+{
+	bool enable = m_enabled && !m_inhibited;
+	if (enable != m_reader_enabled)
+		step(enable ? CL_ENABLE : CL_DISABLE);
+	else
+		step(CL_POLL);
+}
+
+void CashlessReader::SetPeer(CashlessReader &peer)
+{
+	m_peer = &peer;
+	peer.m_peer = this;
+}
+
+//a vend runs for one session at a time, one command of the application waits
+bool CashlessReader::Vend(unsigned long price, unsigned int item)
+{
+	if (m_session != SESSION_IDLE || m_request != STEP_IDLE || m_scale_factor == 0)
+		return false;
+	m_price = min(price / m_scale_factor, 0xFFFFUL);
+	m_item = item;
+	m_approved = 0;
+	m_session = SESSION_VEND;
+	m_vend_time = millis();
+	queue(CL_VEND);
+	return true;
+}
+
+bool CashlessReader::VendSuccess()
+{
+	if (m_session != SESSION_APPROVED || m_request != STEP_IDLE)
+		return false;
+	m_session = SESSION_IDLE;
+	audit.Vend(m_approved);
+	queue(CL_VEND_SUCCESS);
+	return true;
+}
+
+bool CashlessReader::VendFailure()
+{
+	if (m_session != SESSION_APPROVED || m_request != STEP_IDLE)
+		return false;
+	m_session = SESSION_IDLE;
+	queue(CL_VEND_FAILURE);
+	return true;
+}
+
+bool CashlessReader::CancelVend()
+{
+	if (m_session != SESSION_VEND || m_request != STEP_IDLE)
+		return false;
+	queue(CL_VEND_CANCEL);
+	return true;
+}
+
+bool CashlessReader::EndSession()
+{
+	if (m_session == SESSION_NONE || m_request != STEP_IDLE)
+		return false;
+	queue(CL_SESSION_COMPLETE);
+	return true;
+}
+
+//an idle reader sends the command at once, a busy one after its step.
+//without a bus it runs here
+void CashlessReader::queue(uint8_t next)
+{
+	m_request = next;
+	if (m_step == STEP_IDLE && !m_queued)
+		follow();
+	if (!m_on_bus)
+		run();
+}
+
+void CashlessReader::follow()
+{
+	if (m_refuse)
+	{
+		m_refuse = false;
+		step(CL_SESSION_COMPLETE);
+	}
+	else if (m_request != STEP_IDLE)
+	{
+		uint8_t next = m_request;
+		m_request = STEP_IDLE;
+		step(next);
+	}
+	else if (m_session == SESSION_VEND)
+	{
+		unsigned long timeout = (m_max_response ? m_max_response : CL_VEND_TIMEOUT) * 1000UL;
+		if (millis() - m_vend_time >= timeout)
+		{
+			warning << F("CL: NO VEND APPROVAL") << endl;
+			step(CL_VEND_CANCEL);
+		}
+		else
+			step(CL_POLL, CL_APPROVAL_POLL);
+	}
+	//the peer began its session while this reader was busy
+	else if (m_inhibited && m_reader_enabled)
+		step(CL_DISABLE);
+	else
+		step(STEP_IDLE);
+}
+
+//called by the peer. an idle reader is disabled right away, a busy one after
+//its step
+void CashlessReader::inhibit(bool on)
+{
+	m_inhibited = on;
+	if (m_step == STEP_IDLE && !m_queued && m_scale_factor != 0 && (m_enabled && !on) != m_reader_enabled
+			&& (m_health == DEVICE_ONLINE || m_health == DEVICE_DEGRADED))
+		cycle();
+}
+
+void CashlessReader::end_session()
+{
+	m_request = STEP_IDLE;
+	m_refuse = false;
+	if (m_session == SESSION_NONE)
+		return;
+	m_session = SESSION_NONE;
+	event(EVENT_SESSION_END);
+	if (m_peer)
+		m_peer->inhibit(false);
+}
+
+bool CashlessReader::request()
+{
+	switch (m_step)
+	{
+	case CL_PROBE:
+	case CL_CHECK:
+	case CL_JUST_RESET:
+	case CL_POLL:
+		memset(m_buffer, 0, sizeof(m_buffer));
+		command(CL_CMD_POLL);
+		break;
+	case CL_RESET:
+		command(CL_CMD_RESET);
+		break;
+	case CL_SETUP:
+	{
+		//VMC level 1 without a display
+		uint8_t out[] = { 1, 0, 0, 0 };
+		command(CL_CMD_SETUP, out);
+		break;
+	}
+	case CL_PRICES:
+	{
+		uint8_t out[] = { 0xFF, 0xFF, 0x00, 0x00 };
+		command(CL_CMD_PRICES, out);
+		break;
+	}
+	case CL_ENABLE:
+		command(CL_CMD_ENABLE);
+		break;
+	case CL_DISABLE:
+		command(CL_CMD_DISABLE);
+		break;
+	case CL_VEND:
+	{
+		uint8_t out[] = { uint8_t(m_price >> 8), uint8_t(m_price & 0xff), uint8_t(m_item >> 8), uint8_t(m_item & 0xff) };
+		command(CL_CMD_VEND_REQUEST, out);
+		break;
+	}
+	case CL_VEND_SUCCESS:
+	{
+		uint8_t out[] = { uint8_t(m_item >> 8), uint8_t(m_item & 0xff) };
+		command(CL_CMD_VEND_SUCCESS, out);
+		break;
+	}
+	case CL_VEND_FAILURE:
+		command(CL_CMD_VEND_FAILURE);
+		break;
+	case CL_VEND_CANCEL:
+		command(CL_CMD_VEND_CANCEL);
+		break;
+	case CL_SESSION_COMPLETE:
+		command(CL_CMD_SESSION_COMPLETE);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void CashlessReader::response(int answer)
+{
+	switch (m_step)
+	{
+	case CL_PROBE:
+	case CL_CHECK:
+	case CL_JUST_RESET:
+	case CL_POLL:
+	{
+		int result = parse_poll(answer);
+		if (result == JUST_RESET)
+		{
+			//the poll counts once the reader is set up again
+			m_poll_step = m_step;
+			step(CL_SETUP);
+		}
+		else
+			polled(m_step, result);
+		break;
+	}
+
+	case CL_RESET:
+		if (answer == ACK)
+		{
+			m_resetCount = 0;
+			step(CL_JUST_RESET);
+		}
+		else
+		{
+			m_resetCount++;
+			step(CL_CHECK, 100);
+		}
+		break;
+
+	case CL_SETUP:
+		if (accepted(CL_CMD_SETUP, answer) && parse_config(m_buffer))
+			step(CL_PRICES);
+		else if (!retry())
+		{
+			error << F("CL: SETUP ERROR") << endl;
+			initialized(false);
+		}
+		break;
+
+	case CL_PRICES:
+		if (answer != ACK && retry())
+			break;
+		if (answer != ACK)
+			warning << F("CL: MAX/MIN PRICES ERROR") << endl;
+		Print();
+		debug << F("CL: INIT COMPLETED") << endl;
+		initialized(true);
+		break;
+
+	//sent again by the next poll cycle when it failed
+	case CL_ENABLE:
+	case CL_DISABLE:
+		if (answer != ACK && retry())
+			break;
+		if (answer == ACK)
+		{
+			m_reader_enabled = m_step == CL_ENABLE;
+			step(CL_POLL);
+		}
+		else
+		{
+			warning << F("CL: READER ENABLE ERROR") << endl;
+			step(STEP_IDLE);
+		}
+		break;
+
+	//an answer with data is what the next poll would report, an
+	//approval may come right away
+	case CL_VEND:
+		if (answer != ACK && parse_poll(answer) < 0)
+		{
+			if (retry())
+				break;
+			warning << F("CL: VEND REQUEST FAILED") << endl;
+			m_session = SESSION_IDLE;
+			event(EVENT_VEND_DENIED);
+		}
+		follow();
+		break;
+
+	case CL_VEND_SUCCESS:
+	case CL_VEND_FAILURE:
+		if (answer != ACK && retry())
+			break;
+		if (answer != ACK)
+			warning << F("CL: VEND RESULT ERROR") << endl;
+		follow();
+		break;
+
+	//the reader denies the vend, with its answer or in a poll
+	case CL_VEND_CANCEL:
+		if (answer != ACK && parse_poll(answer) < 0 && retry())
+			break;
+		if (m_session == SESSION_VEND)
+		{
+			m_session = SESSION_IDLE;
+			event(EVENT_VEND_DENIED);
+		}
+		follow();
+		break;
+
+	//END SESSION comes with the answer or in a poll
+	case CL_SESSION_COMPLETE:
+		if (answer != ACK && parse_poll(answer) < 0 && retry())
+			break;
+		follow();
+		break;
+	}
+}
+
+//the customer waits for an approval and for the other reader to go off
+uint8_t CashlessReader::priority()
+{
+	if (m_step == CL_VEND || m_step == CL_DISABLE || (m_step == CL_POLL && m_session == SESSION_VEND))
+		return PRIORITY_URGENT;
+	return PRIORITY_POLL;
+}
+
+//what a poll answer means depends on the step that sent it, as for the changer
+void CashlessReader::polled(uint8_t from, int result)
+{
+	switch (from)
+	{
+	case CL_PROBE:
+		if (result >= 0)
+		{
+			m_resetCount = 0;
+			step(CL_CHECK);
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("CL: NOT CONNECTED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(CL_PROBE, 100);
+		}
+		break;
+
+	case CL_CHECK:
+		if (result > 0 && m_resetCount < MAX_RESET_POLL)
+			step(CL_RESET);
+		else
+		{
+			debug << F("CL: RESET FAILED") << endl;
+			done(false);
+		}
+		break;
+
+	case CL_JUST_RESET:
+		if (result == JUST_RESET)
+		{
+			debug << F("CL: RESET COMPLETED") << endl;
+			done(true);
+		}
+		else if (m_resetCount > MAX_RESET_POLL && m_bus_reset)
+		{
+			warning << F("CL: NO JUST RESET AFTER BUS RESET") << endl;
+			reset();
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("CL: NO JUST RESET RECEIVED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(CL_JUST_RESET, 100);
+		}
+		break;
+
+	case CL_POLL:
+		follow();
+		break;
+	}
+}
+
+//end of the init after JUST RESET, back to the step that polled
+void CashlessReader::initialized(bool ok)
+{
+	uint8_t from = m_poll_step;
+	m_poll_step = STEP_IDLE;
+	polled(from, ok ? JUST_RESET : 1);
+}
+
+//returns JUST_RESET if the reader has to be set up again. the records of a
+//level 1 reader, the ones after one this driver does not know are skipped
+int CashlessReader::parse_poll(int answer)
+{
+	bool reset = false;
+	if (answer == ACK)
+		return 1;
+	if (!accepted(CL_CMD_POLL, answer))
+		return -1;
+
+	for (int i = 0; i < m_count;)
+	{
+		uint8_t *record = m_buffer + i;
+		int length;
+		switch (record[0])
+		{
+		case 0x01:
+			length = 8;
+			break;
+		case 0x02:
+			length = 34;
+			break;
+		case 0x03:
+		case 0x05:
+			length = 3;
+			break;
+		case 0x09:
+			length = 30;
+			break;
+		case 0x0A:
+			length = 2;
+			break;
+		default:
+			length = 1;
+		}
+		if (i + length > m_count)
+		{
+			warning << F("CL: poll response truncated") << endl;
+			break;
+		}
+		i += length;
+
+		switch (record[0])
+		{
+		case 0x00:
+			event(EVENT_RESET);
+			reset = true;
+			break;
+		case 0x01:
+			parse_config(record);
+			break;
+		case 0x02:
+			debug << F("CL: display request") << endl;
+			break;
+		//a session on the peer keeps this one from beginning
+		case 0x03:
+			if (m_peer && m_peer->m_session != SESSION_NONE)
+			{
+				warning << F("CL: session refused, other reader in session") << endl;
+				m_refuse = true;
+				break;
+			}
+			m_session = SESSION_IDLE;
+			m_funds = (unsigned long)(record[1] << 8 | record[2]) * m_scale_factor;
+			debug << F("CL: begin session ") << m_funds << endl;
+			event(EVENT_SESSION_BEGIN, 0, 0, m_funds);
+			if (m_peer)
+				m_peer->inhibit(true);
+			break;
+		case 0x04:
+			debug << F("CL: session cancel request") << endl;
+			event(EVENT_SESSION_CANCEL);
+			if (m_session == SESSION_IDLE)
+				m_request = CL_SESSION_COMPLETE;
+			break;
+		case 0x05:
+			if (m_session != SESSION_VEND)
+				break;
+			m_session = SESSION_APPROVED;
+			m_approved = (unsigned long)(record[1] << 8 | record[2]) * m_scale_factor;
+			debug << F("CL: vend approved ") << m_approved << endl;
+			event(EVENT_VEND_APPROVED, 0, 0, m_approved);
+			break;
+		case 0x06:
+			if (m_session != SESSION_VEND)
+				break;
+			m_session = SESSION_IDLE;
+			debug << F("CL: vend denied") << endl;
+			event(EVENT_VEND_DENIED);
+			break;
+		case 0x07:
+			debug << F("CL: end session") << endl;
+			end_session();
+			break;
+		case 0x08:
+			debug << F("CL: cancelled") << endl;
+			break;
+		case 0x09:
+			debug << F("CL: peripheral id") << endl;
+			break;
+		case 0x0A:
+			error << F("CL: malfunction ") << (int)record[1] << endl;
+			event(EVENT_FAULT, record[1]);
+			break;
+		case 0x0B:
+			warning << F("CL: command out of sequence") << endl;
+			event(EVENT_FAULT, record[0]);
+			break;
+		default:
+			debug << F("CL: default: ") << (int)record[0] << endl;
+			i = m_count;
+		}
+	}
+	if (reset)
+	{
+		//the reader is disabled and out of its session after a reset
+		m_reader_enabled = false;
+		end_session();
+		return JUST_RESET;
+	}
+	return 1;
+}
+
+//reader config data: level, country, scale factor, decimal places, the
+//longest time for an answer and the options
+bool CashlessReader::parse_config(const uint8_t *config)
+{
+	if (config[0] != 0x01)
+		return false;
+	m_feature_level = config[1];
+	m_country = config[2] << 8 | config[3];
+	m_scale_factor = config[4];
+	m_decimal_places = config[5];
+	m_max_response = config[6];
+	m_options = config[7];
+	return true;
+}
+
+void CashlessReader::Print()
+{
+	debug << F("## CashlessReader ##") << endl;
+	debug << F("address: ") << ADDRESS << endl;
+	debug << F("country: ") << m_country << endl;
+	debug << F("feature level: ") << (int)m_feature_level << endl;
+	debug << F("scale factor: ") << (int)m_scale_factor << endl;
+	debug << F("decimal places: ") << (int)m_decimal_places << endl;
+	debug << F("max response time: ") << (int)m_max_response << endl;
+	debug << F("options: ") << (int)m_options << endl;
+	debug << F("session: ") << (int)m_session << endl;
+	debug << F("###") << endl;
+}
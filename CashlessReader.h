@@ -0,0 +1,150 @@
+#pragma once
+
+#include "MDBDevice.h"
+
+//addresses of cashless device 1 and 2
+#define CASHLESS_1 					0x10
+#define CASHLESS_2 					0x60
+
+//commands of a cashless device, POLL has another offset than on the changer
+#define CASHLESS_POLL 				0x02
+#define VEND 						0x03
+#define READER 						0x04
+
+//subcommands of SETUP, VEND and READER
+#define CONFIG_DATA 				0x00
+#define MAX_MIN_PRICES 				0x01
+#define VEND_REQUEST 				0x00
+#define VEND_CANCEL 				0x01
+#define VEND_SUCCESS 				0x02
+#define VEND_FAILURE 				0x03
+#define SESSION_COMPLETE 			0x04
+#define READER_DISABLE 				0x00
+#define READER_ENABLE 				0x01
+
+//state of the session of a reader
+#define SESSION_NONE 				0
+#define SESSION_IDLE 				1 	//begun, no vend running
+#define SESSION_VEND 				2 	//the vend waits for approval
+#define SESSION_APPROVED 			3 	//until VendSuccess() or VendFailure()
+
+//ms between two polls while a vend waits for approval
+#define CL_APPROVAL_POLL 			10
+//s a vend waits for approval when the reader gives no time of its own
+#define CL_VEND_TIMEOUT 			30
+
+//steps of the reader, see MDBDevice::request()
+#define CL_PROBE 					1 	//Reset(): poll until the reader answers
+#define CL_CHECK 					2 	//Reset(): poll before RESET
+#define CL_RESET 					3
+#define CL_JUST_RESET 				4 	//Reset(): poll until JUST RESET
+#define CL_SETUP 					5 	//init after JUST RESET
+#define CL_PRICES 					6
+#define CL_ENABLE 					7
+#define CL_DISABLE 					8
+#define CL_POLL 					9 	//poll cycle of Update(), also for the approval
+#define CL_VEND 					10
+#define CL_VEND_SUCCESS 			11
+#define CL_VEND_FAILURE 			12
+#define CL_VEND_CANCEL 				13
+#define CL_SESSION_COMPLETE 		14
+
+//the commands of the reader: command, subcommand, data bytes sent and the
+//answer lengths and flags, see MDBCommand. a reader may answer VEND with
+//what it would report in the next poll
+constexpr MDBCommand CL_CMD_RESET 				= { RESET, NO_SUB, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_SETUP 				= { SETUP, CONFIG_DATA, 4, 8, 8, 0 };
+constexpr MDBCommand CL_CMD_PRICES 				= { SETUP, MAX_MIN_PRICES, 4, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_POLL 				= { CASHLESS_POLL, NO_SUB, 0, 1, DATA_MAX, ANSWER_ACK | WINDOW_POLL };
+constexpr MDBCommand CL_CMD_VEND_REQUEST 		= { VEND, VEND_REQUEST, 4, 1, DATA_MAX, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_VEND_CANCEL 		= { VEND, VEND_CANCEL, 0, 1, DATA_MAX, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_VEND_SUCCESS 		= { VEND, VEND_SUCCESS, 2, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_VEND_FAILURE 		= { VEND, VEND_FAILURE, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_SESSION_COMPLETE 	= { VEND, SESSION_COMPLETE, 0, 1, DATA_MAX, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_DISABLE 			= { READER, READER_DISABLE, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CL_CMD_ENABLE 				= { READER, READER_ENABLE, 0, 0, 0, ANSWER_ACK };
+
+//level 1 cashless reader at CASHLESS_1 or CASHLESS_2. the calls for a
+//session only queue a command, the reader sends it as its next step and the
+//outcome comes as an event. two readers linked with SetPeer() never have a
+//session at the same time: a session on one disables the other within one
+//poll cycle, a session the other one begins meanwhile is ended at once.
+//without an MDBBus Update() runs a vend until it is approved or denied
+class CashlessReader : public MDBDevice
+{
+public:
+	CashlessReader(MDBSerial &mdb, uint8_t address = CASHLESS_1);
+
+	bool Reset();
+
+	//runs one poll cycle, on an MDBBus the bus runs it
+	void Update();
+	void Print();
+
+	inline void Enable(bool enable) { m_enabled = enable; }
+	inline bool IsEnabled() { return m_enabled; }
+	//links the two readers of a machine both ways
+	void SetPeer(CashlessReader &peer);
+
+	//asks for approval of price in a session, EVENT_VEND_APPROVED or
+	//EVENT_VEND_DENIED follows. false outside of a session or while a vend runs
+	bool Vend(unsigned long price, unsigned int item);
+	//the approved product was handed out or not, the reader refunds it then
+	bool VendSuccess();
+	bool VendFailure();
+	//withdraws a vend that waits for approval
+	bool CancelVend();
+	//the machine is done with the session, EVENT_SESSION_END follows
+	bool EndSession();
+
+	inline uint8_t GetSession() { return m_session; }
+	inline unsigned long GetFunds() { return m_funds; }
+	inline unsigned long GetApprovedValue() { return m_approved; }
+
+private:
+	template <class... Devices> friend class BusMaster;
+
+	void reset();
+	void restart();
+	void cycle();
+	bool request();
+	void response(int answer);
+	uint8_t priority();
+	void polled(uint8_t from, int result);
+	void initialized(bool ok);
+
+	//the next step of a reader that is set up: a queued command, the poll
+	//for an approval or none
+	void follow();
+	void queue(uint8_t next);
+	//the peer has a session, this reader has to stay disabled
+	void inhibit(bool on);
+	void end_session();
+
+	//the parsers ACK good answers and return false for anything else, the
+	//lengths come from the CL_CMD_ commands
+	int parse_poll(int answer);
+	bool parse_config(const uint8_t *config);
+
+	CashlessReader *m_peer;
+
+	bool m_enabled; 		//by the application
+	bool m_inhibited; 		//by the peer
+	bool m_reader_enabled; 	//as the reader was told
+
+	uint8_t m_scale_factor;
+	uint8_t m_decimal_places;
+	uint8_t m_max_response; //s the reader may take for an approval
+	uint8_t m_options;
+
+	uint8_t m_session;
+	uint8_t m_request; 		//step queued by the application, STEP_IDLE for none
+	bool m_refuse; 			//a session begun while the peer had one
+	unsigned int m_price; 	//scaled
+	unsigned int m_item;
+	unsigned long m_vend_time;
+	unsigned long m_funds;
+	unsigned long m_approved;
+
+	uint8_t m_poll_step; 	//step whose poll answer waits for the init
+};
@@ -1,12 +1,12 @@
 #include "CoinChanger.h"
+#include "Audit.h"
 #include <Arduino.h>
 
 CoinChanger::CoinChanger(MDBSerial &mdb) : MDBDevice(mdb)
 {
 	ADDRESS = 0x08;
-	STATUS = 0x02;
-	DISPENSE = 0x05;
 	
+	m_enabled = true;
 	m_acceptedCoins = 0xFFFF; //all coins enabled by default
 	m_dispenseableCoins = 0xFFFF;
 	
@@ -24,7 +24,6 @@ CoinChanger::CoinChanger(MDBSerial &mdb) : MDBDevice(mdb)
 	}
 	m_tube_full_status = 0;
 	
-	m_software_version = 0;
 	m_optional_features = 3;
 	
 	m_alternative_payout_supported = false;
@@ -33,87 +32,332 @@ CoinChanger::CoinChanger(MDBSerial &mdb) : MDBDevice(mdb)
 	m_file_transport_layer_supported = false;
 	
 	m_update_count = 0;
+	m_inventory_version = 0;
 	
 	m_value_to_dispense = 0;
 	m_dispensed_value = 0;
+	m_payout_value = 0;
+
+	m_poll_step = STEP_IDLE;
+	m_reinit = false;
+	m_hopper_count = 0;
 }
 
+//runs one poll cycle, on an MDBBus the bus runs it
 void CoinChanger::Update(unsigned long &change)
 {
-	poll();
-	tube_status();
+	run();
+	cycle();
+	run();
 	change = m_change;
-	
-	if ((m_update_count % 50) == 0)
+}
+
+bool CoinChanger::Reset()
+{
+	run();
+	reset();
+	run();
+	return m_result;
+}
+
+void CoinChanger::reset()
+{
+	m_resetCount = 0;
+	m_bus_reset = false;
+	health(DEVICE_RECOVERING);
+	step(CC_PROBE);
+}
+
+//the bus reset is over, the changer only has to report JUST RESET
+void CoinChanger::restart()
+{
+	m_resetCount = 0;
+	m_bus_reset = true;
+	health(DEVICE_RECOVERING);
+	step(CC_JUST_RESET);
+}
+
+void CoinChanger::cycle()
+{
+	if (m_reinit)
+	{
+		m_poll_step = CC_POLL;
+		step(CC_SETUP);
+	}
+	else
+		step(CC_POLL);
+}
+
+bool CoinChanger::request()
+{
+	switch (m_step)
 	{
-		if (m_feature_level >= 3)
+	case CC_PROBE:
+	case CC_CHECK:
+	case CC_JUST_RESET:
+	case CC_POLL:
+		memset(m_buffer, 0, sizeof(m_buffer));
+		command(CC_CMD_POLL);
+		break;
+	case CC_RESET:
+		command(CC_CMD_RESET);
+		break;
+	case CC_SETUP:
+		command(CC_CMD_SETUP);
+		break;
+	case CC_IDENTIFICATION:
+		command(CC_CMD_IDENTIFICATION);
+		break;
+	case CC_FEATURE_ENABLE:
+	{
+		uint8_t out[] = { 0x00, 0x00, 0x00, 0x03 };
+		command(CC_CMD_FEATURE_ENABLE, out);
+		break;
+	}
+	case CC_INIT_TUBES:
+	case CC_TUBES:
+		command(CC_CMD_TUBE_STATUS);
+		break;
+	case CC_DIAGNOSTICS:
+		command(CC_CMD_DIAGNOSTICS);
+		break;
+	case CC_TYPE:
+	{
+		unsigned int accepted = m_enabled ? m_acceptedCoins : 0;
+		uint8_t out[] = { uint8_t((accepted & 0xff00) >> 8), 
+						uint8_t(accepted & 0xff), 
+						uint8_t((m_dispenseableCoins & 0xff00) >> 8), 
+						uint8_t(m_dispenseableCoins & 0xff) };
+		command(CC_CMD_TYPE, out);
+		break;
+	}
+	default:
+		return false;
+	}
+	return true;
+}
+
+void CoinChanger::response(int answer)
+{
+	switch (m_step)
+	{
+	case CC_PROBE:
+	case CC_CHECK:
+	case CC_JUST_RESET:
+	case CC_POLL:
+	{
+		bool busy = false;
+		int result = parse_poll(answer, &busy);
+		if (result == JUST_RESET)
 		{
-			expansion_send_diagnostic_status();
+			//the poll counts once the changer is set up again
+			m_poll_step = m_step;
+			step(CC_SETUP);
 		}
-		m_update_count = 0;
+		else
+			polled(m_step, result, busy);
+		break;
+	}
+
+	case CC_RESET:
+		if (answer == ACK)
+		{
+			m_resetCount = 0;
+			step(CC_JUST_RESET);
+		}
+		else
+		{
+			m_resetCount++;
+			step(CC_CHECK, 100);
+		}
+		break;
+
+	case CC_SETUP:
+		if (parse_setup(answer))
+			step(m_feature_level >= 3 ? CC_IDENTIFICATION : CC_INIT_TUBES);
+		else if (!retry())
+		{
+			error << F("CC: SETUP ERROR") << endl;
+			initialized(false);
+		}
+		break;
+
+	case CC_IDENTIFICATION:
+		if (parse_identification(answer))
+			step(CC_FEATURE_ENABLE);
+		else if (!retry())
+		{
+			error << F("CC: EXP ID ERROR") << endl;
+			step(CC_FEATURE_ENABLE);
+		}
+		break;
+
+	case CC_FEATURE_ENABLE:
+		if (answer == ACK)
+			step(CC_INIT_TUBES);
+		else if (!retry())
+		{
+			error << F("CC: EXP FEATURE ENABLE ERROR") << endl;
+			step(CC_INIT_TUBES);
+		}
+		break;
+
+	case CC_INIT_TUBES:
+	case CC_TUBES:
+		if (!parse_tubes(answer))
+		{
+			if (retry())
+				break;
+			warning << F("CC: STATUS ERROR") << endl;
+		}
+		if (m_step == CC_INIT_TUBES)
+		{
+			Print();
+			debug << F("CC: INIT COMPLETED") << endl;
+			initialized(true);
+		}
+		else if ((m_update_count % 50) == 0)
+		{
+			m_update_count = 0;
+			step(m_feature_level >= 3 ? CC_DIAGNOSTICS : CC_TYPE);
+		}
+		else
+			step(CC_TYPE);
+		break;
+
+	//should be send by the vmc every 1-10 seconds
+	case CC_DIAGNOSTICS:
+		if (parse_diagnostics(answer) <= 0 || !retry(1000))
+			step(CC_TYPE);
+		break;
+
+	case CC_TYPE:
+		if (answer != ACK && retry())
+			break;
+		if (answer != ACK)
+			error << F("CC: TYPE ERROR") << endl;
+		m_update_count++;
+		step(STEP_IDLE);
+		break;
 	}
-	
-	type();
-	
-	m_update_count++;
 }
 
-bool CoinChanger::Reset()
+//the payout is blocking and has the bus anyway
+uint8_t CoinChanger::priority()
 {
-	int count = 0;
-	//wait for CC to response
-	while (poll() < 0)
+	return m_step == CC_TUBES || m_step == CC_DIAGNOSTICS ? PRIORITY_BACKGROUND : PRIORITY_POLL;
+}
+
+//what a poll answer means depends on the step that sent it
+void CoinChanger::polled(uint8_t from, int result, bool busy)
+{
+	switch (from)
 	{
-		if (count > MAX_RESET_POLL)
+	//wait for CC to response
+	case CC_PROBE:
+		if (result >= 0)
+		{
+			m_resetCount = 0;
+			step(CC_CHECK);
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
 		{
 			debug << F("CC: NOT CONNECTED") << endl;
-			return false;
+			done(false);
 		}
-		delay(100);
-		count++;
-	}
-	
-	count = 0;
+		else
+		{
+			m_resetCount++;
+			step(CC_PROBE, 100);
+		}
+		break;
 
 	//wait for CC to power up
-	while (poll() > 0 && count < MAX_RESET_POLL)
-	{
-		m_mdb->SendCommand(ADDRESS, RESET);
-		if ((m_mdb->GetResponse() == ACK))
-		{	
-			int count2 = 0;
-			while (poll() != JUST_RESET) 
-			{
-				if (count2 > MAX_RESET_POLL)
-				{
-					debug << F("CC: NO JUST RESET RECEIVED") << endl;
-					return false;
-				}
-				delay(100);
-				count2++;
-			}
+	case CC_CHECK:
+		if (result > 0 && m_resetCount < MAX_RESET_POLL)
+			step(CC_RESET);
+		else
+		{
+			debug << F("CC: RESET FAILED") << endl;
+			done(false);
+		}
+		break;
+
+	case CC_JUST_RESET:
+		if (result == JUST_RESET)
+		{
 			debug << F("CC: RESET COMPLETED") << endl;
-			return true;
+			done(true);
+		}
+		else if (m_resetCount > MAX_RESET_POLL && m_bus_reset)
+		{
+			warning << F("CC: NO JUST RESET AFTER BUS RESET") << endl;
+			reset();
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("CC: NO JUST RESET RECEIVED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(CC_JUST_RESET, 100);
 		}
-		count++;
-		delay(100);
+		break;
+
+	case CC_POLL:
+		step(CC_TUBES, busy ? 50 : 0);
+		break;
 	}
-	debug << F("CC: RESET FAILED") << endl;
-	return false;
 }
 
-bool CoinChanger::init()
+//end of the init after JUST RESET, back to the step that polled
+void CoinChanger::initialized(bool ok)
 {
-	if (!setup())
+	m_reinit = false;
+	polled(m_poll_step, ok ? JUST_RESET : 1, false);
+}
+
+bool CoinChanger::SetHopper(CoinHopper &hopper)
+{
+	if (m_hopper_count >= CC_HOPPERS)
 		return false;
-	tube_status();
-	Print();
-	debug << F("CC: INIT COMPLETED") << endl;
+	m_hoppers[m_hopper_count++] = &hopper;
 	return true;
 }
 
-
+//the hoppers pay while the changer does, on an MDBBus their payout status is
+//polled between the commands of the changer. what a hopper is known not to
+//have paid the changer pays at the end, an unknown payout counts as paid
 bool CoinChanger::Dispense(unsigned long value)
+{
+	m_payout_value = 0;
+	unsigned long share[CC_HOPPERS];
+	unsigned long rest = value;
+	for (uint8_t i = 0; i < m_hopper_count; i++)
+	{
+		share[i] = m_hoppers[i]->Payout(rest);
+		rest -= share[i];
+	}
+	bool result = rest == 0 || dispense_value(rest);
+	unsigned long missing = 0;
+	for (uint8_t i = 0; i < m_hopper_count; i++)
+	{
+		if (share[i] == 0)
+			continue;
+		unsigned long paid = m_hoppers[i]->WaitPayout();
+		m_payout_value += paid;
+		if (paid < share[i])
+			missing += share[i] - paid;
+	}
+	if (missing > 0)
+		result = dispense_value(missing) && result;
+	event(EVENT_PAYOUT_COMPLETE, 0, 0, m_payout_value);
+	return result;
+}
+
+bool CoinChanger::dispense_value(unsigned long value, int it)
 {
 	tube_status(); //to get actual available change
 	//to make sure we have a value even to 5c
@@ -122,9 +366,12 @@ bool CoinChanger::Dispense(unsigned long value)
 
 	if (m_change < value)
 	{
-		Dispense(m_change);
+		if (m_change > 0 && it < MAX_RESET)
+			dispense_value(m_change, ++it);
 		return false;
 	}
+	if (m_coin_scaling_factor == 0)
+		return false;
 	m_value_to_dispense = value;
 	int val = value / m_coin_scaling_factor;
 
@@ -138,6 +385,8 @@ bool CoinChanger::Dispense(unsigned long value)
 		bool dispensed_anything = false;
 		for (int i = 15; i >= 0; i--) // since we have 6 tubes
 		{
+			if (m_coin_type_credit[i] == 0)
+				continue;
 			int count = m_value_to_dispense / (m_coin_type_credit[i] * m_coin_scaling_factor);
 			count = min(count, m_tube_status[i]); //check if sufficient coins in tube
 			if (count <= 0)
@@ -155,10 +404,10 @@ bool CoinChanger::Dispense(unsigned long value)
 		if (m_value_to_dispense == 0)
 			return true;
 		
-		if (dispensed_anything)
+		if (dispensed_anything && it < MAX_RESET)
 		{
 			m_value_to_dispense += 5;
-			return Dispense(m_value_to_dispense);
+			return dispense_value(m_value_to_dispense, ++it);
 		}
 	}
 	return false;
@@ -170,13 +419,15 @@ bool CoinChanger::dispense(int coin, int count)
 	tube_status();
 	if (count > m_tube_status[coin])
 		return false;
-	int out = (count << 4) | coin;
-	m_mdb->SendCommand(ADDRESS, DISPENSE, &out, 1);
-	if (m_mdb->GetResponse() != ACK)
+	uint8_t out = (count << 4) | coin;
+	if (transact(CC_CMD_DISPENSE, &out) != ACK)
 	{
 		warning << F("CC: DISPENSE FAILED") << endl;
 		return false;
 	}
+	audit.CoinOut(coin, count);
+	m_payout_value += (unsigned long)count * m_coin_type_credit[coin] * m_coin_scaling_factor;
+	event(EVENT_PAYOUT_PROGRESS, 0, 0, m_payout_value);
 	poll(); //wait for dispense to finish
 	return true;
 }
@@ -207,8 +458,7 @@ void CoinChanger::Print()
     }
 	debug << endl;
 	
-	debug << F("software version: ") << m_software_version << endl;
-	debug << F("optional features: ") << m_optional_features << endl;
+	print_identification();
 	debug << F("alternative payout supported: ") << (bool)m_alternative_payout_supported << endl;
 	debug << F("extended diagnostic supported: ") << (bool)m_extended_diagnostic_supported << endl;
 	debug << F("mauall fill and payout supported: ") << (bool)m_manual_fill_and_payout_supported << endl;
@@ -216,55 +466,71 @@ void CoinChanger::Print()
 	debug << F("######") << endl;
 }
 
+//a JUST RESET during the payout is set up by the next poll cycle
 int CoinChanger::poll()
 {
-	int response_size = 16;
-	bool reset = false;
-	bool payout_busy = false;
 	bool busy = false;
-	for (int i = 0; i < 64; i++)
-		m_buffer[i] = 0;
-	m_mdb->SendCommand(ADDRESS, POLL);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
+	memset(m_buffer, 0, sizeof(m_buffer));
+	int result = parse_poll(transact(CC_CMD_POLL), &busy);
+	if (result == JUST_RESET)
+		m_reinit = true;
+	if (busy)
+		wait(50);
+	return result;
+}
+
+//returns JUST_RESET if the changer has to be set up again
+int CoinChanger::parse_poll(int answer, bool *busy)
+{
+	bool reset = false;
 	if (answer == ACK)
 	{
 		debug << F("CC: poll got ack") << endl;
 		return 1;
 	}
-
-	if (answer > 0 && m_count > 0)
-	{
-		m_mdb->Ack();
-	}
-	else
+	if (!accepted(CC_CMD_POLL, answer))
 		return -1;
 	
-	//max of 16 bytes as response
-	for (int i = 0; i < m_count && i < response_size; i++)
+	for (int i = 0; i < m_count; i++)
 	{
 		//coins dispensed manually
 		if (m_buffer[i] & 0b10000000)
 		{
-			
+			if (i + 1 >= m_count)
+			{
+				warning << F("CC: poll response truncated") << endl;
+				break;
+			}
 			int count = (m_buffer[i] & 0b01110000) >> 4;
 			int type = m_buffer[i] & 0b00001111;
 			int coins_in_tube = m_buffer[i + 1];
+			audit.CoinOut(type, count, true);
+			event(EVENT_COINS_DISPENSED, type, count, (unsigned long)count * m_coin_type_credit[type] * m_coin_scaling_factor);
 
 			i++; //cause we used 2 bytes
 		}
 		//coins deposited
 		else if (m_buffer[i] & 0b01000000)
 		{
+			if (i + 1 >= m_count)
+			{
+				warning << F("CC: poll response truncated") << endl;
+				break;
+			}
 			int routing = (m_buffer[i] & 0b00110000) >> 4;
 			int type = m_buffer[i] & 0b00001111;
 			int those_coins_in_tube = m_buffer[i + 1];
+			audit.CoinIn(type, routing);
+			unsigned int value = (unsigned int)m_coin_type_credit[type] * m_coin_scaling_factor;
 			if (routing < 2)
 			{
-				m_credit += (m_coin_type_credit[type] * m_coin_scaling_factor);
+				m_credit += value;
+				event(EVENT_COIN_ACCEPTED, type, routing, value);
 			}
 			else
 			{
 				debug << F("CC: coin rejected") << endl;
+				event(EVENT_COIN_REJECTED, type, routing, value);
 			}
 			i++; //cause we used 2 bytes
 		}
@@ -272,6 +538,8 @@ int CoinChanger::poll()
 		else if (m_buffer[i] & 0b00100000)
 		{
 			int slug_count = m_buffer[i] & 0b00011111;
+			audit.Slugs(slug_count);
+			event(EVENT_SLUG, 0, 0, slug_count);
 			debug << F("CC: slug") << endl;
 		}
 		//status
@@ -284,39 +552,46 @@ int CoinChanger::poll()
 				break;
 			case 2:
 				warning << F("CC: changer payout busy") << endl;
-				payout_busy = true;
+				*busy = true;
 				break;
 			case 3:
 				debug << F("CC: no credit") << endl;
 				break;
 			case 4:
 				error << F("CC: defective tube sensor") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 5:
 				debug << F("CC: double arrival") << endl;
 				break;
 			case 6:
 				debug << F("CC: acceptor unplugged") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 7:
 				debug << F("CC: tube jam") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 8:
 				warning << F("CC: ROM checksum error") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 9:
 				debug << F("CC: coin routing error") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 10:
 				debug << F("CC: changer busy") << endl;
-				busy = true;
+				*busy = true;
 				break;
 			case 11:
 				//debug << F("CC: changer was reset") << endl;
+				event(EVENT_RESET);
 				reset = true;
 				break;
 			case 12:
 				warning << F("CC: coin jam") << endl;
+				event(EVENT_FAULT, m_buffer[i]);
 				break;
 			case 13:
 				debug << F("CC: possible credited coin removal") << endl;
@@ -324,30 +599,20 @@ int CoinChanger::poll()
 			default:
 				debug << F("CC: default: ");
 				for ( ; i < m_count; i++) // print the bytes that could not be parsed
-					debug << m_buffer[i];
+					debug << (int)m_buffer[i] << " ";
 				debug << endl;
 			}
 		}
 	}
-	if (reset && init())	
+	if (reset)
 		return JUST_RESET;
-	if (busy || payout_busy)
-	{
-		//delay(500);
-		//return poll();
-		delay(50);
-	}
 	return 1;
 }
 
-bool CoinChanger::setup(int it)
+bool CoinChanger::parse_setup(int answer)
 {
-	int response_size = 23;
-	m_mdb->SendCommand(ADDRESS, SETUP);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer >= 0 && m_count == response_size)
+	if (accepted(CC_CMD_SETUP, answer))
 	{
-		m_mdb->Ack();
 		m_feature_level = m_buffer[0];
 		m_country = m_buffer[1] << 8 | m_buffer[2];
 		m_coin_scaling_factor = m_buffer[3];
@@ -356,91 +621,54 @@ bool CoinChanger::setup(int it)
 		for (int i = 0; i < 16; i++)
 		{
 			m_coin_type_credit[i] = m_buffer[7 + i];
+			audit.SetCoinValue(i, (unsigned int)m_coin_type_credit[i] * m_coin_scaling_factor);
 		}
-
-		if (m_feature_level >= 3)
-		{
-			expansion_identification();
-			expansion_feature_enable();
-		}
+		m_inventory_version++;
 		return true;
 	}
+	return false;
+}
+
+void CoinChanger::tube_status(int it)
+{
+	if (parse_tubes(transact(CC_CMD_TUBE_STATUS)))
+		return;
 	if (it < MAX_RESET)
 	{
-		delay(50);
-		return setup(++it);
+		wait(50);
+		return tube_status(++it);
 	}
-	error << F("CC: SETUP ERROR") << endl;
-	return false;
+	warning << F("CC: STATUS ERROR") << endl;
 }
 
-void CoinChanger::tube_status(int it)
+bool CoinChanger::parse_tubes(int answer)
 {
-	int response_size = 18;
-	m_mdb->SendCommand(ADDRESS, STATUS);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer != -1 && m_count == response_size)
+	if (accepted(CC_CMD_TUBE_STATUS, answer))
 	{
-		m_mdb->Ack();
 		//if bit is set, the tube is full
 		m_tube_full_status = m_buffer[0] << 8 | m_buffer[1];
 		for (int i = 0; i < 16; i++)
 		{
 			//number of coins in the tube
+			if (m_tube_status[i] != m_buffer[2 + i])
+				m_inventory_version++;
 			m_tube_status[i] = m_buffer[2 + i];
 		}
 		m_change = 0;
 		for (int i = 0; i < 16; i++)
 		{
-			m_change += m_coin_type_credit[i] * m_tube_status[i] * m_coin_scaling_factor;
+			m_change += (unsigned long)m_coin_type_credit[i] * m_tube_status[i] * m_coin_scaling_factor;
 		}
-		return;
-	}
-	if (it < MAX_RESET)
-	{
-		delay(50);
-		return tube_status(++it);
-	}
-	warning << F("CC: STATUS ERROR") << endl;
-}
-
-void CoinChanger::type(int it)
-{
-	int out[] = { uint8_t((m_acceptedCoins & 0xff00) >> 8), 
-					uint8_t(m_acceptedCoins & 0xff), 
-					uint8_t((m_dispenseableCoins & 0xff00) >> 8), 
-					uint8_t(m_dispenseableCoins & 0xff) };
-					
-	m_mdb->SendCommand(ADDRESS, TYPE, out, 4);
-	if (m_mdb->GetResponse() != ACK)
-	{
-		if (it < MAX_RESET)
-		{
-			delay(50);
-			return type(++it);
-		}
-		error << F("CC: TYPE ERROR") << endl;
+		return true;
 	}
+	return false;
 }
 
-void CoinChanger::expansion_identification(int it)
+bool CoinChanger::parse_identification(int answer)
 {
-	int response_size = 33;
-	m_mdb->SendCommand(ADDRESS, EXPANSION, IDENTIFICATION);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer > 0 && m_count == response_size)
+	if (accepted(CC_CMD_IDENTIFICATION, answer))
 	{
-		m_mdb->Ack();
-		// * 1L to overcome 16bit integer error
-		m_manufacturer_code = (m_buffer[0] * 1L) << 16 | m_buffer[1] << 8 | m_buffer[2];
-		for (int i = 0; i < 12; i++)
-		{
-			m_serial_number[i] = m_buffer[3 + i];
-			m_model_number[i] = m_buffer[15 + i];
-		}
-
-		m_software_version = m_buffer[27] << 8 | m_buffer[28];
-		m_optional_features = (m_buffer[29] * 1L) << 24 | (m_buffer[30] * 1L) << 16 | m_buffer[31] << 8 | m_buffer[32];
+		identification();
 
 		if (m_optional_features & 0b1)
 		{
@@ -458,36 +686,15 @@ void CoinChanger::expansion_identification(int it)
 		{ 
 			m_file_transport_layer_supported = true;
 		}
-		return;
-	}
-	if (it < MAX_RESET)
-	{
-		delay(50);
-		return expansion_identification(++it);
-	}
-	error << F("CC: EXP ID ERROR") << endl;
-}
-
-void CoinChanger::expansion_feature_enable(int it)
-{
-	int out[] = { 0x00, 0x00, 0x00, 0x03 };
-	m_mdb->SendCommand(ADDRESS, EXPANSION, FEATURE_ENABLE, out, 4);
-	if (m_mdb->GetResponse() != ACK)
-	{
-		if (it < MAX_RESET)
-		{
-			delay(50);
-			return expansion_feature_enable(++it);
-		}
-		error << F("CC: EXP FEATURE ENABLE ERROR") << endl;
+		return true;
 	}
-	m_mdb->Ack();
+	return false;
 }
 
 bool CoinChanger::expansion_payout(int value)
 {
-	m_mdb->SendCommand(ADDRESS, EXPANSION, PAYOUT, &value, 1);
-	if (m_mdb->GetResponse() != ACK)
+	uint8_t out = value;
+	if (transact(CC_CMD_PAYOUT, &out) != ACK)
 	{
 		warning << F("CC: dispense failed") << endl;
 		return false;
@@ -510,23 +717,26 @@ bool CoinChanger::expansion_payout(int value)
 //changer clears output data after an ack from controller
 void CoinChanger::expansion_payout_status(int it)
 {
-	int response_size = 16;
-	m_mdb->SendCommand(ADDRESS, EXPANSION, PAYOUT_STATUS);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
+	int answer = transact(CC_CMD_PAYOUT_STATUS);
 	if (answer == ACK)
 	{
 		debug << F("CC: payout busy") << endl;
-		delay(500);		
-		expansion_payout_status(++it);
+		if (it < MAX_RESET_POLL)
+		{
+			wait(500);
+			expansion_payout_status(++it);
+		}
 	}
-	else if (answer > 0 && m_count > 0)
+	else if (accepted(CC_CMD_PAYOUT_STATUS, answer)) //the ACK clears the data
 	{
-		m_mdb->Ack(); //to clear data 
 		debug << F("CC: payd out: ");
- 		for (int i = 0; i < m_count; i++)
+		for (int i = 0; i < m_count; i++)
 		{
 			debug << (int)m_buffer[i] << " ";
-			m_dispensed_value += m_coin_type_credit[i] * m_coin_scaling_factor * (int)m_buffer[i];
+			m_dispensed_value += (unsigned long)m_coin_type_credit[i] * m_coin_scaling_factor * m_buffer[i];
+			m_payout_value += (unsigned long)m_coin_type_credit[i] * m_coin_scaling_factor * m_buffer[i];
+			if (m_buffer[i] > 0)
+				audit.CoinOut(i, m_buffer[i]);
 		}
 		debug << endl;
 	}
@@ -536,38 +746,34 @@ void CoinChanger::expansion_payout_status(int it)
 //after the initial alternative_payout
 void CoinChanger::expansion_payout_value_poll()
 {
-	int response_size = 1;
-	m_mdb->SendCommand(ADDRESS, EXPANSION, PAYOUT_VALUE_POLL);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	if (answer == ACK) //payout finished 
-	{
-		expansion_payout_status();
-	}
-	else if (answer > 0 && m_count == response_size)
+	unsigned long paid = m_payout_value;
+	for (int it = 0; it < MAX_PAYOUT_POLL; it++)
 	{
-		m_mdb->Ack();
-		//debug << (int)m_buffer[0] << "-";
-		delay(50);
-		expansion_payout_value_poll();
+		int answer = transact(CC_CMD_PAYOUT_VALUE_POLL);
+		if (answer == ACK) //payout finished 
+		{
+			expansion_payout_status();
+			return;
+		}
+		if (!accepted(CC_CMD_PAYOUT_VALUE_POLL, answer))
+			return;
+		paid += (unsigned long)m_buffer[0] * m_coin_scaling_factor;
+		event(EVENT_PAYOUT_PROGRESS, 0, 0, paid);
+		wait(50);
 	}
+	warning << F("CC: PAYOUT POLL TIMEOUT") << endl;
 }
 
-//should be send by the vmc every 1-10 seconds
-void CoinChanger::expansion_send_diagnostic_status()
+//returns 1 while the changer powers up, -1 without a status
+int CoinChanger::parse_diagnostics(int answer)
 {
-	int response_size = 2;
 	bool powering_up = false;
 	
-	m_mdb->SendCommand(ADDRESS, EXPANSION, SEND_DIAGNOSTIC_STATUS);
-	int answer = m_mdb->GetResponse(m_buffer, &m_count, response_size);
-	
-	if (answer > 0 && m_count >= response_size)
+	if (accepted(CC_CMD_DIAGNOSTICS, answer))
 	{		
-		m_mdb->Ack();
-		
-		for (int i = 0; i < m_count / response_size; i++)
+		for (int i = 0; i < m_count / 2; i++)
 		{
-			switch (m_buffer[0])
+			switch (m_buffer[i * 2])
 			{
 			case 1:
 				debug <<  F("CC: powering up") << endl;
@@ -584,7 +790,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 				
 			case 5:
-				switch (m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 				case 10:
 					console <<  F("CC: manual fill / payout active") << endl;
@@ -600,7 +806,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 				
 			case 10:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 				case 0:
 					error << F("CC: non specific error") << endl;
@@ -618,7 +824,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 				
 			case 11:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 					case 0:
 						error << F("CC: non specific discriminator error") << endl;
@@ -654,7 +860,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 			
 			case 12:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 					case 0:
 						error << F("CC: non specific accept gate error") << endl;
@@ -675,7 +881,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 			
 			case 13:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 					case 0:
 						error << F("CC: non specific separator error") << endl;
@@ -687,7 +893,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 
 			case 14:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 					case 0:
 						error << F("CC: non specific dispenser error") << endl;
@@ -696,7 +902,7 @@ void CoinChanger::expansion_send_diagnostic_status()
 				break;
 				
 			case 15:
-				switch(m_buffer[1])
+				switch (m_buffer[i * 2 + 1])
 				{
 					case 0:
 						error << F("CC: non specific cassette error") << endl;
@@ -715,12 +921,8 @@ void CoinChanger::expansion_send_diagnostic_status()
 			}
 		}
 		
-		if (powering_up)
-		{
-			delay(1000);
-			expansion_send_diagnostic_status();
-		}
+		return powering_up ? 1 : 0;
 	}
-	else
-		warning << F("CC: diagnostic status failed") << endl;
+	warning << F("CC: diagnostic status failed") << endl;
+	return -1;
 }
\ No newline at end of file
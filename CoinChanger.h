@@ -1,12 +1,49 @@
 #pragma once
 
 #include "MDBDevice.h"
+#include "CoinHopper.h"
 
+#define TUBE_STATUS 				0x02
+#define DISPENSE 					0x05
+
+//expansion commands
 #define PAYOUT 						0x02
 #define PAYOUT_STATUS 	 			0x03
 #define PAYOUT_VALUE_POLL			0x04
 #define SEND_DIAGNOSTIC_STATUS 		0x05
 
+//steps of the changer, see MDBDevice::request()
+#define CC_PROBE 					1 	//Reset(): poll until the changer answers
+#define CC_CHECK 					2 	//Reset(): poll before RESET
+#define CC_RESET 					3
+#define CC_JUST_RESET 				4 	//Reset(): poll until JUST RESET
+#define CC_SETUP 					5 	//init after JUST RESET
+#define CC_IDENTIFICATION 			6
+#define CC_FEATURE_ENABLE 			7
+#define CC_INIT_TUBES 				8
+#define CC_POLL 					9 	//poll cycle of Update()
+#define CC_TUBES 					10
+#define CC_DIAGNOSTICS 				11
+#define CC_TYPE 					12
+
+//hoppers one changer pays change with
+#define CC_HOPPERS 					2
+
+//the commands of the changer: command, subcommand, data bytes sent and the
+//answer lengths and flags, see MDBCommand
+constexpr MDBCommand CC_CMD_RESET 				= { RESET, NO_SUB, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_SETUP 				= { SETUP, NO_SUB, 0, 23, 23, 0 };
+constexpr MDBCommand CC_CMD_TUBE_STATUS 		= { TUBE_STATUS, NO_SUB, 0, 18, 18, 0 };
+constexpr MDBCommand CC_CMD_POLL 				= { POLL, NO_SUB, 0, 1, 16, ANSWER_ACK | WINDOW_POLL };
+constexpr MDBCommand CC_CMD_TYPE 				= { TYPE, NO_SUB, 4, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_DISPENSE 			= { DISPENSE, NO_SUB, 1, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_IDENTIFICATION 		= { EXPANSION, IDENTIFICATION, 0, 33, 33, 0 };
+constexpr MDBCommand CC_CMD_FEATURE_ENABLE 		= { EXPANSION, FEATURE_ENABLE, 4, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_PAYOUT 				= { EXPANSION, PAYOUT, 1, 0, 0, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_PAYOUT_STATUS 		= { EXPANSION, PAYOUT_STATUS, 0, 1, 16, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_PAYOUT_VALUE_POLL 	= { EXPANSION, PAYOUT_VALUE_POLL, 0, 1, 1, ANSWER_ACK };
+constexpr MDBCommand CC_CMD_DIAGNOSTICS 		= { EXPANSION, SEND_DIAGNOSTIC_STATUS, 0, 2, 16, 0 };
+
 class CoinChanger : public MDBDevice
 {
 public:
@@ -15,34 +52,60 @@ public:
 	bool Reset();
 
 	void Update(unsigned long &change);
+	//the hoppers pay the part of value they have coins for while the changer
+	//pays the rest, GetPayoutValue() is the sum of both
 	bool Dispense(unsigned long value);
+	bool SetHopper(CoinHopper &hopper);
 	void Print();
+
+	//disabled changers accept no coins, payouts still work
+	inline void Enable(bool enable) { m_enabled = enable; }
+	inline bool IsEnabled() { return m_enabled; }
 	
 	inline unsigned long GetDispensedValue() { unsigned long val = m_dispensed_value; m_dispensed_value = 0; return val; }
 	inline unsigned long GetCredit() { return m_credit; }
 	inline void ClearCredit() { m_credit = 0; }
+	inline unsigned long GetChange() { return m_change; }
+	inline unsigned long GetPayoutValue() { return m_payout_value; }
+
+	//value of one coin of each type and the coins in its tube, the version
+	//changes whenever one of them does
+	inline unsigned int GetCoinValue(int type) { return (unsigned int)m_coin_type_credit[type % 16] * m_coin_scaling_factor; }
+	inline uint8_t GetTubeCount(int type) { return m_tube_status[type % 16]; }
+	inline unsigned int GetInventoryVersion() { return m_inventory_version; }
 	
 private:
-	bool init();
+	template <class... Devices> friend class BusMaster;
+
+	void reset();
+	void restart();
+	void cycle();
+	bool request();
+	void response(int answer);
+	uint8_t priority();
+	void polled(uint8_t from, int result, bool busy);
+	void initialized(bool ok);
+
+	//the parsers ACK good answers and return false for anything else, the
+	//lengths come from the CC_CMD_ commands
+	int parse_poll(int answer, bool *busy);
+	bool parse_setup(int answer);
+	bool parse_tubes(int answer);
+	bool parse_identification(int answer);
+	int parse_diagnostics(int answer);
+
+	//blocking, for the payout
 	int poll();
-	bool setup(int it = 0);
 	void tube_status(int it = 0);
-	void type(int it = 0);
 	
+	bool dispense_value(unsigned long value, int it = 0);
 	bool dispense(int coin, int count);
 	
-	void expansion_identification(int it = 0);
-	void expansion_feature_enable(int it = 0);
-	
 	bool expansion_payout(int value);
 	void expansion_payout_status(int it = 0); 
 	void expansion_payout_value_poll();
-	void expansion_send_diagnostic_status();
 
-	int ADDRESS;
-	int STATUS;
-	int DISPENSE;
-	
+	bool m_enabled;
 	unsigned int m_acceptedCoins;
 	unsigned int m_dispenseableCoins;
 
@@ -51,18 +114,16 @@ private:
 	
 	unsigned long m_value_to_dispense;
 	unsigned long m_dispensed_value;
+	unsigned long m_payout_value; //paid out by the running Dispense
 
 	
-	char m_coin_scaling_factor;
-	char m_decimal_places;
+	uint8_t m_coin_scaling_factor;
+	uint8_t m_decimal_places;
 	unsigned int m_coin_type_routing;
-	char m_coin_type_credit[16]; //coin value divided by coin scaling factor
+	uint8_t m_coin_type_credit[16]; //coin value divided by coin scaling factor
 
 	unsigned int m_tube_full_status;
-	char m_tube_status[16];
-
-	unsigned long m_software_version;
-	unsigned long m_optional_features;
+	uint8_t m_tube_status[16];
 
 	bool m_alternative_payout_supported;
 	bool m_extended_diagnostic_supported;
@@ -70,4 +131,11 @@ private:
 	bool m_file_transport_layer_supported;
 	
 	int m_update_count;
-};
+	unsigned int m_inventory_version;
+
+	uint8_t m_poll_step; 	//step whose poll answer waits for the init
+	bool m_reinit; 			//JUST RESET seen during a payout
+
+	CoinHopper *m_hoppers[CC_HOPPERS];
+	uint8_t m_hopper_count;
+};
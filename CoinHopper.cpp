@@ -0,0 +1,512 @@
+#include "CoinHopper.h"
+#include "Audit.h"
+#include <Arduino.h>
+
+CoinHopper::CoinHopper(MDBSerial &mdb, uint8_t address) : MDBDevice(mdb)
+{
+	ADDRESS = address;
+
+	m_resetCount = 0;
+
+	m_coin_scaling_factor = 0;
+	m_decimal_places = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		m_coin_type_credit[i] = 0;
+		m_coin_count[i] = 0;
+	}
+	m_full_status = 0;
+	m_change = 0;
+
+	m_manual_types = 0;
+	m_manual_changed = false;
+
+	m_paying = false;
+	m_payout_polls = 0;
+	m_payout_value = 0;
+	m_payout_requested = 0;
+
+	m_update_count = 0;
+	m_poll_step = STEP_IDLE;
+}
+
+void CoinHopper::Update()
+{
+	run();
+	cycle();
+	run();
+}
+
+bool CoinHopper::Reset()
+{
+	run();
+	reset();
+	run();
+	return m_result;
+}
+
+void CoinHopper::reset()
+{
+	m_resetCount = 0;
+	m_bus_reset = false;
+	if (m_paying)
+		payout_unknown();
+	health(DEVICE_RECOVERING);
+	step(HP_PROBE);
+}
+
+//the bus reset is over, the hopper only has to report JUST RESET
+void CoinHopper::restart()
+{
+	m_resetCount = 0;
+	m_bus_reset = true;
+	if (m_paying)
+		payout_unknown();
+	health(DEVICE_RECOVERING);
+	step(HP_JUST_RESET);
+}
+
+void CoinHopper::cycle()
+{
+	step(m_manual_changed ? HP_MANUAL_ENABLE : HP_POLL);
+}
+
+void CoinHopper::SetManualDispense(unsigned int types)
+{
+	m_manual_changed = m_manual_changed || types != m_manual_types;
+	m_manual_types = types;
+}
+
+bool CoinHopper::request()
+{
+	switch (m_step)
+	{
+	case HP_PROBE:
+	case HP_CHECK:
+	case HP_JUST_RESET:
+	case HP_POLL:
+		memset(m_buffer, 0, sizeof(m_buffer));
+		command(HP_CMD_POLL);
+		break;
+	case HP_RESET:
+		command(HP_CMD_RESET);
+		break;
+	case HP_SETUP:
+		command(HP_CMD_SETUP);
+		break;
+	case HP_MANUAL_ENABLE:
+	{
+		uint8_t out[] = { uint8_t(m_manual_types >> 8), uint8_t(m_manual_types & 0xff) };
+		command(HP_CMD_MANUAL_DISPENSE_ENABLE, out);
+		break;
+	}
+	case HP_INIT_STATUS:
+	case HP_STATUS:
+	case HP_PAYOUT_CHECK:
+		command(HP_CMD_STATUS);
+		break;
+	case HP_PAYOUT_STATUS:
+		command(HP_CMD_PAYOUT_STATUS);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void CoinHopper::response(int answer)
+{
+	switch (m_step)
+	{
+	case HP_PROBE:
+	case HP_CHECK:
+	case HP_JUST_RESET:
+	case HP_POLL:
+	{
+		int result = parse_poll(answer);
+		if (result == JUST_RESET)
+		{
+			//the poll counts once the hopper is set up again
+			m_poll_step = m_step;
+			step(HP_SETUP);
+		}
+		else
+			polled(m_step, result);
+		break;
+	}
+
+	case HP_RESET:
+		if (answer == ACK)
+		{
+			m_resetCount = 0;
+			step(HP_JUST_RESET);
+		}
+		else
+		{
+			m_resetCount++;
+			step(HP_CHECK, 100);
+		}
+		break;
+
+	case HP_SETUP:
+		if (parse_setup(answer))
+			step(HP_MANUAL_ENABLE);
+		else if (!retry())
+		{
+			error << F("HP: SETUP ERROR") << endl;
+			initialized(false);
+		}
+		break;
+
+	//sent again by the next poll cycle when it failed
+	case HP_MANUAL_ENABLE:
+		if (answer != ACK && retry())
+			break;
+		if (answer == ACK)
+			m_manual_changed = false;
+		else
+			warning << F("HP: MANUAL DISPENSE ENABLE ERROR") << endl;
+		step(m_poll_step != STEP_IDLE ? HP_INIT_STATUS : HP_POLL);
+		break;
+
+	case HP_INIT_STATUS:
+	case HP_STATUS:
+		if (!parse_status(answer))
+		{
+			if (retry())
+				break;
+			warning << F("HP: STATUS ERROR") << endl;
+		}
+		if (m_step == HP_INIT_STATUS)
+		{
+			Print();
+			debug << F("HP: INIT COMPLETED") << endl;
+			initialized(true);
+		}
+		else
+			step(STEP_IDLE);
+		break;
+
+	//the hopper ACKs while it pays, then reports the coins
+	case HP_PAYOUT_STATUS:
+		if (answer == ACK && ++m_payout_polls < MAX_PAYOUT_POLL)
+		{
+			step(HP_PAYOUT_STATUS, 50);
+			break;
+		}
+		if (parse_payout_status(answer))
+		{
+			debug << F("HP: paid out ") << m_payout_value << endl;
+			paid_out();
+			step(HP_STATUS);
+			break;
+		}
+		if (answer != ACK && retry())
+			break;
+		warning << F("HP: PAYOUT STATUS ERROR") << endl;
+		step(HP_PAYOUT_CHECK);
+		break;
+
+	//the coins that left the hopper since the payout began
+	case HP_PAYOUT_CHECK:
+		if (parse_status(answer))
+		{
+			for (int i = 0; i < 16; i++)
+				if (m_payout_counts[i] > m_coin_count[i])
+					coins_out(i, m_payout_counts[i] - m_coin_count[i]);
+			warning << F("HP: paid out by the coin counts ") << m_payout_value << endl;
+			paid_out();
+		}
+		else if (retry())
+			break;
+		else
+			payout_unknown();
+		step(STEP_IDLE);
+		break;
+	}
+}
+
+uint8_t CoinHopper::priority()
+{
+	return m_step == HP_STATUS ? PRIORITY_BACKGROUND : PRIORITY_POLL;
+}
+
+//what a poll answer means depends on the step that sent it, as for the changer
+void CoinHopper::polled(uint8_t from, int result)
+{
+	switch (from)
+	{
+	case HP_PROBE:
+		if (result >= 0)
+		{
+			m_resetCount = 0;
+			step(HP_CHECK);
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("HP: NOT CONNECTED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(HP_PROBE, 100);
+		}
+		break;
+
+	case HP_CHECK:
+		if (result > 0 && m_resetCount < MAX_RESET_POLL)
+			step(HP_RESET);
+		else
+		{
+			debug << F("HP: RESET FAILED") << endl;
+			done(false);
+		}
+		break;
+
+	case HP_JUST_RESET:
+		if (result == JUST_RESET)
+		{
+			debug << F("HP: RESET COMPLETED") << endl;
+			done(true);
+		}
+		else if (m_resetCount > MAX_RESET_POLL && m_bus_reset)
+		{
+			warning << F("HP: NO JUST RESET AFTER BUS RESET") << endl;
+			reset();
+		}
+		else if (m_resetCount > MAX_RESET_POLL)
+		{
+			debug << F("HP: NO JUST RESET RECEIVED") << endl;
+			done(false);
+		}
+		else
+		{
+			m_resetCount++;
+			step(HP_JUST_RESET, 100);
+		}
+		break;
+
+	case HP_POLL:
+		if (++m_update_count >= HOPPER_STATUS_UPDATES)
+		{
+			m_update_count = 0;
+			step(HP_STATUS);
+		}
+		else
+			step(STEP_IDLE);
+		break;
+	}
+}
+
+//end of the init after JUST RESET, back to the step that polled
+void CoinHopper::initialized(bool ok)
+{
+	uint8_t from = m_poll_step;
+	m_poll_step = STEP_IDLE;
+	polled(from, ok ? JUST_RESET : 1);
+}
+
+//greedy from the biggest coin, the changer pays what is left
+unsigned long CoinHopper::Payout(unsigned long value)
+{
+	if (m_health != DEVICE_ONLINE && m_health != DEVICE_DEGRADED)
+		return 0;
+	run(); //a step of the hopper may still wait for its answer
+	if (m_paying || m_coin_scaling_factor == 0)
+		return 0;
+	unsigned long payable = 0;
+	for (int i = 15; i >= 0; i--)
+	{
+		unsigned long coin = GetCoinValue(i);
+		if (coin == 0)
+			continue;
+		payable += min((value - payable) / coin, (unsigned long)m_coin_count[i]) * coin;
+	}
+	if (payable == 0)
+		return 0;
+
+	unsigned int scaled = payable / m_coin_scaling_factor;
+	uint8_t out[] = { uint8_t(scaled >> 8), uint8_t(scaled & 0xff) };
+	if (transact(HP_CMD_PAYOUT, out) != ACK)
+	{
+		warning << F("HP: PAYOUT FAILED") << endl;
+		return 0;
+	}
+	m_paying = true;
+	m_payout_polls = 0;
+	m_payout_value = 0;
+	m_payout_requested = payable;
+	memcpy(m_payout_counts, m_coin_count, sizeof(m_payout_counts));
+	step(HP_PAYOUT_STATUS, 50);
+	return payable;
+}
+
+//an MDBBus drops the steps of a hopper that went offline
+unsigned long CoinHopper::WaitPayout()
+{
+	run();
+	if (m_paying)
+		payout_unknown();
+	return m_payout_value;
+}
+
+void CoinHopper::paid_out()
+{
+	m_paying = false;
+	event(EVENT_PAYOUT_COMPLETE, 0, 0, m_payout_value);
+}
+
+//coins may be out, paying them again from the changer loses money
+void CoinHopper::payout_unknown()
+{
+	error << F("HP: PAYOUT UNKNOWN, ") << m_payout_requested << F(" counted as paid") << endl;
+	event(EVENT_FAULT);
+	m_payout_value = m_payout_requested;
+	paid_out();
+}
+
+//returns JUST_RESET if the hopper has to be set up again
+int CoinHopper::parse_poll(int answer)
+{
+	bool reset = false;
+	if (answer == ACK)
+		return 1;
+	if (!accepted(HP_CMD_POLL, answer))
+		return -1;
+
+	for (int i = 0; i < m_count; i++)
+	{
+		//coins dispensed manually
+		if (m_buffer[i] & 0b10000000)
+		{
+			if (i + 1 >= m_count)
+			{
+				warning << F("HP: poll response truncated") << endl;
+				break;
+			}
+			int count = (m_buffer[i] & 0b01110000) >> 4;
+			int type = m_buffer[i] & 0b00001111;
+			event(EVENT_COINS_DISPENSED, type, count, (unsigned long)count * GetCoinValue(type));
+			coins_out(type, count, true);
+			m_update_count = HOPPER_STATUS_UPDATES; //the status follows
+			i++; //cause we used 2 bytes
+			continue;
+		}
+		switch (m_buffer[i])
+		{
+		case 2:
+			debug << F("HP: payout busy") << endl;
+			break;
+		case 4:
+			error << F("HP: defective sensor") << endl;
+			event(EVENT_FAULT, m_buffer[i]);
+			break;
+		case 6:
+			debug << F("HP: dispenser unplugged") << endl;
+			event(EVENT_FAULT, m_buffer[i]);
+			break;
+		case 7:
+			warning << F("HP: payout jam") << endl;
+			event(EVENT_FAULT, m_buffer[i]);
+			break;
+		case 8:
+			warning << F("HP: ROM checksum error") << endl;
+			event(EVENT_FAULT, m_buffer[i]);
+			break;
+		case 10:
+			debug << F("HP: dispenser busy") << endl;
+			break;
+		case 11:
+			event(EVENT_RESET);
+			reset = true;
+			break;
+		default:
+			debug << F("HP: default: ") << (int)m_buffer[i] << endl;
+		}
+	}
+	if (reset)
+		return JUST_RESET;
+	return 1;
+}
+
+//level, country, scaling, decimal places and the coin types the hopper has
+bool CoinHopper::parse_setup(int answer)
+{
+	if (!accepted(HP_CMD_SETUP, answer))
+		return false;
+	m_feature_level = m_buffer[0];
+	m_country = m_buffer[1] << 8 | m_buffer[2];
+	m_coin_scaling_factor = m_buffer[3];
+	m_decimal_places = m_buffer[4];
+	for (int i = 0; i < 16; i++)
+	{
+		m_coin_type_credit[i] = 5 + i < m_count ? m_buffer[5 + i] : 0;
+		if (m_coin_type_credit[i] > 0)
+			audit.CoinType(GetCoinValue(i));
+	}
+	return true;
+}
+
+//full flags and the coins of each type in the hopper
+bool CoinHopper::parse_status(int answer)
+{
+	if (!accepted(HP_CMD_STATUS, answer))
+		return false;
+	m_full_status = m_buffer[0] << 8 | m_buffer[1];
+	m_change = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		m_coin_count[i] = 2 + i < m_count ? m_buffer[2 + i] : 0;
+		m_change += (unsigned long)GetCoinValue(i) * m_coin_count[i];
+	}
+	return true;
+}
+
+//coins of each type paid out by the last payout
+bool CoinHopper::parse_payout_status(int answer)
+{
+	if (answer == ACK || !accepted(HP_CMD_PAYOUT_STATUS, answer))
+		return false;
+	for (int i = 0; i < m_count; i++)
+	{
+		if (m_buffer[i] > 0)
+			coins_out(i, m_buffer[i]);
+		m_coin_count[i] -= min(m_buffer[i], m_coin_count[i]);
+	}
+	return true;
+}
+
+//the audit counts hopper coins under the type of their value, a manual
+//dispense is not part of the payout
+void CoinHopper::coins_out(int type, uint8_t count, bool manual)
+{
+	if (!manual)
+		m_payout_value += (unsigned long)GetCoinValue(type) * count;
+	int audit_type = audit.CoinType(GetCoinValue(type));
+	if (audit_type >= 0)
+		audit.CoinOut(audit_type, count, manual);
+}
+
+void CoinHopper::Print()
+{
+	debug << F("## CoinHopper ##") << endl;
+	debug << F("address: ") << ADDRESS << endl;
+	debug << F("country: ") << m_country << endl;
+	debug << F("feature level: ") << (int)m_feature_level << endl;
+	debug << F("coin scaling factor: ") << (int)m_coin_scaling_factor << endl;
+	debug << F("decimal places: ") << (int)m_decimal_places << endl;
+
+	debug << F("coin type credits: ");
+	for (int i = 0; i < 16; i++)
+		debug << (int)m_coin_type_credit[i] << " ";
+	debug << endl;
+
+	debug << F("full status: ") << m_full_status << endl;
+	debug << F("coins: ");
+	for (int i = 0; i < 16; i++)
+		debug << (int)m_coin_count[i] << " ";
+	debug << endl;
+	debug << F("change: ") << m_change << endl;
+	debug << F("###") << endl;
+}
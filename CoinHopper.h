@@ -0,0 +1,116 @@
+#pragma once
+
+#include "MDBDevice.h"
+
+//addresses of coin hopper / tube dispenser 1 and 2
+#define HOPPER_1 					0x58
+#define HOPPER_2 					0x70
+
+#define DISPENSER_STATUS 			0x02
+#define MANUAL_DISPENSE_ENABLE 		0x04
+#define HOPPER_PAYOUT 				0x05
+#define HOPPER_PAYOUT_STATUS 		0x06
+
+//poll cycles between two dispenser status requests
+#define HOPPER_STATUS_UPDATES 		10
+
+//steps of the hopper, see MDBDevice::request()
+#define HP_PROBE 					1 	//Reset(): poll until the hopper answers
+#define HP_CHECK 					2 	//Reset(): poll before RESET
+#define HP_RESET 					3
+#define HP_JUST_RESET 				4 	//Reset(): poll until JUST RESET
+#define HP_SETUP 					5 	//init after JUST RESET
+#define HP_MANUAL_ENABLE 			6
+#define HP_INIT_STATUS 				7
+#define HP_POLL 					8 	//poll cycle of Update()
+#define HP_STATUS 					9
+#define HP_PAYOUT_STATUS 			10 	//until the payout is over
+#define HP_PAYOUT_CHECK 			11 	//coin counts when the payout status failed
+
+//the commands of the hopper: command, subcommand, data bytes sent and the
+//answer lengths and flags, see MDBCommand. setup and status answers end after
+//the last coin type the hopper has
+constexpr MDBCommand HP_CMD_RESET 					= { RESET, NO_SUB, 0, 0, 0, ANSWER_ACK };
+constexpr MDBCommand HP_CMD_SETUP 					= { SETUP, NO_SUB, 0, 6, 21, 0 };
+constexpr MDBCommand HP_CMD_STATUS 					= { DISPENSER_STATUS, NO_SUB, 0, 3, 18, 0 };
+constexpr MDBCommand HP_CMD_POLL 					= { POLL, NO_SUB, 0, 1, 16, ANSWER_ACK | WINDOW_POLL };
+constexpr MDBCommand HP_CMD_MANUAL_DISPENSE_ENABLE 	= { MANUAL_DISPENSE_ENABLE, NO_SUB, 2, 0, 0, ANSWER_ACK };
+constexpr MDBCommand HP_CMD_PAYOUT 					= { HOPPER_PAYOUT, NO_SUB, 2, 0, 0, ANSWER_ACK };
+constexpr MDBCommand HP_CMD_PAYOUT_STATUS 			= { HOPPER_PAYOUT_STATUS, NO_SUB, 0, 1, 16, ANSWER_ACK };
+
+//coin hopper or tube dispenser at HOPPER_1 or HOPPER_2. it only pays out,
+//a CoinChanger with SetHopper() hands it the part of its payouts it can pay
+//in its own coins
+class CoinHopper : public MDBDevice
+{
+public:
+	CoinHopper(MDBSerial &mdb, uint8_t address = HOPPER_1);
+
+	bool Reset();
+
+	//runs one poll cycle, on an MDBBus the bus runs it
+	void Update();
+	void Print();
+
+	//starts to pay the part of value the coins in the hopper make up, the
+	//hopper pays it while the bus goes on. returns that part, 0 if there is
+	//none or the hopper is not set up
+	unsigned long Payout(unsigned long value);
+	//waits for the running payout, returns the value it paid. when the hopper
+	//does not tell, the whole payout counts as paid and a fault is raised
+	unsigned long WaitPayout();
+	inline bool IsPaying() { return m_paying; }
+	//paid out by the last payout
+	inline unsigned long GetPayoutValue() { return m_payout_value; }
+
+	//coin types that may be paid by hand on the hopper
+	void SetManualDispense(unsigned int types);
+
+	inline unsigned long GetChange() { return m_change; }
+	inline unsigned int GetCoinValue(int type) { return (unsigned int)m_coin_type_credit[type % 16] * m_coin_scaling_factor; }
+	inline uint8_t GetCoinCount(int type) { return m_coin_count[type % 16]; }
+
+private:
+	template <class... Devices> friend class BusMaster;
+
+	void reset();
+	void restart();
+	void cycle();
+	bool request();
+	void response(int answer);
+	uint8_t priority();
+	void polled(uint8_t from, int result);
+	void initialized(bool ok);
+
+	//the parsers ACK good answers and return false for anything else, the
+	//lengths come from the HP_CMD_ commands
+	int parse_poll(int answer);
+	bool parse_setup(int answer);
+	bool parse_status(int answer);
+	bool parse_payout_status(int answer);
+	//counts coins that left the hopper for the payout and the audit
+	void coins_out(int type, uint8_t count, bool manual = false);
+	//the payout is over, with the value paid so far or an unknown one
+	void paid_out();
+	void payout_unknown();
+
+	uint8_t m_coin_scaling_factor;
+	uint8_t m_decimal_places;
+	uint8_t m_coin_type_credit[16]; //coin value divided by coin scaling factor
+
+	unsigned int m_full_status;
+	uint8_t m_coin_count[16];
+	unsigned long m_change;
+
+	unsigned int m_manual_types;
+	bool m_manual_changed;
+
+	bool m_paying;
+	unsigned int m_payout_polls;
+	unsigned long m_payout_value;
+	unsigned long m_payout_requested;
+	uint8_t m_payout_counts[16]; 	//coins before the payout
+
+	uint8_t m_update_count;
+	uint8_t m_poll_step; 	//step whose poll answer waits for the init
+};
@@ -0,0 +1,153 @@
+#include "EscrowPolicy.h"
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+	while (b)
+	{
+		unsigned long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+EscrowPolicy::EscrowPolicy()
+{
+	m_changer = 0;
+	m_changer_version = 0;
+	m_change = 0;
+	m_min_price = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		m_bill_value[i] = 0;
+		m_note_count[i] = 0;
+	}
+	m_dirty = true;
+	m_mask = 0;
+}
+
+void EscrowPolicy::changed()
+{
+	m_dirty = true;
+}
+
+//without a changer the bills are enabled by the plain value of the change
+void EscrowPolicy::SetChanger(CoinChanger *changer)
+{
+	m_changer = changer;
+	changed();
+}
+
+void EscrowPolicy::SetChange(unsigned long change)
+{
+	if (m_changer == 0 && change != m_change)
+		changed();
+	m_change = change;
+}
+
+void EscrowPolicy::SetMinPrice(unsigned long price)
+{
+	m_min_price = price;
+	changed();
+}
+
+void EscrowPolicy::SetBills(const uint8_t credit[16], unsigned int scaling)
+{
+	for (int i = 0; i < 16; i++)
+		m_bill_value[i] = (unsigned long)credit[i] * scaling;
+	changed();
+}
+
+void EscrowPolicy::SetNotes(const unsigned int count[16])
+{
+	for (int i = 0; i < 16; i++)
+	{
+		if (m_note_count[i] != count[i])
+			changed();
+		m_note_count[i] = count[i];
+	}
+}
+
+unsigned int EscrowPolicy::GetEnableMask()
+{
+	if (m_changer && m_changer->GetInventoryVersion() != m_changer_version)
+		changed();
+	if (m_dirty)
+		update();
+	return m_mask;
+}
+
+//count coins of one value, split in 1, 2, 4, ... so every count up to
+//the total is reachable with a few shifts of the table
+void EscrowPolicy::add(unsigned int value, unsigned int count)
+{
+	if (value == 0 || value >= POLICY_UNITS)
+		return;
+	for (unsigned int take = 1; count > 0; take *= 2)
+	{
+		take = min(take, count);
+		count -= take;
+		unsigned long shift = (unsigned long)take * value;
+		if (shift >= POLICY_UNITS)
+			return;
+		//m_payable |= m_payable << shift, from the top so every source byte is still unchanged
+		int bytes = shift / 8;
+		int bits = shift % 8;
+		for (int i = POLICY_UNITS / 8 - 1; i >= bytes; i--)
+		{
+			uint8_t val = m_payable[i - bytes] << bits;
+			if (bits && i - bytes > 0)
+				val |= m_payable[i - bytes - 1] >> (8 - bits);
+			m_payable[i] |= val;
+		}
+	}
+}
+
+void EscrowPolicy::update()
+{
+	m_dirty = false;
+	m_mask = 0;
+
+	if (m_changer == 0)
+	{
+		unsigned long change = m_change;
+		for (int i = 0; i < 16; i++)
+			change += m_note_count[i] * m_bill_value[i];
+		for (int i = 0; i < 16; i++)
+		{
+			if (m_bill_value[i] > 0 && m_bill_value[i] <= change + m_min_price)
+				bitSet(m_mask, i);
+		}
+		return;
+	}
+	m_changer_version = m_changer->GetInventoryVersion();
+
+	unsigned long unit = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		if (m_changer->GetTubeCount(i) > 0)
+			unit = gcd(unit, m_changer->GetCoinValue(i));
+		unit = gcd(unit, m_bill_value[i]);
+	}
+	unit = gcd(unit, m_min_price);
+	if (unit == 0)
+		return;
+
+	memset(m_payable, 0, sizeof(m_payable));
+	m_payable[0] = 1;
+	for (int i = 0; i < 16; i++)
+	{
+		add(m_changer->GetCoinValue(i) / unit, m_changer->GetTubeCount(i));
+		add(m_bill_value[i] / unit, m_note_count[i]);
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		if (m_bill_value[i] == 0)
+			continue;
+		unsigned long change = m_bill_value[i] > m_min_price ? m_bill_value[i] - m_min_price : 0;
+		unsigned long units = change / unit;
+		if (units < POLICY_UNITS && bitRead(m_payable[units / 8], units % 8))
+			bitSet(m_mask, i);
+	}
+}
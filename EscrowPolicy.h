@@ -0,0 +1,44 @@
+#pragma once
+
+#include "CoinChanger.h"
+
+//size of the table of payable change values, in units of the greatest common
+//divisor of all coin and bill values (5 cents for euro coins: up to 51.15 EUR)
+#define POLICY_UNITS 			1024
+
+//decides which bills are enabled and whether a bill in escrow is accepted.
+//a bill is only taken when its value minus the cheapest product can be paid
+//back exactly with the coins in the tubes and the notes in the recycler.
+//the result is cached until the inventory changes, so a decision in escrow
+//costs only a table lookup
+class EscrowPolicy
+{
+public:
+	EscrowPolicy();
+
+	void SetChanger(CoinChanger *changer);
+	void SetChange(unsigned long change);
+	void SetMinPrice(unsigned long price);
+	void SetBills(const uint8_t credit[16], unsigned int scaling);
+	void SetNotes(const unsigned int count[16]);
+
+	unsigned int GetEnableMask();
+	inline bool Accept(int type) { return bitRead(GetEnableMask(), type % 16); }
+
+private:
+	void update();
+	void add(unsigned int value, unsigned int count);
+	void changed();
+
+	CoinChanger *m_changer;
+	unsigned int m_changer_version;
+	unsigned long m_change;
+	unsigned long m_min_price;
+
+	unsigned long m_bill_value[16];
+	unsigned int m_note_count[16];
+
+	bool m_dirty;
+	unsigned int m_mask;
+	uint8_t m_payable[POLICY_UNITS / 8];
+};
@@ -1,4 +1,5 @@
 #include "Logger.h"
+#include "Recorder.h"
 
 static UART *s_uart;
 static bool s_uartSet = false;
@@ -155,6 +156,8 @@ void Logger::print(T t)
 			if (s_debug)
 				*s_uart << t;
 	}
+	if (m_level > 0)
+		recorder.Text(t);
 	/*
 	if (m_level > 1)
 	{	
@@ -168,6 +171,8 @@ void Logger::startLine()
 {
 	if (m_lineStart)
 	{
+		if (m_level > 0)
+			recorder.Line(m_level);
 		if (m_level > 1)
 		{
 			/*
@@ -203,5 +208,7 @@ void Logger::endLine()
 {
 	//if (m_level > 1)
 	//	s_file.close();
+	if (m_level > 0)
+		recorder.EndLine();
 	m_lineStart = true;
 }
\ No newline at end of file
@@ -0,0 +1,506 @@
+#include "MDBBus.h"
+#include <limits.h>
+
+MDBBus *MDBBus::s_buses[MDB_BUSES];
+uint8_t MDBBus::s_count = 0;
+bool MDBBus::s_watchdog = false;
+
+MDBBus::MDBBus(MDBSerial &mdb) : m_mdb(&mdb)
+{
+	m_index = s_count;
+	if (s_count < MDB_BUSES)
+		s_buses[s_count++] = this;
+	MDBSerial::s_idle = UpdateAll;
+
+	m_device_count = 0;
+	m_current = -1;
+	m_next = 0;
+	m_driver_count = 0;
+	m_discovery = false;
+	m_present = 0;
+	m_sweep = 0;
+	m_probe = 0;
+	m_probe_last = 0;
+	m_probe_time = 0;
+	m_probes = 0;
+	m_queue_head = 0;
+	m_queue_count = 0;
+	SetPipeline(true);
+	m_break_pending = false;
+	m_break = false;
+	m_restarting = 0;
+	m_interval = POLL_INTERVAL;
+	m_cycles = 0;
+	m_since = 0;
+	m_progress = 0;
+	m_transactions = 0;
+	m_misses = 0;
+	memset(m_latency, 0, sizeof(m_latency));
+}
+
+bool MDBBus::Add(MDBDevice &device)
+{
+	if (m_device_count >= MDB_BUS_DEVICES || device.m_mdb != m_mdb)
+		return false;
+	device.m_on_bus = true;
+	device.m_bus = m_index;
+	m_devices[m_device_count++] = &device;
+	return true;
+}
+
+bool MDBBus::Register(MDBDevice &device)
+{
+	if (m_device_count + m_driver_count >= MDB_BUS_DEVICES || device.m_mdb != m_mdb)
+		return false;
+	m_drivers[m_driver_count++] = &device;
+	return true;
+}
+
+void MDBBus::Discover()
+{
+	m_discovery = true;
+	m_sweep = DISCOVERY_ADDRESSES & ~m_present;
+	m_probe_time = millis();
+}
+
+void MDBBus::SetPipeline(bool on)
+{
+	m_pipeline = on;
+	m_mdb->SetAutoAck(on);
+}
+
+void MDBBus::Reset()
+{
+	for (uint8_t i = 0; i < m_device_count; i++)
+		m_devices[i]->m_reset_pending = true;
+}
+
+void MDBBus::HardReset()
+{
+	m_break_pending = true;
+}
+
+void MDBBus::UpdateAll()
+{
+	for (uint8_t i = 0; i < s_count; i++)
+		s_buses[i]->Update();
+}
+
+//the devices work in ms, a step due within the current ms is due now
+unsigned long MDBBus::GetIdle()
+{
+	if (m_break_pending || m_queue_count > 0 || m_mdb->IsBlocked())
+		return 0;
+	if (m_break || m_probe || m_current >= 0)
+		return m_mdb->GetIdle();
+	unsigned long now = millis();
+	unsigned long ms = ULONG_MAX;
+	for (uint8_t i = 0; i < m_device_count; i++)
+	{
+		MDBDevice *device = m_devices[i];
+		unsigned long since;
+		unsigned long wait;
+		if (device->m_step != STEP_IDLE)
+		{
+			since = device->m_step_time;
+			wait = device->m_step_wait;
+		}
+		else if (device->m_reset_pending)
+			return 0;
+		else if (device->m_health == DEVICE_OFFLINE)
+		{
+			since = device->m_offline_time;
+			wait = device->m_backoff;
+		}
+		else
+		{
+			since = device->m_cycle_time;
+			wait = m_interval;
+		}
+		if (now - since >= wait)
+			return 0;
+		ms = min(ms, wait - (now - since));
+	}
+	if (m_discovery && empty())
+	{
+		if (m_sweep)
+			return 0;
+		if (now - m_probe_time >= DISCOVERY_INTERVAL)
+			return 0;
+		ms = min(ms, DISCOVERY_INTERVAL - (now - m_probe_time));
+	}
+	return ms == ULONG_MAX ? ULONG_MAX : ms * 1000 - micros() % 1000;
+}
+
+bool MDBBus::Sleep()
+{
+	unsigned long us = ULONG_MAX;
+	for (uint8_t i = 0; i < s_count && us > 0; i++)
+		us = min(us, s_buses[i]->GetIdle());
+	return power.Sleep(us);
+}
+
+void MDBBus::EnableWatchdog(uint8_t timeout)
+{
+	for (uint8_t i = 0; i < s_count; i++)
+		s_buses[i]->m_progress = millis();
+	s_watchdog = true;
+	Watchdog::begin(timeout);
+}
+
+//also counts the transactions of blocking calls, they do not go through Update()
+void MDBBus::watch()
+{
+	unsigned long now = millis();
+	unsigned long transactions = m_mdb->GetStats().transactions;
+	if (!m_mdb->Busy() || transactions != m_transactions)
+	{
+		m_transactions = transactions;
+		m_progress = now;
+	}
+	if (!s_watchdog)
+		return;
+	for (uint8_t i = 0; i < s_count; i++)
+		if (now - s_buses[i]->m_progress > WATCHDOG_STALL)
+			return;
+	Watchdog::reset();
+}
+
+void MDBBus::Update()
+{
+	watch();
+	if (m_break)
+	{
+		if (m_mdb->Update() == MDB_BUSY)
+			return;
+		m_break = false;
+		for (uint8_t i = 0; i < m_device_count; i++)
+		{
+			m_devices[i]->restart();
+			m_restarting |= 1 << i;
+		}
+	}
+	if (m_probe)
+	{
+		int answer = m_mdb->Update();
+		if (answer == MDB_BUSY)
+		{
+			decode();
+			return;
+		}
+		probed(answer);
+	}
+	else if (m_current >= 0)
+	{
+		int answer = m_mdb->Update();
+		if (answer == MDB_BUSY)
+		{
+			decode();
+			return;
+		}
+		MDBDevice *device = m_devices[m_current];
+		device->m_count = answer == 1 ? m_mdb->GetCount() : 0;
+		memcpy(device->m_buffer, m_mdb->GetData(), device->m_count);
+		//a transaction only starts with room in the queue
+		if (m_pipeline)
+		{
+			device->m_answer = answer;
+			device->m_queued = true;
+			m_queue[(m_queue_head + m_queue_count++) % MDB_PIPELINE] = m_current;
+			m_current = -1;
+		}
+		else
+		{
+			m_current = -1;
+			device->response(answer);
+			device->track(answer);
+		}
+	}
+	//a blocking command has the bus
+	if (m_mdb->IsBlocked() || m_mdb->Busy())
+	{
+		decode();
+		return;
+	}
+
+	//whatever the devices were doing is void after the break, the answers
+	//in the queue are ACKed already and a credit in them must not get lost
+	if (m_break_pending)
+	{
+		decode();
+		m_break_pending = false;
+		m_break = m_mdb->Break();
+		for (uint8_t i = 0; i < m_device_count; i++)
+		{
+			m_devices[i]->m_step = STEP_IDLE;
+			m_devices[i]->m_reset_pending = false;
+		}
+		m_restarting = 0;
+		return;
+	}
+
+	if (m_queue_count >= MDB_PIPELINE)
+		decode();
+
+	unsigned long now = millis();
+	uint8_t priority = 0;
+	long slack = 0;
+	int8_t next = pick(now, &priority, &slack);
+	//a queued answer with data may bring an urgent step, a background step
+	//does not go out before it is parsed
+	if (next >= 0 && priority == PRIORITY_BACKGROUND && queued_data())
+	{
+		decode();
+		now = millis();
+		next = pick(now, &priority, &slack);
+	}
+	//a probe goes out in place of a step it beats
+	uint8_t probe_priority = 0;
+	long probe_slack = 0;
+	uint8_t address = m_discovery ? probe(now, &probe_priority, &probe_slack) : 0;
+	if (address && (next < 0 || probe_priority > priority || (probe_priority == priority && probe_slack < slack)))
+	{
+		uint8_t frame = address | RESET;
+		m_mdb->Start(&frame, 1, MDB_RAW, m_sweep ? DISCOVERY_WINDOW : T_RESPONSE);
+		m_sweep &= ~(1 << (address >> 3));
+		m_probe = address;
+		m_probe_time = now;
+		m_probes++;
+		decode();
+		return;
+	}
+	if (next < 0)
+	{
+		decode();
+		return;
+	}
+
+	MDBDevice *device = m_devices[next];
+	unsigned long waited = now - device->m_step_time - device->m_step_wait;
+	if (waited > m_latency[priority])
+		m_latency[priority] = waited;
+	if (slack < 0)
+		m_misses++;
+	m_mdb->Start(device->m_command, device->m_command_count, device->m_descriptor);
+	m_current = next;
+	m_next = next + 1;
+	decode();
+}
+
+//every ready step is a candidate, the device after the last one sent
+//wins a tie so equal steps take turns. idle devices start their next cycle
+//or reset here
+int8_t MDBBus::pick(unsigned long now, uint8_t *priority, long *slack)
+{
+	int8_t next = -1;
+	for (uint8_t n = 0; n < m_device_count; n++)
+	{
+		uint8_t i = (m_next + n) % m_device_count;
+		MDBDevice *device = m_devices[i];
+		//its next step comes from the answer
+		if (device->m_queued)
+			continue;
+		if (device->m_step == STEP_IDLE)
+		{
+			m_restarting &= ~(1 << i);
+			if (device->m_reset_pending)
+			{
+				device->m_reset_pending = false;
+				device->reset();
+			}
+			//no poll cycles while offline, only a reset now and then
+			else if (device->m_health == DEVICE_OFFLINE)
+			{
+				if (now - device->m_offline_time >= device->m_backoff)
+				{
+					device->m_recoveries++;
+					device->reset();
+				}
+			}
+			else if (now - device->m_cycle_time >= m_interval)
+			{
+				device->m_cycle_time = now;
+				device->cycle();
+				m_cycles++;
+			}
+		}
+		if (!device->ready())
+			continue;
+		if (!device->request())
+		{
+			device->m_step = STEP_IDLE;
+			continue;
+		}
+		uint8_t step_priority = device->priority();
+		long step_slack = LONG_MAX;
+		if (step_priority == PRIORITY_URGENT)
+			step_slack = (long)(device->m_step_time + device->m_step_wait + DEADLINE_URGENT - now);
+		else if (step_priority == PRIORITY_POLL)
+			step_slack = (long)(device->m_step_time + device->m_step_wait + DEADLINE_POLL - now);
+		if (next < 0 || step_priority > *priority || (step_priority == *priority && step_slack < *slack))
+		{
+			next = i;
+			*priority = step_priority;
+			*slack = step_slack;
+		}
+	}
+	return next;
+}
+
+//addresses to probe, the ones of devices on the bus never are
+uint16_t MDBBus::empty()
+{
+	uint16_t taken = m_present;
+	for (uint8_t i = 0; i < m_device_count; i++)
+		taken |= 1 << (m_devices[i]->ADDRESS >> 3);
+	return DISCOVERY_ADDRESSES & ~taken;
+}
+
+//the sweep goes in address order as a poll step that is due, after it the
+//next empty address after the last one probed is a background step
+uint8_t MDBBus::probe(unsigned long now, uint8_t *priority, long *slack)
+{
+	uint16_t addresses = empty();
+	m_sweep &= addresses;
+	if (m_sweep)
+	{
+		for (uint8_t i = 1; i < 16; i++)
+			if (m_sweep & (1 << i))
+			{
+				*priority = PRIORITY_POLL;
+				*slack = 0;
+				return i << 3;
+			}
+	}
+	if (addresses == 0 || now - m_probe_time < DISCOVERY_INTERVAL)
+		return 0;
+	for (uint8_t n = 1; n <= 16; n++)
+	{
+		uint8_t i = (m_probe_last + n) % 16;
+		if (addresses & (1 << i))
+		{
+			m_probe_last = i;
+			*priority = PRIORITY_BACKGROUND;
+			*slack = LONG_MAX;
+			return i << 3;
+		}
+	}
+	return 0;
+}
+
+//anything but silence is a peripheral, a NAK or a broken answer as well
+void MDBBus::probed(int answer)
+{
+	uint8_t address = m_probe;
+	m_probe = 0;
+	if (answer == -2)
+		return;
+	if (answer == 1)
+		m_mdb->Ack();
+	m_present |= 1 << (address >> 3);
+
+	bool driver = false;
+	for (uint8_t i = 0; i < m_driver_count; i++)
+	{
+		MDBDevice *device = m_drivers[i];
+		if (device->ADDRESS != address)
+			continue;
+		m_drivers[i] = m_drivers[--m_driver_count];
+		Add(*device);
+		device->m_reset_pending = true;
+		driver = true;
+		break;
+	}
+	status << F("MDB ") << (int)address << F(": FOUND") << (driver ? F("") : F(", NO DRIVER")) << endl;
+	MDBEvent event;
+	event.type = EVENT_DEVICE_FOUND;
+	event.address = address;
+	event.bus = m_index;
+	event.item = driver;
+	event.routing = 0;
+	event.value = 0;
+	events.Push(event);
+}
+
+bool MDBBus::queued_data()
+{
+	for (uint8_t n = 0; n < m_queue_count; n++)
+		if (m_devices[m_queue[(m_queue_head + n) % MDB_PIPELINE]]->m_answer == 1)
+			return true;
+	return false;
+}
+
+//the words of a command have to follow each other within T_INTER_BYTE and
+//only Update() writes them, so the answers wait until the command is out.
+//a device may send a blocking command from response(), the answer is taken
+//off the queue first
+void MDBBus::decode()
+{
+	while (m_queue_count > 0 && !m_mdb->IsSending())
+	{
+		MDBDevice *device = m_devices[m_queue[m_queue_head]];
+		m_queue_head = (m_queue_head + 1) % MDB_PIPELINE;
+		m_queue_count--;
+		device->m_queued = false;
+		device->response(device->m_answer);
+		device->track(device->m_answer);
+	}
+}
+
+unsigned int MDBBus::GetLoad()
+{
+	unsigned long elapsed = (micros() - m_since) / 100;
+	if (elapsed == 0)
+		return 0;
+	return m_mdb->GetStats().busy_us / elapsed;
+}
+
+void MDBBus::ClearStats()
+{
+	m_mdb->ClearStats();
+	m_cycles = 0;
+	m_misses = 0;
+	memset(m_latency, 0, sizeof(m_latency));
+	m_since = micros();
+}
+
+void MDBBus::Print()
+{
+	const MDBStats &stats = m_mdb->GetStats();
+	debug << F("## MDB BUS ") << (int)m_index << F(" ##") << endl;
+	debug << F("devices: ") << (int)m_device_count << endl;
+	if (m_discovery)
+	{
+		debug << F("present:");
+		for (uint8_t i = 1; i < 16; i++)
+			if (m_present & (1 << i))
+				debug << ' ' << (int)(i << 3);
+		debug << F(", ") << (int)m_driver_count << F(" drivers waiting") << endl;
+	}
+	debug << F("poll cycles: ") << m_cycles << endl;
+	debug << F("transactions: ") << stats.transactions << endl;
+	debug << F("acks: ") << stats.acks << endl;
+	debug << F("data: ") << stats.data << endl;
+	debug << F("naks: ") << stats.naks << endl;
+	debug << F("timeouts: ") << stats.timeouts << endl;
+	debug << F("errors: ") << stats.errors << endl;
+	debug << F("bus resets: ") << stats.resets << endl;
+	debug << F("load: ") << GetLoad() << F("%") << endl;
+	debug << F("deadline misses: ") << m_misses << endl;
+	debug << F("longest wait: urgent ") << m_latency[PRIORITY_URGENT] << F(" ms, poll ")
+			<< m_latency[PRIORITY_POLL] << F(" ms, background ") << m_latency[PRIORITY_BACKGROUND] << F(" ms") << endl;
+	for (uint8_t i = 0; i < m_device_count; i++)
+	{
+		MDBDevice *device = m_devices[i];
+		uint8_t health = device->m_health;
+		debug << F("device ") << device->ADDRESS << F(": ")
+				<< (health == DEVICE_ONLINE ? F("online") : health == DEVICE_DEGRADED ? F("degraded")
+					: health == DEVICE_OFFLINE ? F("offline") : F("recovering"))
+				<< F(", ") << device->m_recoveries << F(" recoveries") << endl;
+		const MDBTiming *timing = m_mdb->GetTiming(device->ADDRESS);
+		if (timing)
+			debug << F("  response ") << timing->response_us << F(" us, poll window ") << timing->window_us
+					<< F(" us, errors ") << (int)(100UL * timing->errors / MDB_ERRORS_ALL) << F("%") << endl;
+	}
+	debug << F("###") << endl;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "MDBDevice.h"
+#include "MDBSerial.h"
+#include "Watchdog.h"
+#include "Power.h"
+
+//buses one board can run, USART1-3 of the Mega 2560
+#define MDB_BUSES 				3
+
+//ms a bus may hold one transaction before it counts as stuck, the longest
+//legitimate one is a bus reset of T_BREAK + T_SETUP
+#define WATCHDOG_STALL 			1000
+
+static_assert(MDB_PIPELINE >= 1, "MDB_PIPELINE: at least one answer has to wait");
+static_assert(MDB_BUS_DEVICES <= 8, "MDB_BUS_DEVICES: m_restarting has one bit per device");
+static_assert(MDB_TIMING_SLOTS >= MDB_BUS_DEVICES, "MDB_TIMING_SLOTS: every device of a bus needs its POLL window");
+
+//peripheral addresses Discover() probes, one bit per address >> 3: changer,
+//cashless 1, gateway, display, energy management, validator, universal
+//satellite devices 1-3, hopper 1, cashless 2, age verification and hopper 2
+#define DISCOVERY_ADDRESSES 	0x7F7E
+//response window of a probe in us, shorter during the first sweep
+#define DISCOVERY_WINDOW 		2000
+//ms between two probes of empty addresses after the first sweep
+#define DISCOVERY_INTERVAL 		2000
+
+//one MDB bus on its own USART with its own devices and stats. Update() never
+//waits for the bus: it collects the answer of the running transaction, hands
+//it to its device and starts the most urgent step of all its devices, see
+//MDBDevice::priority(). buses share nothing, a device that times out only
+//holds up its own bus.
+//with the pipeline the answer is ACKed by MDBSerial and queued, the next
+//command goes out first and the answer is parsed and logged while the bus
+//waits for the next one. a device with a queued answer gets no new step, at
+//most MDB_PIPELINE answers wait before the bus stops for them.
+class MDBBus
+{
+public:
+	explicit
+	MDBBus(MDBSerial &mdb);
+
+	bool Add(MDBDevice &device);
+
+	//a driver that joins the bus once Discover() finds its address, it
+	//takes one of the MDB_BUS_DEVICES places already
+	bool Register(MDBDevice &device);
+	//probes every address of DISCOVERY_ADDRESSES with RESET between the
+	//steps of the devices, then the empty ones one by one every
+	//DISCOVERY_INTERVAL ms for good. a registered driver whose address
+	//answers is added and reset. a device that is unplugged later stays on
+	//the bus and is reset with the backoff of its health
+	void Discover();
+	//bit address >> 3 of every peripheral that answered a probe
+	inline uint16_t GetPresent() { return m_present; }
+	inline bool IsPresent(uint8_t address) { return m_present & (1 << (address >> 3)); }
+	inline unsigned long GetProbes() { return m_probes; }
+
+	//resets every device of the bus side by side, without waiting
+	void Reset();
+	//bus reset: BREAK resets every device at once, after the setup time they
+	//are set up again side by side. a device that does not report JUST RESET
+	//gets the RESET command
+	void HardReset();
+	//a reset is running or a device is not set up again yet
+	inline bool IsResetting() { return m_break_pending || m_break || m_restarting; }
+	void Update();
+
+	//runs all buses, also called while a blocking command waits
+	static void UpdateAll();
+
+	//starts the hardware watchdog, Update() feeds it while every bus moves
+	//on: it is idle or a transaction ended within WATCHDOG_STALL. a bus that
+	//hangs in a transaction or a loop() that stops calling Update() resets
+	//the board
+	static void EnableWatchdog(uint8_t timeout = WDTO_2S);
+
+	//us until Update() has work, 0 for right away: a step, poll cycle, reset
+	//or probe falls due, or the transaction needs it. ULONG_MAX for none
+	unsigned long GetIdle();
+	//idle sleep of the CPU until the next work of any bus or an interrupt
+	//that brings some, at the end of loop(). the answers come in while it
+	//sleeps, the response timeouts run on the timer. false if it did not sleep
+	static bool Sleep();
+
+	inline void SetPollInterval(unsigned int ms) { m_interval = ms; }
+	//on by default, off parses every answer before the next command
+	void SetPipeline(bool on);
+	inline uint8_t GetIndex() { return m_index; }
+	inline MDBSerial &GetSerial() { return *m_mdb; }
+	inline const MDBStats &GetStats() { return m_mdb->GetStats(); }
+	inline unsigned long GetCycles() { return m_cycles; }
+	//steps sent after their deadline, longest time a step of a PRIORITY_
+	//waited for the bus in ms, both since ClearStats()
+	inline unsigned long GetDeadlineMisses() { return m_misses; }
+	inline unsigned long GetLatency(uint8_t priority) { return m_latency[priority % PRIORITIES]; }
+	//percent of the time since ClearStats() the bus carried a transaction
+	unsigned int GetLoad();
+	void ClearStats();
+	void Print();
+
+private:
+	void watch();
+	void decode();
+	bool queued_data();
+	uint16_t empty();
+	uint8_t probe(unsigned long now, uint8_t *priority, long *slack);
+	void probed(int answer);
+	int8_t pick(unsigned long now, uint8_t *priority, long *slack);
+
+	MDBSerial *m_mdb;
+	uint8_t m_index;
+
+	MDBDevice *m_devices[MDB_BUS_DEVICES];
+	uint8_t m_device_count;
+	int8_t m_current; 		//device of the running transaction, -1 for none
+	uint8_t m_next; 		//first device to ask for a step
+
+	bool m_pipeline;
+	uint8_t m_queue[MDB_PIPELINE]; 	//devices with an answer to parse
+	uint8_t m_queue_head;
+	uint8_t m_queue_count;
+
+	MDBDevice *m_drivers[MDB_BUS_DEVICES]; 	//registered, not found yet
+	uint8_t m_driver_count;
+	bool m_discovery;
+	uint16_t m_present;
+	uint16_t m_sweep; 		//addresses of the first sweep not probed yet
+	uint8_t m_probe; 		//address of the running probe, 0 for none
+	uint8_t m_probe_last; 	//of the probes after the sweep
+	unsigned long m_probe_time;
+	unsigned long m_probes;
+
+	bool m_break_pending;
+	bool m_break;
+	uint8_t m_restarting; 	//one bit per device
+
+	unsigned int m_interval;
+	unsigned long m_cycles;
+	unsigned long m_since;
+
+	unsigned long m_misses;
+	unsigned long m_latency[PRIORITIES];
+
+	unsigned long m_progress;
+	unsigned long m_transactions;
+
+	static MDBBus *s_buses[MDB_BUSES];
+	static uint8_t s_count;
+	static bool s_watchdog;
+};
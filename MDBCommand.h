@@ -0,0 +1,36 @@
+#pragma once
+#include <Arduino.h>
+
+//flags of a command
+#define ANSWER_ACK 			0x01 	//an ACK is a good answer too
+#define WINDOW_POLL 		0x02 	//response window adapted to the peripheral, see MDBSerial::GetTiming().
+									//without it T_RESPONSE, a late ACK to a payout must not be missed
+
+//subcommand of a command that has none
+#define NO_SUB 				-1
+//answer length of a frame without a descriptor
+#define ANSWER_ANY 			0xFF
+
+//one MDB command as the peripheral sees it: the command added to the device
+//address, the subcommand of EXPANSION, the data bytes the VMC sends after
+//them and the data bytes of a good answer, 0 to 0 for none. every table of
+//them is constexpr and passed by value, the fields end up as constants in the
+//code and not in RAM
+struct MDBCommand
+{
+	uint8_t command;
+	int16_t sub;
+	uint8_t request;
+	uint8_t answer_min;
+	uint8_t answer_max;
+	uint8_t flags;
+};
+
+//a frame built by hand, any answer goes
+constexpr MDBCommand MDB_RAW = { 0, NO_SUB, 0, 1, ANSWER_ANY, ANSWER_ACK };
+
+//the answer has data of a length the command allows
+constexpr bool answer_fits(MDBCommand command, int count)
+{
+	return command.answer_max == ANSWER_ANY || (count >= command.answer_min && count <= command.answer_max);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+//compile time settings of the library, every one can also be given with -D
+
+//USARTs the library drives, a USART that is off costs no RAM, has no
+//interrupt handlers here and UART::begin() fails on it
+#ifndef UART0_ENABLED
+#define UART0_ENABLED 		1 	//console
+#endif
+#ifndef UART1_ENABLED
+#define UART1_ENABLED 		1 	//MDB bus
+#endif
+#ifndef UART2_ENABLED
+#define UART2_ENABLED 		0 	//second bus or sniffer
+#endif
+#ifndef UART3_ENABLED
+#define UART3_ENABLED 		0 	//third bus or sniffer
+#endif
+
+//receive buffer in words, a power of two from 8 to 256. a word takes a byte
+//and a bit, the ninth bits are packed into a bitmap
+#ifndef UART0_RX_BUFFER
+#define UART0_RX_BUFFER 	64 	//one Remote frame is 38 bytes
+#endif
+#ifndef UART1_RX_BUFFER
+#define UART1_RX_BUFFER 	64 	//one MDB answer is 37 words
+#endif
+#ifndef UART2_RX_BUFFER
+#define UART2_RX_BUFFER 	64
+#endif
+#ifndef UART3_RX_BUFFER
+#define UART3_RX_BUFFER 	64
+#endif
+
+//transmit buffer in bytes, a power of two up to 256 or 0 to write every byte
+//directly. 9 bit writes never use it
+#ifndef UART0_TX_BUFFER
+#define UART0_TX_BUFFER 	64
+#endif
+#ifndef UART1_TX_BUFFER
+#define UART1_TX_BUFFER 	0
+#endif
+#ifndef UART2_TX_BUFFER
+#define UART2_TX_BUFFER 	0
+#endif
+#ifndef UART3_TX_BUFFER
+#define UART3_TX_BUFFER 	0
+#endif
+
+//answer buffer of every MDBDevice, not less than DATA_MAX
+#ifndef MDB_BUFFER_SIZE
+#define MDB_BUFFER_SIZE 	36
+#endif
+//devices of one MDBBus: changer, validator, both hoppers and both cashless
+//readers, at most 8
+#ifndef MDB_BUS_DEVICES
+#define MDB_BUS_DEVICES 	6
+#endif
+//peripherals per MDBSerial whose response time and error rate are tracked,
+//14 bytes each. a device without one keeps T_RESPONSE for its POLL
+#ifndef MDB_TIMING_SLOTS
+#define MDB_TIMING_SLOTS 	MDB_BUS_DEVICES
+#endif
+//answers an MDBBus keeps to parse while the next command goes out, at least 1
+#ifndef MDB_PIPELINE
+#define MDB_PIPELINE 		2
+#endif
+//serial and model number from the identification, 24 bytes per device
+#ifndef MDB_IDENTITY
+#define MDB_IDENTITY 		1
+#endif
+
+//debug build: the stack is painted at boot, Memory tracks the deepest stack,
+//the heap and the least free RAM and warns below MEMORY_WARN_FREE bytes
+#ifndef MDB_MEMORY_STATS
+#define MDB_MEMORY_STATS 	0
+#endif
+#ifndef MEMORY_WARN_FREE
+#define MEMORY_WARN_FREE 	256
+#endif
+
+//flight recorder in .noinit RAM, the last RECORDER_RECORDS log lines and bus
+//frames survive a watchdog or brown-out reset, 32 bytes per record
+#ifndef MDB_RECORDER
+#define MDB_RECORDER 		1
+#endif
+#ifndef RECORDER_RECORDS
+#define RECORDER_RECORDS 	16
+#endif
+
+//MDBBus::Sleep() puts the CPU into idle sleep until the next step is due or
+//an answer comes in, 0 to keep it running
+#ifndef MDB_SLEEP
+#define MDB_SLEEP 			1
+#endif
@@ -0,0 +1,189 @@
+#include "MDBDevice.h"
+
+//the identification response starts the same for every device class,
+//the option bits are only sent by level 2+ validators and level 3 changers
+void MDBDevice::identification()
+{
+	m_manufacturer_code = (m_buffer[0] * 1UL) << 16 | (unsigned int)m_buffer[1] << 8 | m_buffer[2];
+#if MDB_IDENTITY
+	for (int i = 0; i < 12; i++)
+	{
+		m_serial_number[i] = m_buffer[3 + i];
+		m_model_number[i] = m_buffer[15 + i];
+	}
+#endif
+	m_software_version = (unsigned int)m_buffer[27] << 8 | m_buffer[28];
+	if (m_count >= 33)
+		m_optional_features = (m_buffer[29] * 1UL) << 24 | (m_buffer[30] * 1UL) << 16 | (unsigned int)m_buffer[31] << 8 | m_buffer[32];
+}
+
+void MDBDevice::print_identification()
+{
+	debug << F("manufacturer: ") << (char)(m_manufacturer_code >> 16) << (char)(m_manufacturer_code >> 8) << (char)m_manufacturer_code << endl;
+#if MDB_IDENTITY
+	debug << F("serial number: ");
+	for (int i = 0; i < 12; i++)
+		debug << m_serial_number[i];
+	debug << endl;
+	debug << F("model number: ");
+	for (int i = 0; i < 12; i++)
+		debug << m_model_number[i];
+	debug << endl;
+#endif
+	debug << F("software version: ") << m_software_version << endl;
+	debug << F("optional features: ") << m_optional_features << endl;
+}
+
+void MDBDevice::event(uint8_t type, uint8_t item, uint8_t routing, unsigned long value)
+{
+	MDBEvent e;
+	e.type = type;
+	e.address = ADDRESS;
+	e.bus = m_bus;
+	e.item = item;
+	e.routing = routing;
+	e.value = value;
+	events.Push(e);
+}
+
+//a device on an MDBBus is left to the bus, the other buses keep running meanwhile
+void MDBDevice::run()
+{
+	while (m_step != STEP_IDLE)
+	{
+		if (m_on_bus || !ready())
+		{
+			MDBSerial::Idle();
+			continue;
+		}
+		if (!request())
+		{
+			m_step = STEP_IDLE;
+			break;
+		}
+		m_mdb->Send(m_command, m_command_count, m_descriptor);
+		int answer = m_mdb->GetResponse(m_buffer, &m_count);
+		response(answer);
+		track(answer);
+	}
+}
+
+//answers while a reset runs do not count, the reset ends with done()
+void MDBDevice::track(int answer)
+{
+	if (answer == 1 || answer == ACK)
+	{
+		m_failures = 0;
+		if (m_health == DEVICE_DEGRADED)
+			health(DEVICE_ONLINE);
+		return;
+	}
+	if (m_failures < 0xFF)
+		m_failures++;
+	if (m_health == DEVICE_RECOVERING || m_health == DEVICE_OFFLINE)
+		return;
+	if (m_failures >= HEALTH_OFFLINE)
+	{
+		health(DEVICE_OFFLINE);
+		m_step = STEP_IDLE;
+	}
+	else if (m_failures >= HEALTH_DEGRADED)
+		health(DEVICE_DEGRADED);
+}
+
+void MDBDevice::health(uint8_t state)
+{
+	if (state == m_health)
+		return;
+	if (state == DEVICE_OFFLINE)
+	{
+		m_offline_time = millis();
+		m_backoff = m_backoff == 0 ? HEALTH_BACKOFF_MIN : min(2U * m_backoff, (unsigned int)HEALTH_BACKOFF_MAX);
+		warning << F("MDB ") << ADDRESS << F(": OFFLINE") << endl;
+		if (m_on_bus)
+			debug << F("MDB ") << ADDRESS << F(": NEXT RESET IN ") << m_backoff << F(" MS") << endl;
+	}
+	else if (state == DEVICE_DEGRADED)
+		warning << F("MDB ") << ADDRESS << F(": DEGRADED, ") << (int)m_failures << F(" FAILURES") << endl;
+	else if (state == DEVICE_ONLINE)
+	{
+		//back from DEGRADED or OFFLINE, not after a plain reset
+		if (m_health == DEVICE_DEGRADED || m_backoff != 0)
+			status << F("MDB ") << ADDRESS << F(": ONLINE") << endl;
+		m_failures = 0;
+		m_backoff = 0;
+	}
+	m_health = state;
+	event(EVENT_HEALTH, state, 0, m_failures);
+}
+
+uint8_t MDBDevice::frame(MDBCommand c, const uint8_t *data, uint8_t *out)
+{
+	uint8_t count = 0;
+	out[count++] = ADDRESS | c.command;
+	if (c.sub != NO_SUB)
+		out[count++] = c.sub;
+	for (uint8_t i = 0; i < c.request && count < DATA_MAX; i++)
+		out[count++] = data[i];
+	return count;
+}
+
+void MDBDevice::command(MDBCommand c, const uint8_t *data)
+{
+	m_command_count = frame(c, data, m_command);
+	m_descriptor = c;
+}
+
+//own frame, a step of this device may wait in m_command meanwhile
+int MDBDevice::transact(MDBCommand c, const uint8_t *data)
+{
+	uint8_t out[DATA_MAX];
+	uint8_t count = frame(c, data, out);
+	m_mdb->Send(out, count, c);
+	return m_mdb->GetResponse(m_buffer, &m_count);
+}
+
+//MDBSerial already refused data of another length, only an ACK can be wrong
+bool MDBDevice::accepted(MDBCommand c, int answer)
+{
+	if (answer == ACK)
+		return c.flags & ANSWER_ACK;
+	if (answer != 1)
+		return false;
+	m_mdb->Ack();
+	return true;
+}
+
+//a new step starts with a fresh retry count
+void MDBDevice::step(uint8_t next, unsigned int wait)
+{
+	if (next != m_step)
+		m_retry = 0;
+	m_step = next;
+	m_step_time = millis();
+	m_step_wait = wait;
+}
+
+//repeats the current step after wait ms, false once max retries are used up.
+//both are scaled by the error rate of the device, see MDBSerial::RetryBudget()
+bool MDBDevice::retry(unsigned int wait, int max)
+{
+	max = m_mdb->RetryBudget(ADDRESS, max);
+	wait = m_mdb->RetryWait(ADDRESS, wait);
+	if (m_retry >= max)
+	{
+		m_retry = 0;
+		return false;
+	}
+	m_retry++;
+	m_step_time = millis();
+	m_step_wait = wait;
+	return true;
+}
+
+void MDBDevice::wait(unsigned long ms)
+{
+	unsigned long start = millis();
+	while (millis() - start < ms)
+		MDBSerial::Idle();
+}
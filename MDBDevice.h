@@ -2,6 +2,7 @@
 
 #include "MDBSerial.h"
 #include "Logger.h"
+#include "MDBEvent.h"
 #include <Arduino.h>
 
 #define RESET 					0x00
@@ -11,6 +12,7 @@
 #define EXPANSION 				0x07
 #define IDENTIFICATION 			0x00
 #define FEATURE_ENABLE 			0x01
+#define DIAGNOSTICS 			0xFF
 
 #define JUST_RESET 		 		0x0B
 
@@ -18,38 +20,162 @@
 
 #define MAX_RESET 				5
 #define MAX_RESET_POLL 			15
+#define MAX_PAYOUT_POLL 		200
 
-#define SETUP_TIME 				200
-#define RESPONSE_TIME 			5
+//ms between the start of two poll cycles of a device on an MDBBus
+#define POLL_INTERVAL 			100
+
+//step of a device without anything to send
+#define STEP_IDLE 				0
+
+//priority of a step on an MDBBus: of the ready steps the bus sends the one
+//with the highest priority, the earliest deadline among equal ones
+#define PRIORITY_BACKGROUND 	0 	//tube, stacker, recycler and diagnostic status
+#define PRIORITY_POLL 			1 	//polls, coin and bill enables, setup
+#define PRIORITY_URGENT 		2 	//the customer waits: escrow decisions, vend approvals
+#define PRIORITIES 				3
+
+//ms a ready step may wait for the bus, background steps have no deadline
+#define DEADLINE_URGENT 		20
+#define DEADLINE_POLL 			POLL_INTERVAL
+
+//health of a device from the transactions in a row that failed, by timeout,
+//NAK, checksum or UART error
+#define DEVICE_ONLINE 			0
+#define DEVICE_DEGRADED 		1 	//HEALTH_DEGRADED failures in a row
+#define DEVICE_OFFLINE 			2 	//HEALTH_OFFLINE failures or a failed reset
+#define DEVICE_RECOVERING 		3 	//a reset runs, its result decides
+
+#define HEALTH_DEGRADED 		3
+#define HEALTH_OFFLINE 			10
+//ms an offline device on an MDBBus waits for its next reset, doubled after
+//every reset that failed
+#define HEALTH_BACKOFF_MIN 		500
+#define HEALTH_BACKOFF_MAX 		32000
 
 #define WARNING					1
 #define ERROR					2
 #define SEVERE					3
 
+static_assert(MDB_BUFFER_SIZE >= DATA_MAX, "MDB_BUFFER_SIZE: an answer has up to DATA_MAX bytes");
+
 class MDBDevice
 {
 public:
 	explicit
-	MDBDevice(MDBSerial &mdb) : m_mdb(&mdb) {}
+	MDBDevice(MDBSerial &mdb) : m_mdb(&mdb), ADDRESS(0), m_resetCount(0), m_count(0),
+		m_feature_level(0), m_country(0), m_manufacturer_code(0),
+		m_software_version(0), m_optional_features(0),
+		m_step(STEP_IDLE), m_retry(0), m_step_time(0), m_step_wait(0),
+		m_command_count(0), m_descriptor(MDB_RAW), m_result(false), m_bus_reset(false), m_on_bus(false),
+		m_bus(0), m_reset_pending(false), m_cycle_time(0), m_queued(false), m_answer(0),
+		m_health(DEVICE_ONLINE), m_failures(0), m_backoff(0), m_offline_time(0), m_recoveries(0)
+	{
+#if MDB_IDENTITY
+		for (int i = 0; i < 12; i++)
+		{
+			m_serial_number[i] = ' ';
+			m_model_number[i] = ' ';
+		}
+#endif
+	}
 
 	virtual bool Reset() = 0;
 
 	virtual void Print() = 0;
+
+	inline int GetAddress() { return ADDRESS; }
+
+	//an offline device on an MDBBus gets no poll cycles, the bus resets it in
+	//the background after the backoff. without a bus only Reset() brings it back
+	inline uint8_t GetHealth() { return m_health; }
+	inline uint8_t GetFailures() { return m_failures; }
+	inline unsigned long GetRecoveries() { return m_recoveries; }
 	
 protected:
-	virtual int poll() = 0;
+	friend class MDBBus;
+	template <class... Devices> friend class BusMaster;
+
+	//asynchronous steps, each one sends a single command: request() builds it
+	//into m_command, response() parses the answer in m_buffer and picks the
+	//next step. an MDBBus runs the steps of its devices in turns, run() runs
+	//them for this device alone.
+	virtual void reset() = 0; 	//first step of Reset()
+	virtual void restart() = 0; //first step after a bus reset
+	virtual void cycle() = 0; 	//first step of a poll cycle
+	virtual bool request() = 0;
+	virtual void response(int answer) = 0;
+	//of the current step
+	virtual uint8_t priority() { return PRIORITY_POLL; }
+
+	void run();
+	//builds the command of a step into m_command, with c.request bytes of data
+	void command(MDBCommand c, const uint8_t *data = 0);
+	//blocking command, the answer goes to m_buffer
+	int transact(MDBCommand c, const uint8_t *data = 0);
+	//the answer is the one c expects, an answer with data gets its ACK
+	bool accepted(MDBCommand c, int answer);
+	uint8_t frame(MDBCommand c, const uint8_t *data, uint8_t *out);
+	void step(uint8_t next, unsigned int wait = 0);
+	bool retry(unsigned int wait = 50, int max = MAX_RESET);
+	//end of a reset
+	inline void done(bool result) { m_result = result; step(STEP_IDLE); health(result ? DEVICE_ONLINE : DEVICE_OFFLINE); }
+	inline bool ready() { return m_step != STEP_IDLE && millis() - m_step_time >= m_step_wait; }
+	//like delay(), but the other buses keep running
+	void wait(unsigned long ms);
+
+	void identification();
+	void print_identification();
+
+	//counts the answer of a transaction for the health, after response()
+	void track(int answer);
+	void health(uint8_t state);
+
+	//queues an event for the application, tagged with the device address and
+	//bus, events are dropped and counted while the queue is full
+	void event(uint8_t type, uint8_t item = 0, uint8_t routing = 0, unsigned long value = 0);
 	
 	MDBSerial *m_mdb;
 
+	int ADDRESS;
+
 	int m_resetCount;
 	
 	int m_count;
-	char m_buffer[64];
+	uint8_t m_buffer[MDB_BUFFER_SIZE];
 
-	char m_feature_level;
+	uint8_t m_feature_level;
 	unsigned int m_country;
 
 	unsigned long m_manufacturer_code;
+#if MDB_IDENTITY
 	char m_serial_number[12];
 	char m_model_number[12];
-};
+#endif
+	unsigned long m_software_version;
+	unsigned long m_optional_features;
+
+	uint8_t m_step;
+	uint8_t m_retry;
+	unsigned long m_step_time;
+	unsigned int m_step_wait;
+	uint8_t m_command[DATA_MAX];
+	uint8_t m_command_count;
+	MDBCommand m_descriptor; 	//of m_command
+	bool m_result; 		//of the last Reset()
+	bool m_bus_reset; 	//the reset was a BREAK, RESET is the fallback
+
+	//set by MDBBus
+	bool m_on_bus;
+	uint8_t m_bus;
+	bool m_reset_pending;
+	unsigned long m_cycle_time;
+	bool m_queued; 			//m_answer waits to be parsed
+	int m_answer;
+
+	uint8_t m_health;
+	uint8_t m_failures; 		//in a row
+	unsigned int m_backoff;
+	unsigned long m_offline_time;
+	unsigned long m_recoveries; //resets started by the bus
+};
@@ -0,0 +1,44 @@
+#include "MDBEvent.h"
+
+//keeps the compiler from moving the slot access past the index update
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+EventQueue events;
+
+EventQueue::EventQueue() : m_head(0), m_tail(0), m_dropped(0)
+{
+}
+
+//a full queue drops the new event, the application has to drain in time
+bool EventQueue::Push(const MDBEvent &event)
+{
+	uint8_t tail = m_tail;
+	uint8_t next = (tail + 1) % EVENT_QUEUE_SIZE;
+	if (next == m_head)
+	{
+		m_dropped++;
+		return false;
+	}
+	m_events[tail] = event;
+	barrier();
+	m_tail = next;
+	return true;
+}
+
+bool EventQueue::Pop(MDBEvent &event)
+{
+	uint8_t head = m_head;
+	if (head == m_tail)
+		return false;
+	barrier();
+	event = m_events[head];
+	barrier();
+	m_head = (head + 1) % EVENT_QUEUE_SIZE;
+	return true;
+}
+
+//only from the consumer side
+void EventQueue::Clear()
+{
+	m_head = m_tail;
+}
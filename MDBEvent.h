@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+//number of events the application can fall behind, power of two
+#define EVENT_QUEUE_SIZE 			32
+
+//item is the coin or bill type, value the credit in the smallest currency unit
+#define EVENT_COIN_ACCEPTED 		1 	//routing 0 cash box, 1 tubes
+#define EVENT_COIN_REJECTED 		2
+#define EVENT_COINS_DISPENSED 		3 	//manually, routing holds the number of coins
+#define EVENT_SLUG 					4 	//value holds the number of slugs
+#define EVENT_BILL_ESCROWED 		5
+#define EVENT_BILL_STACKED 			6
+#define EVENT_BILL_RETURNED 		7
+#define EVENT_BILL_TO_RECYCLER 		8
+#define EVENT_BILL_REJECTED 		9
+#define EVENT_PAYOUT_PROGRESS 		10 	//value paid out so far
+#define EVENT_PAYOUT_COMPLETE 		11 	//value paid out in total
+#define EVENT_FAULT 				12 	//item holds the status byte
+#define EVENT_RESET 				13
+#define EVENT_HEALTH 				14 	//item holds the DEVICE_ state, value the failures in a row
+#define EVENT_DEVICE_FOUND 			15 	//by MDBBus::Discover(), item 1 if a driver took it
+#define EVENT_SESSION_BEGIN 		16 	//cashless, value holds the funds, 0xFFFF scaled if unknown
+#define EVENT_SESSION_END 			17
+#define EVENT_VEND_APPROVED 		18 	//value holds the amount
+#define EVENT_VEND_DENIED 			19
+#define EVENT_SESSION_CANCEL 		20 	//the reader asks to end the session
+
+struct MDBEvent
+{
+	uint8_t type;
+	uint8_t address;
+	uint8_t item;
+	uint8_t routing;
+	unsigned long value;
+	uint8_t bus; 		//index of the MDBBus, 0 without one
+};
+
+//single producer, single consumer ring without locks: only the producer writes
+//m_tail and only the consumer writes m_head, both are single bytes
+class EventQueue
+{
+public:
+	EventQueue();
+
+	bool Push(const MDBEvent &event);
+	bool Pop(MDBEvent &event);
+	void Clear();
+
+	inline bool Empty() { return m_head == m_tail; }
+	inline uint8_t Count() { return (uint8_t)(m_tail - m_head) % EVENT_QUEUE_SIZE; }
+	inline unsigned int GetDropped() { return m_dropped; }
+
+private:
+	MDBEvent m_events[EVENT_QUEUE_SIZE];
+	volatile uint8_t m_head;
+	volatile uint8_t m_tail;
+	unsigned int m_dropped;
+};
+
+extern EventQueue events;
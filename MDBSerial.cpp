@@ -1,42 +1,147 @@
 #include "MDBSerial.h"
+#include <limits.h>
+#include "Recorder.h"
 
 
+void (*MDBSerial::s_idle)() = 0;
+
 MDBSerial::MDBSerial(uint8_t uart) 
 {
 	m_uart = new UART(uart);
+	m_state = MDB_IDLE;
+	m_blocked = false;
+	m_auto_ack = false;
+	m_frame_count = 0;
+	m_sent = 0;
+	m_count = 0;
+	m_sum = 0;
+	m_start = 0;
+	m_tx_end = 0;
+	m_window = 0;
+	m_current = 0;
+	memset(m_timing, 0, sizeof(m_timing));
+	ClearStats();
 }
 
-bool MDBSerial::begin()
+MDBSerial::~MDBSerial()
 {
-	//hardReset(); //does not work at the moment
-	return m_uart->begin(9600, true);
+	delete m_uart;
+}
+
+unsigned int MDBSerial::GetDropped()
+{
+	return m_uart->getDropped();
 }
 
-void MDBSerial::hardReset()
+void MDBSerial::ClearStats()
 {
-	/*
-	pinMode(m_TXn, OUTPUT);
-	digitalWrite(m_TXn, HIGH);
-	delay(TIME_SETUP);
-	digitalWrite(m_TXn, LOW);
-	delay(TIME_BREAK);
-	digitalWrite(m_TXn, HIGH);
-	*/
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+MDBTiming *MDBSerial::timing(uint8_t address, bool add)
+{
+	for (int i = 0; i < MDB_TIMING_SLOTS; i++)
+	{
+		if (m_timing[i].address == address)
+			return &m_timing[i];
+		if (m_timing[i].address == 0 && add)
+		{
+			m_timing[i].address = address;
+			m_timing[i].window_us = T_RESPONSE;
+			return &m_timing[i];
+		}
+	}
+	return 0;
+}
+
+const MDBTiming *MDBSerial::GetTiming(uint8_t address)
+{
+	return timing(address & 0xF8, false);
+}
+
+int MDBSerial::RetryBudget(uint8_t address, int max)
+{
+	MDBTiming *t = timing(address & 0xF8, false);
+	if (t == 0 || max <= 1)
+		return max;
+	return max - (long)(max - 1) * t->errors / MDB_ERRORS_ALL;
+}
+
+unsigned int MDBSerial::RetryWait(uint8_t address, unsigned int wait)
+{
+	MDBTiming *t = timing(address & 0xF8, false);
+	if (t == 0)
+		return wait;
+	return wait + 3UL * wait * t->errors / MDB_ERRORS_ALL;
+}
+
+//the first word is complete one word time after it started. the window is
+//the mean plus four deviations, as for TCP, and T_RESPONSE_SLACK, within
+//T_RESPONSE_MIN and T_RESPONSE
+void MDBSerial::measured(unsigned long now)
+{
+	MDBTiming *t = m_current;
+	if (t == 0)
+		return;
+	long sample = now - m_tx_end - WORD_TIME_US;
+	if (sample < 0)
+		sample = 0;
+	if (t->samples == 0)
+	{
+		t->response_us = sample;
+		t->deviation_us = sample / 2;
+	}
+	else
+	{
+		long diff = sample - (long)t->response_us;
+		t->response_us += diff / 8;
+		t->deviation_us += ((diff < 0 ? -diff : diff) - (long)t->deviation_us) / 4;
+	}
+	if (t->samples < 0xFFFF)
+		t->samples++;
+	if (t->samples >= MDB_TIMING_SAMPLES)
+		t->window_us = constrain(t->response_us + 4UL * t->deviation_us + T_RESPONSE_SLACK,
+				T_RESPONSE_MIN, T_RESPONSE);
+}
+
+void MDBSerial::Idle()
+{
+	if (s_idle)
+		s_idle();
+	yield();
+}
+
+bool MDBSerial::begin()
+{
+	Timer::begin();
+	return m_uart->begin(9600, true);
 }
 
 void MDBSerial::Ack()
 {
-	m_uart->write9bit(0x00); //need 0 since ACK is 0x100 and doesnt work
+	if (!m_auto_ack)
+		write(0x00); //need 0 since ACK is 0x100 and doesnt work
 }
 
 void MDBSerial::Nak()
 {
-	m_uart->write9bit(NAK);
+	write(NAK);
 }
 
 void MDBSerial::Ret()
 {
-	m_uart->write9bit(RET);
+	write(RET);
+}
+
+//the UART sends without a gap once the word before is out, m_tx_end is at
+//most two words ahead or it is from an earlier transaction
+void MDBSerial::write(uint16_t word)
+{
+	unsigned long now = MDBTimer::Now();
+	if (m_tx_end - now > 2 * WORD_TIME_US)
+		m_tx_end = now;
+	m_tx_end += WORD_TIME_US;
+	m_uart->write9bit(word);
 }
 
 void MDBSerial::SendCommand(int address, int cmd, int *data, int dataCount)
@@ -46,87 +151,245 @@ void MDBSerial::SendCommand(int address, int cmd, int *data, int dataCount)
 
 void MDBSerial::SendCommand(int address, int cmd,  int subCmd, int *data, int dataCount)
 {
-	char sum = 0;
-	m_uart->flush();
-	m_uart->write9bit(0x100 | address | cmd);
-	sum += address | cmd;
-	
+	uint8_t frame[DATA_MAX];
+	int count = 0;
+	frame[count++] = address | cmd;
 	if (subCmd >= 0)
+		frame[count++] = subCmd;
+	for (int i = 0; i < dataCount && count < DATA_MAX; i++)
+		frame[count++] = data[i];
+	Send(frame, count);
+}
+
+//waits for a transaction an MDBBus has running, the bus starts no new one
+//until GetResponse() is done. the buses parse their queued answers first,
+//the answer of this call may go into the buffer of one of them
+void MDBSerial::Send(const uint8_t *frame, int count, MDBCommand command)
+{
+	m_blocked = true;
+	if (s_idle)
+		s_idle();
+	while (Busy())
+		Idle();
+	Start(frame, count, command);
+}
+
+//data has to hold DATA_MAX bytes, longer frames are dropped. the frame ends
+//with the mode bit
+int MDBSerial::GetResponse(uint8_t data[], int *count)
+{
+	if (count)
+		*count = 0;
+	m_blocked = true;
+	//without a command just take what comes in
+	if (!Busy())
 	{
-		m_uart->write9bit(subCmd);
-		sum += subCmd;
+		m_state = MDB_WAITING;
+		m_start = MDBTimer::Now();
+		m_command = MDB_RAW;
+		m_timer.Start(T_RESPONSE);
 	}
+	int answer;
+	while ((answer = Update()) == MDB_BUSY)
+		Idle();
+	m_blocked = false;
+
+	if (answer != 1)
+		return answer;
+	//caller only expects an ACK
+	if (data == 0 || count == 0)
+		return -5;
+	memcpy(data, m_data, m_count);
+	*count = m_count;
+	return 1;
+}
 
-	for (int i = 0; i < dataCount; i++)
+bool MDBSerial::Start(const uint8_t *frame, int count, MDBCommand command, unsigned int window)
+{
+	if (Busy() || count < 1 || count > DATA_MAX)
+		return false;
+	m_sum = 0;
+	for (int i = 0; i < count; i++)
 	{
-		m_uart->write9bit(data[i]);
-		sum += data[i];
+		m_frame[i] = frame[i];
+		m_sum += frame[i];
 	}
-	m_uart->write9bit(sum); //send the checksum
-	delay(RESPONSE_TIME * 2);
-}
-
-int MDBSerial::GetResponse(char data[], int *count, int num_bytes)
-{	
-	char sum = 0;
-	*count = 0;
-	
-	//wait for the response to arrive
-	delay(RESPONSE_TIME);
-	for (int i = 0; i < num_bytes; i++)
+	m_frame[count] = m_sum; //checksum
+	m_frame_count = count + 1;
+	m_sent = 0;
+	m_count = 0;
+	m_sum = 0;
+	m_uart->flush();
+	m_timer.Stop();
+	m_state = MDB_SENDING;
+	m_start = MDBTimer::Now();
+	m_window = window;
+	m_command = command;
+	m_current = window ? 0 : timing(m_frame[0] & 0xF8, true);
+	m_stats.transactions++;
+	recorder.Frame(RECORD_COMMAND, m_uart->getNumber(), 0, m_frame, count);
+	Update();
+	return true;
+}
+
+bool MDBSerial::Break()
+{
+	if (Busy())
+		return false;
+	m_start = MDBTimer::Now();
+	//the words still in the UART go out before the line drops
+	if (m_tx_end - m_start > 2 * WORD_TIME_US)
+		m_tx_end = m_start;
+	m_uart->setBreak(true);
+	m_timer.StartAt(m_tx_end + T_BREAK);
+	m_state = MDB_BREAK;
+	m_stats.resets++;
+	return true;
+}
+
+//words only go out while the UART can take them, so Update() never waits for
+//the 9600 baud line. the answer is complete with the mode bit, the peripheral
+//has T_RESPONSE after the end of the command for the first word and
+//T_INTER_BYTE between the others, the deadlines run on m_timer
+int MDBSerial::Update()
+{
+	switch (m_state)
 	{
-		if (m_uart->ninthBitSet())
-		{
-			break;
-		}
-		else if (m_uart->error())
+	case MDB_IDLE:
+		return -2;
+
+	case MDB_SENDING:
+		while (m_sent < m_frame_count && m_uart->txReady())
 		{
-			m_uart->flush();
-			return -1;
+			write(m_sent == 0 ? 0x100 | m_frame[0] : m_frame[m_sent]);
+			m_sent++;
 		}
+		if (m_sent < m_frame_count)
+			return MDB_BUSY;
+		//a word is complete in the receiver one word time after its start.
+		//only a POLL gets the adapted window: a peripheral sends its answer
+		//again when the VMC missed it, a late ACK of another command could
+		//make the VMC repeat a payout
+		m_state = MDB_WAITING;
+		if (m_window)
+			m_timer.StartAt(m_tx_end + WORD_TIME_US + m_window);
 		else
-		{
-			delay(BYTE_SEND_TIME + INTER_BYTE_TIME);
-		}
+			m_timer.StartAt(m_tx_end + WORD_TIME_US
+					+ (m_current && (m_command.flags & WINDOW_POLL) ? m_current->window_us : T_RESPONSE));
+		return MDB_BUSY;
+
+	case MDB_BREAK:
+		if (!m_timer.Expired())
+			return MDB_BUSY;
+		m_uart->setBreak(false);
+		m_state = MDB_SETUP;
+		m_timer.Start(T_SETUP);
+		return MDB_BUSY;
+
+	//whatever came in during the break is noise
+	case MDB_SETUP:
+		if (!m_timer.Expired())
+			return MDB_BUSY;
+		m_uart->error();
+		m_uart->flush();
+		m_state = MDB_IDLE;
+		m_stats.busy_us += MDBTimer::Now() - m_start;
+		return ACK;
+	}
+
+	if (m_uart->error())
+	{
+		m_uart->flush();
+		return finish(-1);
 	}
-	
-	//nothing received
-	if (!m_uart->available())
-		return -2;
-	
-	int c = 0;
 	while (m_uart->available())
 	{
+		//the time it came in, Update() may run late while the bus parses
+		if (m_state == MDB_WAITING)
+			measured(m_uart->rxTime());
 		int resp = m_uart->read();
-		char val = resp;
+		uint8_t val = resp;
+		m_state = MDB_RECEIVING;
+		m_timer.Start(T_INTER_BYTE + WORD_TIME_US);
 		if (resp & 0x100)
 		{
-			if (c == 0) //we got an ACK //or NAK or RET??
+			m_uart->flush();
+			if (m_count == 0) //we got an ACK //or NAK or RET??
 			{
-				m_uart->flush();
 				if (resp == ACK)
-					return ACK;
-				else if (resp == NAK)
-					return -4;
+					return finish(ACK);
+				else if (val == NAK)
+					return finish(-4);
 				else
-					return -5;
-			}
-			else //checksum of data
-			{
-				if (sum != val)
-				{
-					m_uart->flush();
-					return -3;
-				}
+					return finish(-5);
 			}
+			//checksum of data
+			if (m_sum != val)
+				return finish(-3);
+			if (!answer_fits(m_command, m_count))
+				return finish(-5);
+			if (m_auto_ack)
+				write(0x00);
+			return finish(1);
 		}
-		else
+		//frame is too long
+		if (m_count >= DATA_MAX)
 		{
-			data[c++] = val;
-			sum += val;
+			m_uart->flush();
+			return finish(-5);
 		}
+		m_data[m_count++] = val;
+		m_sum += val;
 	}
-	*count = c;
+	if (!m_timer.Expired())
+		return MDB_BUSY;
+	//nothing received or a frame without checksum
 	m_uart->flush();
-	return 1;
-}
\ No newline at end of file
+	return finish(m_state == MDB_WAITING ? -2 : -3);
+}
+
+unsigned long MDBSerial::GetIdle()
+{
+	if (m_state == MDB_IDLE)
+		return ULONG_MAX;
+	if (m_state == MDB_SENDING)
+	{
+		long us = (long)(m_tx_end - WORD_TIME_US - MDBTimer::Now());
+		return us > 0 ? us : 0;
+	}
+	if (m_uart->available() || m_timer.Expired())
+		return 0;
+	return ULONG_MAX;
+}
+
+int MDBSerial::finish(int result)
+{
+	m_state = MDB_IDLE;
+	m_timer.Stop();
+	if (result == ACK)
+		m_stats.acks++;
+	else if (result == 1)
+		m_stats.data++;
+	else if (result == -4)
+		m_stats.naks++;
+	else if (result == -2)
+		m_stats.timeouts++;
+	else
+		m_stats.errors++;
+	m_stats.busy_us += MDBTimer::Now() - m_start;
+	//a timeout gives the next POLL the whole window again
+	if (m_current)
+	{
+		m_current->errors -= m_current->errors / 8;
+		if (result < 0)
+			m_current->errors += MDB_ERRORS_ALL / 8;
+		if (result == -2)
+		{
+			m_current->window_us = T_RESPONSE;
+			m_current->samples = 0;
+		}
+		m_current = 0;
+	}
+	recorder.Frame(RECORD_ANSWER, m_uart->getNumber(), result, m_data, m_count);
+	return result;
+}
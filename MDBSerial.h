@@ -1,42 +1,153 @@
 #pragma once
 #include <Arduino.h>
 #include "UART.h"
+#include "MDBTimer.h"
+#include "MDBCommand.h"
 
 //MDB specific stuff
 #define DATA_MAX 36
 
-#define TIME_OUT 	5
-#define TIME_BREAK 	100
-#define TIME_SETUP 	200
-
 #define ACK 	0x100
 #define RET 	0xAA
 #define NAK 	0xFF
 
-#define INTER_BYTE_TIME 	1
-#define RESPONSE_TIME 		5
-#define BYTE_SEND_TIME 		1.2
+//one 9 bit word at 9600 baud with start and stop bit in us
+#define WORD_TIME_US 		1146
+
+//Update() while a transaction is running
+#define MDB_BUSY 			0
+
+//answers a peripheral has to give before its POLL window is adapted
+#define MDB_TIMING_SAMPLES 	8
+//share of failed transactions in MDBTiming::errors
+#define MDB_ERRORS_ALL 		0x8000
+
+//states of the transaction engine
+#define MDB_IDLE 			0
+#define MDB_SENDING 		1
+#define MDB_WAITING 		2 	//frame is out, nothing received yet
+#define MDB_RECEIVING 		3
+#define MDB_BREAK 			4 	//TX held low for T_BREAK
+#define MDB_SETUP 			5 	//peripherals start up for T_SETUP
+
+struct MDBStats
+{
+	unsigned long transactions;
+	unsigned long acks;
+	unsigned long data;
+	unsigned long naks;
+	unsigned long timeouts;
+	unsigned long errors; 		//UART, checksum and framing errors
+	unsigned long resets; 		//bus resets
+	unsigned long busy_us; 		//time a transaction was running
+};
+
+//measured timing of one peripheral, the averages move by 1/8 per answer
+struct MDBTiming
+{
+	uint8_t address; 			//0 for a free slot
+	unsigned int response_us; 	//end of the command to the first word
+	unsigned int deviation_us;
+	unsigned int window_us; 	//response timeout of its next POLL
+	unsigned int errors; 		//failed transactions, MDB_ERRORS_ALL for all
+	unsigned int samples;
+};
 
 class MDBSerial
 {
 public:
 	MDBSerial(uint8_t uart = 0);
+	~MDBSerial();
 	
 	bool begin();
 	
+	//no-op with auto ACK, the engine has sent it
 	void Ack();
 	void Nak();
 	void Ret();
 
+	//blocking, other buses keep running through Idle() while this one waits
 	void SendCommand(int address, int cmd, int *data, int dataCount);
 	void SendCommand(int address, int cmd, int subCmd = -1, int *data = 0, int dataCount = 0);
-	int GetResponse(char data[] = 0, int *count = 0, int num_bytes = 1);
+	int GetResponse(uint8_t data[] = 0, int *count = 0);
+	//frame and command as for Start()
+	void Send(const uint8_t *frame, int count, MDBCommand command = MDB_RAW);
+
+	//non-blocking transaction: frame holds address | command and the data
+	//without checksum, Update() returns MDB_BUSY until the answer is complete
+	//and then the result code of GetResponse(). command gives the response
+	//window and the answer lengths: an answer with data of another length
+	//ends with -5 and gets no ACK, the peripheral sends it again. window is
+	//a response timeout in us for a peripheral that may not be there, it is
+	//not measured
+	bool Start(const uint8_t *frame, int count, MDBCommand command = MDB_RAW, unsigned int window = 0);
+	int Update();
+	inline bool Busy() { return m_state != MDB_IDLE; }
+	//words of the command still have to go out from Update()
+	inline bool IsSending() { return m_state == MDB_SENDING; }
+	//us Update() has nothing to do that an interrupt would not announce: the
+	//next word of the command waits for the UART, a received word or the
+	//timer ends everything else. ULONG_MAX without a transaction
+	unsigned long GetIdle();
+	inline const uint8_t *GetData() { return m_data; }
+	inline int GetCount() { return m_count; }
+
+	//bus reset: BREAK for T_BREAK, then T_SETUP for the peripherals to start.
+	//Update() returns MDB_BUSY until the setup time is over and then ACK
+	bool Break();
+
+	//set by a blocking call, an MDBBus does not start transactions meanwhile
+	inline bool IsBlocked() { return m_blocked; }
+
+	//Update() ACKs an answer with data as soon as its checksum and length are
+	//right, the next command can follow before the answer is parsed
+	inline void SetAutoAck(bool on) { m_auto_ack = on; }
+
+	//bytes of the peripherals lost in the receive path
+	unsigned int GetDropped();
+	inline const MDBStats &GetStats() { return m_stats; }
+	void ClearStats();
+	//0 for a peripheral that was never sent a command
+	const MDBTiming *GetTiming(uint8_t address);
+
+	//retries a step of the peripheral gets: max while its transactions go
+	//through, down to one when they all fail, and the wait between them grows
+	//up to four times, so a flaky peripheral does not hold the bus
+	int RetryBudget(uint8_t address, int max);
+	unsigned int RetryWait(uint8_t address, unsigned int wait);
+
+	//runs while a blocking call waits, MDBBus hooks in here
+	static void Idle();
+	static void (*s_idle)();
 
 private:
-	void hardReset();
+	void write(uint16_t word);
+	int finish(int result);
+	MDBTiming *timing(uint8_t address, bool add);
+	void measured(unsigned long now);
 	
 private:
 	UART *m_uart;
+
+	uint8_t m_state;
+	bool m_blocked;
+	bool m_auto_ack;
+	uint8_t m_frame[DATA_MAX + 1];
+	uint8_t m_frame_count;
+	uint8_t m_sent;
+	uint8_t m_data[DATA_MAX];
+	uint8_t m_count;
+	uint8_t m_sum;
+	unsigned long m_start; 		//of the transaction
+	unsigned long m_tx_end; 	//the last word written is on the wire
+	unsigned int m_window; 		//of Start(), 0 for the one of the peripheral
+	MDBCommand m_command; 		//of the running transaction
+	MDBTimer m_timer; 			//T_RESPONSE or T_INTER_BYTE
+
+	MDBTiming m_timing[MDB_TIMING_SLOTS];
+	MDBTiming *m_current; 		//of the running transaction
+
+	MDBStats m_stats;
 };
 
 
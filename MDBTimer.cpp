@@ -0,0 +1,108 @@
+#include "MDBTimer.h"
+#include "Power.h"
+
+MDBTimer *MDBTimer::s_timers[MDB_TIMERS];
+uint8_t MDBTimer::s_lost = 0;
+
+MDBTimer::MDBTimer()
+{
+	m_running = false;
+	m_expired = false;
+	m_deadline = 0;
+	m_callback = 0;
+	m_arg = 0;
+	for (int i = 0; i < MDB_TIMERS; i++)
+	{
+		if (s_timers[i] == 0)
+		{
+			s_timers[i] = this;
+			return;
+		}
+	}
+	//constructed before the logger, the sketch reports it from Lost()
+	s_lost++;
+}
+
+MDBTimer::~MDBTimer()
+{
+	Stop();
+	for (int i = 0; i < MDB_TIMERS; i++)
+		if (s_timers[i] == this)
+			s_timers[i] = 0;
+}
+
+void MDBTimer::Start(unsigned long us, MDBTimerCallback callback, void *arg)
+{
+	StartAt(Timer::now() + us, callback, arg);
+}
+
+void MDBTimer::StartAt(unsigned long at, MDBTimerCallback callback, void *arg)
+{
+	uint8_t sreg = SREG;
+	cli();
+	m_deadline = at;
+	m_callback = callback;
+	m_arg = arg;
+	m_expired = false;
+	m_running = true;
+	arm();
+	SREG = sreg;
+}
+
+void MDBTimer::Stop()
+{
+	uint8_t sreg = SREG;
+	cli();
+	m_running = false;
+	m_expired = false;
+	arm();
+	SREG = sreg;
+}
+
+unsigned long MDBTimer::Remaining()
+{
+	uint8_t sreg = SREG;
+	cli();
+	long us = m_running ? (long)(m_deadline - Timer::now()) : 0;
+	SREG = sreg;
+	return us > 0 ? us : 0;
+}
+
+void MDBTimer::Dispatch()
+{
+	unsigned long now = Timer::now();
+	for (int i = 0; i < MDB_TIMERS; i++)
+	{
+		MDBTimer *timer = s_timers[i];
+		if (timer == 0 || !timer->m_running || (long)(now - timer->m_deadline) < 0)
+			continue;
+		timer->m_running = false;
+		timer->m_expired = true;
+		Power::Wake();
+		if (timer->m_callback)
+			timer->m_callback(timer->m_arg);
+	}
+	arm();
+}
+
+//the hardware timer only holds the earliest deadline
+void MDBTimer::arm()
+{
+	unsigned long now = Timer::now();
+	bool any = false;
+	long next = 0;
+	for (int i = 0; i < MDB_TIMERS; i++)
+	{
+		MDBTimer *timer = s_timers[i];
+		if (timer == 0 || !timer->m_running)
+			continue;
+		long left = timer->m_deadline - now;
+		if (!any || left < next)
+			next = left;
+		any = true;
+	}
+	if (any)
+		Timer::arm(now + next);
+	else
+		Timer::disarm();
+}
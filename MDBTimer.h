@@ -0,0 +1,56 @@
+#pragma once
+#include "Timer.h"
+
+//deadlines of the MDB protocol in us
+#define T_RESPONSE 		5000 	//end of the VMC frame to the first word of the answer
+#define T_RESPONSE_MIN 	1500 	//shortest adapted response window of a POLL
+#define T_RESPONSE_SLACK 	500 	//added to the measured response time
+#define T_INTER_BYTE 	1000 	//between two words of a frame
+#define T_BREAK 		100000 	//bus reset, TX held low
+#define T_SETUP 		200000 	//after the break before the first command
+
+//running at the same time, a transaction and a bus reset on three buses and
+//the wake-up of Power. a timer beyond them never expires, see Lost()
+#define MDB_TIMERS 		7
+
+typedef void (*MDBTimerCallback)(void *arg);
+
+//one deadline on the hardware timer: at the time given to Start() the timer
+//interrupt sets Expired(), runs the callback and wakes the CPU from
+//Power::Sleep(), nothing polls for it.
+//callbacks run in the interrupt and must not start timers
+class MDBTimer
+{
+public:
+	MDBTimer();
+	~MDBTimer();
+
+	void Start(unsigned long us, MDBTimerCallback callback = 0, void *arg = 0);
+	//at is an absolute time of Now()
+	void StartAt(unsigned long at, MDBTimerCallback callback = 0, void *arg = 0);
+	void Stop();
+
+	inline bool Expired() { return m_expired; }
+	inline bool Running() { return m_running; }
+	unsigned long Remaining();
+
+	static inline unsigned long Now() { return Timer::now(); }
+	//timers constructed while all MDB_TIMERS places were taken
+	static inline uint8_t Lost() { return s_lost; }
+
+	//from the compare interrupt, expires the timers that are due and arms the
+	//hardware timer for the next one
+	static void Dispatch();
+
+private:
+	static void arm();
+
+	volatile bool m_running;
+	volatile bool m_expired;
+	unsigned long m_deadline;
+	MDBTimerCallback m_callback;
+	void *m_arg;
+
+	static MDBTimer *s_timers[MDB_TIMERS];
+	static uint8_t s_lost;
+};
@@ -0,0 +1,93 @@
+#include "Memory.h"
+#include "Logger.h"
+
+Memory memory;
+
+#if MDB_MEMORY_STATS
+#define MEMORY_PAINT 	0xC5
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+//.init3 runs once r1 is cleared and SP is loaded, before .data and .bss are
+//set up and before any call, nothing is on the stack yet. a naked function
+//gets no frame and no ret, so the body is asm alone: Z walks from _end to
+//__stack and paints every byte
+void memory_paint() __attribute__((naked, used, section(".init3")));
+
+void memory_paint()
+{
+	asm volatile(
+		"ldi r30, lo8(_end)\n\t"
+		"ldi r31, hi8(_end)\n\t"
+		"ldi r24, %0\n\t"
+		"1: st Z+, r24\n\t"
+		"cpi r30, lo8(__stack + 1)\n\t"
+		"ldi r25, hi8(__stack + 1)\n\t"
+		"cpc r31, r25\n\t"
+		"brne 1b\n\t"
+		:: "M" (MEMORY_PAINT) : "r24", "r25", "r30", "r31", "memory");
+}
+
+static uint8_t *heap_end()
+{
+	return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+#endif
+
+Memory::Memory()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_last_check = 0;
+	m_warned = false;
+}
+
+void Memory::Update()
+{
+#if MDB_MEMORY_STATS
+	if (millis() - m_last_check < MEMORY_CHECK_INTERVAL)
+		return;
+	scan();
+	if (!m_warned && m_stats.min_free < MEMORY_WARN_FREE)
+	{
+		m_warned = true;
+		warning << F("MEMORY: ") << m_stats.min_free << F(" BYTES FREE, STACK ") << m_stats.stack_peak << endl;
+	}
+#endif
+}
+
+const MemoryStats &Memory::GetStats()
+{
+	scan();
+	return m_stats;
+}
+
+//the painted bytes right above the heap were never used by the stack
+void Memory::scan()
+{
+	m_last_check = millis();
+#if MDB_MEMORY_STATS
+	uint8_t sp_byte;
+	uint8_t *heap = heap_end();
+	uint8_t *p = heap;
+	while (p <= &__stack && *p == MEMORY_PAINT)
+		p++;
+	m_stats.stack_peak = &__stack - p + 1;
+	m_stats.heap = heap - &__heap_start;
+	m_stats.free = &sp_byte > heap ? &sp_byte - heap : 0;
+	m_stats.min_free = p - heap;
+#endif
+}
+
+void Memory::Print()
+{
+	scan();
+	debug << F("## MEMORY ##") << endl;
+	debug << F("stack peak: ") << m_stats.stack_peak << endl;
+	debug << F("heap: ") << m_stats.heap << endl;
+	debug << F("free: ") << m_stats.free << endl;
+	debug << F("min free: ") << m_stats.min_free << endl;
+	debug << F("###") << endl;
+}
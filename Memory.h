@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+#include "MDBConfig.h"
+
+//ms between two scans of the painted stack, a scan reads all free RAM
+#define MEMORY_CHECK_INTERVAL 	1000
+
+struct MemoryStats
+{
+	unsigned int stack_peak; 	//deepest the stack got since boot
+	unsigned int heap; 			//allocated by malloc/new
+	unsigned int free; 			//between heap and stack right now
+	unsigned int min_free; 		//least free RAM since boot
+};
+
+//RAM use of a build with MDB_MEMORY_STATS, all figures stay 0 without it.
+//the stack is painted before the constructors run, bytes the stack never
+//touched still hold the paint
+class Memory
+{
+public:
+	Memory();
+
+	//scans every MEMORY_CHECK_INTERVAL ms and warns once when the free RAM
+	//fell below MEMORY_WARN_FREE
+	void Update();
+	//scans right away
+	const MemoryStats &GetStats();
+	void Print();
+
+private:
+	void scan();
+
+	MemoryStats m_stats;
+	unsigned long m_last_check;
+	bool m_warned;
+};
+
+extern Memory memory;
@@ -0,0 +1,93 @@
+#include "Power.h"
+#include "Logger.h"
+#include <avr/sleep.h>
+
+Power power;
+
+volatile bool Power::s_wake = false;
+
+Power::Power()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_last = 0;
+	m_asleep_us = 0;
+	m_awake_us = 0;
+}
+
+//interrupts are off between the check of s_wake and the sleep instruction,
+//sei only takes effect after the next one, so no wake-up gets lost
+bool Power::Sleep(unsigned long us)
+{
+#if MDB_SLEEP
+	if (us < POWER_SLEEP_MIN)
+		return false;
+	if (us > POWER_SLEEP_MAX)
+		us = POWER_SLEEP_MAX;
+	unsigned long start = Timer::now();
+	unsigned long deadline = start + us;
+	m_timer.StartAt(deadline);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	for (;;)
+	{
+		noInterrupts();
+		if (s_wake)
+			break;
+		sleep_enable();
+		interrupts();
+		sleep_cpu();
+		sleep_disable();
+	}
+	s_wake = false;
+	interrupts();
+
+	unsigned long now = Timer::now();
+	m_stats.sleeps++;
+	if (m_timer.Expired())
+	{
+		unsigned long late = now - deadline;
+		m_stats.timed++;
+		if (late > POWER_LATE_US)
+			m_stats.late++;
+		if (late > m_stats.latest_us)
+			m_stats.latest_us = late;
+	}
+	m_timer.Stop();
+	m_awake_us += start - m_last;
+	m_asleep_us += now - start;
+	m_last = now;
+	m_stats.awake_ms += m_awake_us / 1000;
+	m_awake_us %= 1000;
+	m_stats.asleep_ms += m_asleep_us / 1000;
+	m_asleep_us %= 1000;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Power::ClearStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_last = Timer::now();
+	m_asleep_us = 0;
+	m_awake_us = 0;
+}
+
+unsigned int Power::GetDutyCycle()
+{
+	unsigned long total = m_stats.asleep_ms + m_stats.awake_ms;
+	if (total < 100)
+		return 100;
+	return m_stats.awake_ms / (total / 100);
+}
+
+void Power::Print()
+{
+	debug << F("## POWER ##") << endl;
+	debug << F("sleeps: ") << m_stats.sleeps << endl;
+	debug << F("asleep: ") << m_stats.asleep_ms << F(" ms, awake ") << m_stats.awake_ms << F(" ms, ")
+			<< GetDutyCycle() << F("% duty cycle") << endl;
+	debug << F("deadlines: ") << m_stats.timed << F(", ") << m_stats.late << F(" late, latest ")
+			<< m_stats.latest_us << F(" us after") << endl;
+	debug << F("###") << endl;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+#include "MDBConfig.h"
+#include "MDBTimer.h"
+
+//longest sleep in us, the loop runs at least this often
+#define POWER_SLEEP_MAX 	100000
+//shorter idle times are not worth the wake-up
+#define POWER_SLEEP_MIN 	200
+//a wake-up this much after its deadline is late
+#define POWER_LATE_US 		200
+
+struct PowerStats
+{
+	unsigned long sleeps;
+	unsigned long asleep_ms;
+	unsigned long awake_ms;
+	unsigned long timed; 		//sleeps that lasted until their deadline
+	unsigned long late; 		//of them woken more than POWER_LATE_US after it
+	unsigned long latest_us; 	//latest wake-up after a deadline
+};
+
+//idle sleep of the ATmega2560 with MDB_SLEEP, the figures stay 0 without it.
+//the CPU stops, timers and USARTs keep running and every interrupt wakes it.
+//Sleep() goes back to sleep after one that brings the loop no work, like the
+//millis() tick, until its deadline or an interrupt that calls Wake()
+class Power
+{
+public:
+	Power();
+
+	//sleeps up to us, an expired MDBTimer or a received word wakes it earlier.
+	//false if it did not sleep at all
+	bool Sleep(unsigned long us);
+	//from an interrupt that has work for the loop
+	static inline void Wake() { s_wake = true; }
+
+	inline const PowerStats &GetStats() { return m_stats; }
+	void ClearStats();
+	//share of the time the CPU was awake since ClearStats(), in %
+	unsigned int GetDutyCycle();
+	void Print();
+
+private:
+	MDBTimer m_timer;
+	PowerStats m_stats;
+	unsigned long m_last; 		//Timer::now() at the end of the last sleep
+	unsigned long m_asleep_us; 	//below 1 ms, not in the stats yet
+	unsigned long m_awake_us;
+
+	static volatile bool s_wake;
+};
+
+extern Power power;
@@ -0,0 +1,248 @@
+#include "Recorder.h"
+#include "Logger.h"
+#include "Watchdog.h"
+
+#define RECORDER_MAGIC 		0x5EC0
+
+Recorder recorder;
+
+#if MDB_RECORDER
+struct RecorderRing
+{
+	uint16_t magic;
+	uint16_t size; 			//a build with other records does not read this one
+	uint8_t head; 			//next record to write
+	uint8_t count;
+	uint16_t boots;
+	Record records[RECORDER_RECORDS];
+};
+
+//neither cleared nor set up by the startup code, a reset leaves it as it was
+static RecorderRing s_ring __attribute__((section(".noinit")));
+#endif
+
+Recorder::Recorder()
+{
+	m_ready = false;
+	m_printing = false;
+	m_in_line = false;
+	memset(&m_line, 0, sizeof(m_line));
+}
+
+void Recorder::Begin()
+{
+	m_in_line = false;
+#if MDB_RECORDER
+	if (s_ring.magic != RECORDER_MAGIC || s_ring.size != sizeof(s_ring)
+			|| s_ring.head >= RECORDER_RECORDS || s_ring.count > RECORDER_RECORDS)
+	{
+		memset(&s_ring, 0, sizeof(s_ring));
+		s_ring.magic = RECORDER_MAGIC;
+		s_ring.size = sizeof(s_ring);
+	}
+	s_ring.boots++;
+	m_ready = true;
+	if (s_ring.count > 0)
+		Print();
+
+	Frame(RECORD_BOOT, Watchdog::resetFlags(), 0, 0, 0);
+#endif
+}
+
+//the record at the head is left out of the count while it is written, a
+//reset in between loses the oldest record and not the ring
+Record *Recorder::next()
+{
+#if MDB_RECORDER
+	if (s_ring.count == RECORDER_RECORDS)
+		s_ring.count--;
+	return &s_ring.records[s_ring.head];
+#else
+	return &m_line;
+#endif
+}
+
+void Recorder::commit()
+{
+#if MDB_RECORDER
+	s_ring.head = (s_ring.head + 1) % RECORDER_RECORDS;
+	s_ring.count++;
+#endif
+}
+
+void Recorder::Frame(uint8_t type, uint8_t source, int result, const uint8_t *data, int count)
+{
+#if MDB_RECORDER
+	if (!m_ready)
+		return;
+	Record *record = next();
+	record->time = millis();
+	record->type = type;
+	record->source = source;
+	record->result = result;
+	record->count = count;
+	memcpy(record->data, data, min(count, RECORDER_DATA));
+	commit();
+#endif
+}
+
+void Recorder::Line(uint8_t level)
+{
+	if (!m_ready || m_printing)
+		return;
+	m_line.time = millis();
+	m_line.type = RECORD_LOG;
+	m_line.source = level;
+	m_line.result = 0;
+	m_line.count = 0;
+	m_in_line = true;
+}
+
+void Recorder::Text(char c)
+{
+	if (!m_in_line || c == '\r' || c == '\n')
+		return;
+	if (m_line.count < RECORDER_DATA)
+		m_line.data[m_line.count] = c;
+	if (m_line.count < 0xFF)
+		m_line.count++;
+}
+
+void Recorder::Text(const char *s)
+{
+	if (!m_in_line)
+		return;
+	while (*s)
+		Text(*s++);
+}
+
+void Recorder::Text(const __FlashStringHelper *s)
+{
+	if (!m_in_line)
+		return;
+	PGM_P p = reinterpret_cast<PGM_P>(s);
+	for (char c = pgm_read_byte(p); c; c = pgm_read_byte(++p))
+		Text(c);
+}
+
+void Recorder::Text(const String &s)
+{
+	Text(s.c_str());
+}
+
+void Recorder::Text(int i)
+{
+	Text((long)i);
+}
+
+void Recorder::Text(long l)
+{
+	if (!m_in_line)
+		return;
+	char str[12];
+	sprintf(str, "%ld", l);
+	Text(str);
+}
+
+void Recorder::Text(unsigned long lu)
+{
+	if (!m_in_line)
+		return;
+	char str[12];
+	sprintf(str, "%lu", lu);
+	Text(str);
+}
+
+void Recorder::Text(double d)
+{
+	if (!m_in_line)
+		return;
+	char str[24];
+	long num = d;
+	sprintf(str, "%ld.%02d", num, abs((int)((d - num) * 100)));
+	Text(str);
+}
+
+void Recorder::EndLine()
+{
+	if (!m_in_line)
+		return;
+	m_in_line = false;
+#if MDB_RECORDER
+	Record *record = next();
+	*record = m_line;
+	commit();
+#endif
+}
+
+int Recorder::GetCount()
+{
+#if MDB_RECORDER
+	return m_ready ? s_ring.count : 0;
+#else
+	return 0;
+#endif
+}
+
+bool Recorder::Get(int i, Record *record)
+{
+#if MDB_RECORDER
+	if (i < 0 || i >= GetCount())
+		return false;
+	*record = s_ring.records[(s_ring.head + RECORDER_RECORDS - s_ring.count + i) % RECORDER_RECORDS];
+	return true;
+#else
+	return false;
+#endif
+}
+
+//one line per record, oldest first. frames as hex, an answer without data
+//shows its result
+void Recorder::Print()
+{
+#if MDB_RECORDER
+	m_printing = true;
+	console << F("## RECORDER, BOOT ") << (unsigned long)s_ring.boots << F(" ##") << endl;
+	Record record;
+	for (int i = 0; Get(i, &record); i++)
+	{
+		char str[8];
+		console << record.time;
+		switch (record.type)
+		{
+		case RECORD_BOOT:
+			sprintf(str, " %02X", record.source);
+			console << F(" BOOT") << str;
+			break;
+		case RECORD_LOG:
+			console << (record.source == 3 ? F(" W ") : record.source > 3 ? F(" E ") : F(" L "));
+			break;
+		case RECORD_COMMAND:
+			console << F(" TX") << (int)record.source;
+			break;
+		default:
+			console << F(" RX") << (int)record.source;
+			if (record.result == 0)
+				console << F(" ACK");
+			else if (record.result < 0)
+				console << ' ' << (int)record.result;
+		}
+		int count = min((int)record.count, RECORDER_DATA);
+		for (int j = 0; j < count; j++)
+		{
+			if (record.type == RECORD_LOG)
+				console << (char)record.data[j];
+			else
+			{
+				sprintf(str, " %02X", record.data[j]);
+				console << str;
+			}
+		}
+		if (record.count > RECORDER_DATA)
+			console << F("..");
+		console << endl;
+	}
+	console << F("###") << endl;
+	m_printing = false;
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include "MDBConfig.h"
+
+//bytes of text or frame kept per record, longer ones are cut
+#define RECORDER_DATA 		24
+
+//record types
+#define RECORD_BOOT 		0 	//source: Watchdog::resetFlags()
+#define RECORD_LOG 			1 	//source: logger level
+#define RECORD_COMMAND 		2 	//source: UART of the bus
+#define RECORD_ANSWER 		3 	//source: UART of the bus, result of GetResponse()
+
+struct Record
+{
+	unsigned long time; 		//ms since the boot it was written in
+	uint8_t type;
+	uint8_t source;
+	int8_t result; 				//ACK is 0 after the cast
+	uint8_t count; 				//bytes of the frame or line, data holds the first ones
+	uint8_t data[RECORDER_DATA];
+};
+
+//ring of the last log lines and bus frames in RAM that is not cleared at a
+//reset. writing a frame is a copy of a few bytes, a log line is collected
+//outside of the ring and only goes in once it is complete, so a reset in
+//the middle of a write leaves the ring intact
+class Recorder
+{
+public:
+	Recorder();
+
+	//checks the ring after a reset, dumps it to the console and adds a boot
+	//record. after a power on the RAM holds garbage and the ring starts empty
+	void Begin();
+
+	void Frame(uint8_t type, uint8_t source, int result, const uint8_t *data, int count);
+
+	//from Logger: a line starts, grows and ends
+	void Line(uint8_t level);
+	void Text(char c);
+	void Text(const char *s);
+	void Text(const __FlashStringHelper *s);
+	void Text(const String &s);
+	void Text(int i);
+	void Text(long l);
+	void Text(unsigned long lu);
+	void Text(double d);
+	void EndLine();
+
+	int GetCount();
+	//0 is the oldest record
+	bool Get(int i, Record *record);
+	void Print();
+
+private:
+	Record *next();
+	void commit();
+
+	bool m_ready;
+	bool m_printing;
+	bool m_in_line;
+	Record m_line;
+};
+
+extern Recorder recorder;
@@ -0,0 +1,248 @@
+#include "Remote.h"
+#include "MDBEvent.h"
+#include "Memory.h"
+#include "Audit.h"
+#include <util/crc16.h>
+
+Remote::Remote(UART &uart, CoinChanger &changer, BillValidator &validator, MDBSerial *mdb)
+	: m_uart(&uart), m_changer(&changer), m_validator(&validator), m_mdb(mdb)
+{
+	m_pos = -1;
+	m_last_byte = 0;
+	m_reply_count = 0;
+	m_replied = false;
+	m_event_seq = 0;
+	m_frames = 0;
+	m_dropped = 0;
+	m_retries = 0;
+	m_events = 0;
+}
+
+void Remote::Update()
+{
+	while (m_uart->available() > 0)
+		receive(m_uart->read());
+
+	MDBEvent event;
+	while (events.Pop(event))
+		forward(event);
+}
+
+//m_frame holds length, seq, cmd, payload and crc of the frame after the SYNC byte
+void Remote::receive(uint8_t c)
+{
+	unsigned long now = millis();
+	if (m_pos >= 0 && (now - m_last_byte) > REMOTE_BYTE_TIMEOUT)
+	{
+		m_dropped++;
+		m_pos = -1;
+	}
+	m_last_byte = now;
+
+	if (m_pos < 0)
+	{
+		if (c == REMOTE_SYNC)
+			m_pos = 0;
+		return;
+	}
+	if (m_pos == 0 && c > REMOTE_PAYLOAD_MAX)
+	{
+		m_dropped++;
+		m_pos = c == REMOTE_SYNC ? 0 : -1;
+		return;
+	}
+	m_frame[m_pos++] = c;
+	if (m_pos < m_frame[0] + 5)
+		return;
+	m_pos = -1;
+
+	uint16_t crc = 0xFFFF;
+	for (int i = 0; i < m_frame[0] + 3; i++)
+		crc = _crc16_update(crc, m_frame[i]);
+	if ((crc & 0xff) != m_frame[m_frame[0] + 3] || (crc >> 8) != m_frame[m_frame[0] + 4])
+	{
+		m_dropped++;
+		return;
+	}
+	m_frames++;
+	handle();
+}
+
+void Remote::handle()
+{
+	uint8_t length = m_frame[0];
+	uint8_t seq = m_frame[1];
+	uint8_t cmd = m_frame[2];
+	const uint8_t *data = &m_frame[3];
+
+	//the host did not get the last reply, do not run the command twice
+	if (m_replied && seq == m_reply[2] && (cmd | REMOTE_REPLY) == m_reply[3])
+	{
+		m_retries++;
+		for (int i = 0; i < m_reply_count; i++)
+			m_uart->write(m_reply[i]);
+		return;
+	}
+
+	uint8_t out[REMOTE_PAYLOAD_MAX];
+	switch (cmd)
+	{
+	case REMOTE_PING:
+		out[0] = REMOTE_VERSION;
+		reply(REMOTE_OK, out, 1);
+		break;
+
+	case REMOTE_ENABLE:
+		if (length != 2)
+			reply(REMOTE_BAD_LENGTH);
+		else if (data[0] == REMOTE_CHANGER)
+		{
+			m_changer->Enable(data[1] & REMOTE_ACCEPT);
+			reply(REMOTE_OK);
+		}
+		else if (data[0] == REMOTE_VALIDATOR)
+		{
+			m_validator->Enable(data[1] & REMOTE_ACCEPT);
+			m_validator->SetManualEscrow(data[1] & REMOTE_MANUAL_ESCROW);
+			reply(REMOTE_OK);
+		}
+		else
+			reply(REMOTE_FAILED);
+		break;
+
+	//notes from the recycler first, the changer pays the rest
+	case REMOTE_DISPENSE:
+		if (length != 4)
+			reply(REMOTE_BAD_LENGTH);
+		else
+		{
+			unsigned long value = get(data);
+			unsigned long paid = m_validator->Dispense(value);
+			if (paid < value)
+			{
+				m_changer->Dispense(value - paid);
+				paid += m_changer->GetPayoutValue();
+			}
+			put(out, paid);
+			reply(paid >= value ? REMOTE_OK : REMOTE_FAILED, out, 4);
+		}
+		break;
+
+	case REMOTE_ESCROW:
+		if (length != 1)
+			reply(REMOTE_BAD_LENGTH);
+		else
+			reply(m_validator->Escrow(data[0]) ? REMOTE_OK : REMOTE_FAILED);
+		break;
+
+	case REMOTE_STATUS:
+	{
+		uint8_t *p = out;
+		p = put(p, m_changer->GetCredit());
+		p = put(p, m_validator->GetCredit());
+		p = put(p, m_changer->GetChange());
+		p = put(p, m_validator->GetChange());
+		int type = m_validator->GetEscrowType();
+		*p++ = type < 0 ? 0xFF : type;
+		*p++ = (m_changer->IsEnabled() ? REMOTE_CHANGER_ENABLED : 0)
+				| (m_validator->IsEnabled() ? REMOTE_VALIDATOR_ENABLED : 0)
+				| (m_validator->IsManualEscrow() ? REMOTE_ESCROW_MANUAL : 0)
+				| (m_validator->HasRecycler() ? REMOTE_RECYCLER : 0);
+		reply(REMOTE_OK, out, p - out);
+		break;
+	}
+
+	case REMOTE_STATS:
+	{
+		uint8_t *p = out;
+		p = put(p, m_frames);
+		p = put(p, m_dropped);
+		p = put(p, m_retries);
+		p = put(p, m_events);
+		p = put(p, events.GetDropped());
+		p = put(p, m_uart->getDropped());
+		p = put(p, m_mdb ? m_mdb->GetDropped() : 0);
+		reply(REMOTE_OK, out, p - out);
+		break;
+	}
+
+	case REMOTE_MEMORY:
+	{
+		const MemoryStats &stats = memory.GetStats();
+		uint8_t *p = out;
+		p = put(p, stats.stack_peak);
+		p = put(p, stats.heap);
+		p = put(p, stats.free);
+		p = put(p, stats.min_free);
+		reply(REMOTE_OK, out, p - out);
+		break;
+	}
+
+	case REMOTE_AUDIT:
+		put(out, audit.Export());
+		reply(REMOTE_OK, out, 4);
+		break;
+
+	default:
+		reply(REMOTE_UNKNOWN);
+	}
+}
+
+//the reply is kept until the next request in case the host retries
+void Remote::reply(uint8_t status, const uint8_t *data, int count)
+{
+	uint8_t payload[REMOTE_PAYLOAD_MAX];
+	count = min(count, REMOTE_PAYLOAD_MAX - 1);
+	payload[0] = status;
+	for (int i = 0; i < count; i++)
+		payload[i + 1] = data[i];
+	send(m_frame[2] | REMOTE_REPLY, m_frame[1], payload, count + 1);
+	m_replied = true;
+}
+
+void Remote::send(uint8_t cmd, uint8_t seq, const uint8_t *data, int count)
+{
+	uint8_t *frame = m_reply;
+	uint8_t buffer[REMOTE_PAYLOAD_MAX + REMOTE_OVERHEAD];
+	if (cmd == REMOTE_EVENT)
+		frame = buffer; //keeps the last reply for a retry
+
+	int n = 0;
+	frame[n++] = REMOTE_SYNC;
+	frame[n++] = count;
+	frame[n++] = seq;
+	frame[n++] = cmd;
+	for (int i = 0; i < count; i++)
+		frame[n++] = data[i];
+	uint16_t crc = 0xFFFF;
+	for (int i = 1; i < n; i++)
+		crc = _crc16_update(crc, frame[i]);
+	frame[n++] = crc & 0xff;
+	frame[n++] = crc >> 8;
+	if (frame == m_reply)
+		m_reply_count = n;
+
+	for (int i = 0; i < n; i++)
+		m_uart->write(frame[i]);
+}
+
+void Remote::forward(const MDBEvent &event)
+{
+	uint8_t out[9] = { event.type, event.address, event.item, event.routing };
+	put(&out[4], event.value);
+	out[8] = event.bus;
+	send(REMOTE_EVENT, m_event_seq++, out, 9);
+	m_events++;
+}
+
+uint8_t *Remote::put(uint8_t *p, unsigned long val)
+{
+	for (int i = 0; i < 4; i++)
+		*p++ = val >> (8 * i);
+	return p;
+}
+
+unsigned long Remote::get(const uint8_t *p)
+{
+	return (unsigned long)p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
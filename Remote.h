@@ -0,0 +1,51 @@
+#pragma once
+
+#include "RemoteProtocol.h"
+#include "CoinChanger.h"
+#include "BillValidator.h"
+#include "UART.h"
+
+//lets a host controller drive the VMC over the console UART, see RemoteProtocol.h.
+//Update() never waits for the host: it takes the bytes already received, answers
+//complete frames and forwards the queued device events. Remote is the consumer
+//of the event queue, the sketch must not drain it as well.
+class Remote
+{
+public:
+	//with mdb the stats also show the bytes lost on the bus
+	Remote(UART &uart, CoinChanger &changer, BillValidator &validator, MDBSerial *mdb = 0);
+
+	void Update();
+
+private:
+	void receive(uint8_t c);
+	void handle();
+	void reply(uint8_t status, const uint8_t *data = 0, int count = 0);
+	void send(uint8_t cmd, uint8_t seq, const uint8_t *data, int count);
+	void forward(const MDBEvent &event);
+
+	static uint8_t *put(uint8_t *p, unsigned long val);
+	static unsigned long get(const uint8_t *p);
+
+	UART *m_uart;
+	CoinChanger *m_changer;
+	BillValidator *m_validator;
+	MDBSerial *m_mdb;
+
+	//receiver, m_pos counts the bytes after the SYNC byte
+	uint8_t m_frame[REMOTE_PAYLOAD_MAX + REMOTE_OVERHEAD];
+	int m_pos;
+	unsigned long m_last_byte;
+
+	//last reply, sent again when the host retries
+	uint8_t m_reply[REMOTE_PAYLOAD_MAX + REMOTE_OVERHEAD];
+	int m_reply_count;
+	bool m_replied;
+
+	uint8_t m_event_seq;
+
+	unsigned long m_frames;
+	unsigned long m_dropped;
+	unsigned long m_retries;
+	unsigned long m_events;
+};
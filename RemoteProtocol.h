@@ -0,0 +1,75 @@
+#pragma once
+
+//binary protocol between a host controller and the VMC on the console UART,
+//shared by Remote.cpp and the host client in extras/remote.
+//
+//frame: SYNC, length, seq, cmd, payload[length], crc low, crc high
+//the crc is CRC-16 (0xA001, start 0xFFFF) over length, seq, cmd and payload,
+//numbers in the payload are little endian.
+//
+//every request is answered with cmd | REMOTE_REPLY, the same seq and the
+//status as first payload byte. a request with the seq and cmd of the last one
+//is a retry: the stored reply is sent again and the command is not repeated.
+//events are sent unrequested with their own running seq.
+//
+//the log output is plain text and may show up between frames, text never
+//holds the SYNC byte.
+
+#define REMOTE_SYNC 				0xA5
+#define REMOTE_PAYLOAD_MAX 			32
+#define REMOTE_OVERHEAD 			6
+
+//ms between two bytes of a frame before the receiver starts over
+#define REMOTE_BYTE_TIMEOUT 		50
+
+//requests
+#define REMOTE_PING 				0x01 	//-> status, protocol version
+#define REMOTE_ENABLE 				0x02 	//device, flags -> status
+#define REMOTE_DISPENSE 			0x03 	//value (4) -> status, paid (4)
+#define REMOTE_ESCROW 				0x04 	//1 accept, 0 return -> status
+#define REMOTE_STATUS 				0x05 	//-> status, snapshot
+#define REMOTE_STATS 				0x06 	//-> status, counters
+#define REMOTE_MEMORY 				0x07 	//-> status, RAM figures
+#define REMOTE_AUDIT 				0x08 	//-> status, crc of the export (4)
+
+#define REMOTE_EVENT 				0x40 	//type, address, item, routing, value (4), bus
+#define REMOTE_REPLY 				0x80
+
+#define REMOTE_VERSION 				3
+
+//devices of REMOTE_ENABLE
+#define REMOTE_CHANGER 				0
+#define REMOTE_VALIDATOR 			1
+
+//flags of REMOTE_ENABLE
+#define REMOTE_ACCEPT 				0x01
+#define REMOTE_MANUAL_ESCROW 		0x02 	//validator: bills wait for REMOTE_ESCROW
+
+//status
+#define REMOTE_OK 					0
+#define REMOTE_UNKNOWN 				1
+#define REMOTE_BAD_LENGTH 			2
+#define REMOTE_FAILED 				3
+
+//snapshot of REMOTE_STATUS after the status byte:
+//changer credit (4), validator credit (4), changer change (4), recycler change (4),
+//bill type in escrow or 0xFF, flags
+#define REMOTE_STATUS_SIZE 			19
+#define REMOTE_CHANGER_ENABLED 		0x01
+#define REMOTE_VALIDATOR_ENABLED 	0x02
+#define REMOTE_ESCROW_MANUAL 		0x04
+#define REMOTE_RECYCLER 			0x08
+
+//counters of REMOTE_STATS after the status byte, 4 bytes each:
+//frames received, frames dropped (crc, length, timeout), retries answered,
+//events sent, events dropped by the queue, bytes lost by the console UART,
+//bytes lost by the MDB UART
+#define REMOTE_STATS_SIZE 			29
+
+//RAM figures of REMOTE_MEMORY after the status byte, 4 bytes each, all 0
+//without MDB_MEMORY_STATS: stack peak, heap, free, least free since boot
+#define REMOTE_MEMORY_SIZE 			17
+
+//REMOTE_AUDIT prints the DEX/UCS like records of Audit::Export() as console
+//text before the reply, from DXS to DXE. the crc is the one of its G85 record
+#define REMOTE_AUDIT_SIZE 			5
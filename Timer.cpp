@@ -0,0 +1,72 @@
+#include "Timer.h"
+#include "MDBTimer.h"
+#include <avr/interrupt.h>
+
+//F_CPU / 8, two ticks per us and 32768 us per overflow
+#define TIMER_OVERFLOW_US 	32768UL
+//longest compare interval, the counter must not pass it twice
+#define TIMER_WINDOW_US 	16000
+//a compare value right behind the counter would wait a whole overflow
+#define TIMER_MIN_US 		4
+
+volatile unsigned long v_timer_base = 0; 	//us at the last overflow
+bool timer_started = false;
+
+void Timer::begin()
+{
+	if (timer_started)
+		return;
+	timer_started = true;
+
+	uint8_t sreg = SREG;
+	cli();
+	TCCR5A = 0;
+	TCCR5B = (1 << CS51);
+	TCNT5 = 0;
+	TIFR5 = (1 << TOV5) | (1 << OCF5A);
+	TIMSK5 = (1 << TOIE5);
+	SREG = sreg;
+}
+
+unsigned long Timer::now()
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t count = TCNT5;
+	unsigned long base = v_timer_base;
+	//overflow that the interrupt did not see yet
+	if ((TIFR5 & (1 << TOV5)) && count < 0x8000)
+		base += TIMER_OVERFLOW_US;
+	SREG = sreg;
+	return base + (count >> 1);
+}
+
+void Timer::arm(unsigned long at)
+{
+	uint8_t sreg = SREG;
+	cli();
+	long us = at - now();
+	if (us < TIMER_MIN_US)
+		us = TIMER_MIN_US;
+	if (us > TIMER_WINDOW_US)
+		us = TIMER_WINDOW_US;
+	OCR5A = TCNT5 + (uint16_t)(us << 1);
+	TIFR5 = (1 << OCF5A);
+	TIMSK5 |= (1 << OCIE5A);
+	SREG = sreg;
+}
+
+void Timer::disarm()
+{
+	TIMSK5 &= ~(1 << OCIE5A);
+}
+
+ISR(TIMER5_OVF_vect)
+{
+	v_timer_base += TIMER_OVERFLOW_US;
+}
+
+ISR(TIMER5_COMPA_vect)
+{
+	MDBTimer::Dispatch();
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <Arduino.h>
+
+//timer 5 of the ATmega2560 as a clock in us with one compare interrupt,
+//MDBTimer keeps its deadlines on top of it. the Servo library also takes
+//timer 5, the two do not go together
+class Timer
+{
+public:
+	static void begin();
+
+	//us since begin(), wraps like micros()
+	static unsigned long now();
+
+	//MDBTimer::Dispatch() runs at the time at, for times further out than one
+	//compare window it runs before and arms the timer again
+	static void arm(unsigned long at);
+	static void disarm();
+};
@@ -1,23 +1,63 @@
 #include "UART.h"
+#include "Timer.h"
+#include "Power.h"
 #include <Arduino.h>
 #include <avr/interrupt.h>
 
-bool uarts_in_use[4];
+//buffers of a USART that is off have no size, see MDBConfig.h
+#define RX_SIZE(n) 	(UART##n##_ENABLED ? UART##n##_RX_BUFFER : 0)
+#define TX_SIZE(n) 	(UART##n##_ENABLED ? UART##n##_TX_BUFFER : 0)
+
+#define CHECK_SIZES(n) \
+	static_assert(RX_SIZE(n) == 0 || (RX_SIZE(n) >= 8 && RX_SIZE(n) <= 256 && \
+		(RX_SIZE(n) & (RX_SIZE(n) - 1)) == 0), "UART" #n "_RX_BUFFER: power of two from 8 to 256"); \
+	static_assert(TX_SIZE(n) <= 256 && (TX_SIZE(n) & (TX_SIZE(n) - 1)) == 0, \
+		"UART" #n "_TX_BUFFER: 0 or a power of two up to 256")
+CHECK_SIZES(0);
+CHECK_SIZES(1);
+CHECK_SIZES(2);
+CHECK_SIZES(3);
 
-volatile uint16_t v_buffer[4][UART_BUFFER_SIZE];
-volatile uint16_t v_start[4];
-volatile uint16_t v_end[4];
+bool uarts_in_use[4];
+const bool uarts_enabled[4] = { UART0_ENABLED, UART1_ENABLED, UART2_ENABLED, UART3_ENABLED };
+
+//the low 8 bits of the received words, bit i % 8 of byte i / 8 in the bitmap
+//is the ninth bit of word i
+volatile uint8_t v_rx0[RX_SIZE(0)], v_rx1[RX_SIZE(1)], v_rx2[RX_SIZE(2)], v_rx3[RX_SIZE(3)];
+volatile uint8_t v_ninth0[RX_SIZE(0) / 8], v_ninth1[RX_SIZE(1) / 8], v_ninth2[RX_SIZE(2) / 8], v_ninth3[RX_SIZE(3) / 8];
+volatile uint8_t v_tx0[TX_SIZE(0)], v_tx1[TX_SIZE(1)], v_tx2[TX_SIZE(2)], v_tx3[TX_SIZE(3)];
+
+volatile uint8_t *const v_buffer[4] = { v_rx0, v_rx1, v_rx2, v_rx3 };
+volatile uint8_t *const v_ninth[4] = { v_ninth0, v_ninth1, v_ninth2, v_ninth3 };
+const uint8_t rx_mask[4] = { (uint8_t)(RX_SIZE(0) - 1), (uint8_t)(RX_SIZE(1) - 1),
+	(uint8_t)(RX_SIZE(2) - 1), (uint8_t)(RX_SIZE(3) - 1) };
+volatile uint8_t v_start[4];
+volatile uint8_t v_end[4];
 volatile bool v_error[4];
 volatile bool v_ninthBitSet[4];
+volatile unsigned int v_dropped[4];
+volatile unsigned long v_rx_time[4];
+
+//a USART without transmit buffer writes directly
+volatile uint8_t *const v_tx_buffer[4] = { TX_SIZE(0) ? v_tx0 : 0, TX_SIZE(1) ? v_tx1 : 0,
+	TX_SIZE(2) ? v_tx2 : 0, TX_SIZE(3) ? v_tx3 : 0 };
+const uint8_t tx_mask[4] = { (uint8_t)(TX_SIZE(0) - 1), (uint8_t)(TX_SIZE(1) - 1),
+	(uint8_t)(TX_SIZE(2) - 1), (uint8_t)(TX_SIZE(3) - 1) };
+volatile uint8_t v_tx_start[4];
+volatile uint8_t v_tx_end[4];
 
 volatile uint8_t *v_UDRn[4];
 volatile uint8_t *v_UCSRnA[4];
 volatile uint8_t *v_UCSRnB[4];
 
+void transmit(int id);
+int stored(int id, uint8_t pos);
+
 
 UART::UART(uint8_t uart)
 {
 	m_uart = uart % 4;
+	m_nine_bit = false;
 }
 
 UART::~UART()
@@ -33,7 +73,7 @@ void UART::clear()
 
 bool UART::begin(uint32_t baud, bool nine_bit)
 {
-	if (uarts_in_use[m_uart])
+	if (uarts_in_use[m_uart] || !uarts_enabled[m_uart])
 		return false;
 	uarts_in_use[m_uart] = true;
 	
@@ -41,6 +81,10 @@ bool UART::begin(uint32_t baud, bool nine_bit)
 	v_end[m_uart] = 0;
 	v_error[m_uart] = false;
 	v_ninthBitSet[m_uart] = false;
+	v_dropped[m_uart] = 0;
+	v_tx_start[m_uart] = 0;
+	v_tx_end[m_uart] = 0;
+	m_nine_bit = nine_bit;
 	if (m_uart == 0)
 	{
 		m_TXn = 1;
@@ -117,7 +161,7 @@ bool UART::begin(uint32_t baud, bool nine_bit)
 		v_UCSRnB[m_uart] = &UCSR1B;
 		v_UCSRnC = &UCSR1C;
 	}
-	//set also UDRIE0 ?? 
+	//UDRIE is only set while the transmit buffer holds data
 	*v_UCSRnB[m_uart] |= (1 << RXENn) | (1 << TXENn) | (1 << RXCIEn);
 	*v_UCSRnC |= (1 << UCSZn1) | (1 << UCSZn0); //8 bit mode
 	if (nine_bit)
@@ -134,14 +178,17 @@ bool UART::begin(uint32_t baud, bool nine_bit)
 
 void UART::end()
 {
+	if (!uarts_in_use[m_uart])
+		return;
+	while (v_tx_start[m_uart] != v_tx_end[m_uart]) {} //let the buffer drain
 	flush();
-	*v_UCSRnB[m_uart] |= (0 << RXENn) | (0 << TXENn) | (0 << RXCIEn);
+	*v_UCSRnB[m_uart] &= ~((1 << RXENn) | (1 << TXENn) | (1 << RXCIEn) | (1 << UDRIE));
 	uarts_in_use[m_uart] = false;
 }
 
 int UART::available()
 {
-	return ((int)(UART_BUFFER_SIZE + v_end[m_uart] - v_start[m_uart])) % UART_BUFFER_SIZE;
+	return (uint8_t)(v_end[m_uart] - v_start[m_uart]) & rx_mask[m_uart];
 }
 
 int UART::peek()
@@ -149,7 +196,7 @@ int UART::peek()
 	if (v_start[m_uart] == v_end[m_uart]) {
 		return -1;
 	} else {
-		v_buffer[m_uart][v_start[m_uart]];
+		return stored(m_uart, v_start[m_uart]);
 	}
 }
 
@@ -219,11 +266,56 @@ void UART::print(const double d)
 }
 
 
+//in 8 bit mode the byte goes to the transmit buffer and the UDRE interrupt
+//sends it, the caller only waits while the buffer is full
 size_t UART::write(uint8_t data)
 {
 	v_ninthBitSet[m_uart] = false;
-	while (!(*v_UCSRnA[m_uart] & (1 << UDRE))) {}
-	*v_UDRn[m_uart] = data;
+	if (m_nine_bit || v_tx_buffer[m_uart] == 0)
+	{
+		while (!(*v_UCSRnA[m_uart] & (1 << UDRE))) {}
+		*v_UDRn[m_uart] = data;
+		return 1;
+	}
+
+	//nothing queued, no need to go through the buffer
+	if (v_tx_start[m_uart] == v_tx_end[m_uart] && (*v_UCSRnA[m_uart] & (1 << UDRE)))
+	{
+		*v_UDRn[m_uart] = data;
+		return 1;
+	}
+	uint8_t next = (v_tx_end[m_uart] + 1) & tx_mask[m_uart];
+	while (next == v_tx_start[m_uart])
+	{
+		//with interrupts off the buffer has to be drained here
+		if (!(SREG & (1 << SREG_I)) && (*v_UCSRnA[m_uart] & (1 << UDRE)))
+			transmit(m_uart);
+	}
+	v_tx_buffer[m_uart][v_tx_end[m_uart]] = data;
+	v_tx_end[m_uart] = next;
+	*v_UCSRnB[m_uart] |= (1 << UDRIE);
+	return 1;
+}
+
+bool UART::txReady()
+{
+	return *v_UCSRnA[m_uart] & (1 << UDRE);
+}
+
+//the transmitter finishes the words it holds, then the port drives the pin
+void UART::setBreak(bool on)
+{
+	if (on)
+	{
+		digitalWrite(m_TXn, LOW);
+		pinMode(m_TXn, OUTPUT);
+		*v_UCSRnB[m_uart] &= ~(1 << TXENn);
+	}
+	else
+	{
+		digitalWrite(m_TXn, HIGH);
+		*v_UCSRnB[m_uart] |= (1 << TXENn);
+	}
 }
 
 size_t UART::write9bit(uint16_t data)
@@ -233,7 +325,17 @@ size_t UART::write9bit(uint16_t data)
 		*v_UCSRnB[m_uart] |= (1 << TXB8);
 	else
 		*v_UCSRnB[m_uart] &= ~(1 << TXB8);
-	write((uint8_t)data);
+	*v_UDRn[m_uart] = (uint8_t)data;
+	return 1;
+}
+
+unsigned long UART::rxTime()
+{
+	uint8_t sreg = SREG;
+	cli();
+	unsigned long time = v_rx_time[m_uart];
+	SREG = sreg;
+	return time;
 }
 
 int UART::read()
@@ -241,8 +343,8 @@ int UART::read()
 	if (v_start[m_uart] == v_end[m_uart]) {
 		return -1;
 	} else {
-		int c = v_buffer[m_uart][v_start[m_uart]];
-		v_start[m_uart] = (v_start[m_uart] + 1) % UART_BUFFER_SIZE;
+		int c = stored(m_uart, v_start[m_uart]);
+		v_start[m_uart] = (v_start[m_uart] + 1) & rx_mask[m_uart];
 		return c;
 	}
 }
@@ -275,6 +377,15 @@ bool UART::error()
 	return false;
 }
 
+unsigned int UART::getDropped()
+{
+	uint8_t sreg = SREG;
+	cli();
+	unsigned int val = v_dropped[m_uart];
+	SREG = sreg;
+	return val;
+}
+
 bool UART::ninthBitSet()
 {
 	if (v_ninthBitSet[m_uart])
@@ -292,34 +403,94 @@ void receive(int id)
 	{
 		v_error[id] = true;
 	}
-	uint16_t result = ((*v_UCSRnB[id] >> 1) & 0x01) << 8;
-	if (result & 0x100)
+	if (status & (1 << DOR))
+		v_dropped[id]++;
+	//RXB8 has to be read before UDR
+	bool ninth = (*v_UCSRnB[id] >> 1) & 0x01;
+	if (ninth)
 		v_ninthBitSet[id] = true;
-	result |= *v_UDRn[id];
-	v_buffer[id][v_end[id]] = result;
-	v_end[id] = (v_end[id] + 1) % UART_BUFFER_SIZE;
+	uint8_t end = v_end[id];
+	if (end == v_start[id])
+		v_rx_time[id] = Timer::now();
+	v_buffer[id][end] = *v_UDRn[id];
+	if (ninth)
+		v_ninth[id][end >> 3] |= 1 << (end & 7);
+	else
+		v_ninth[id][end >> 3] &= ~(1 << (end & 7));
+	v_end[id] = (end + 1) & rx_mask[id];
 	if (v_end[id] == v_start[id])
 	{
-		v_start[id] = (v_start[id] + 1) % UART_BUFFER_SIZE;
+		v_start[id] = (v_start[id] + 1) & rx_mask[id];
+		v_dropped[id]++;
+	}
+	Power::Wake();
+}
+
+int stored(int id, uint8_t pos)
+{
+	int c = v_buffer[id][pos];
+	if (v_ninth[id][pos >> 3] & (1 << (pos & 7)))
+		c |= 0x100;
+	return c;
+}
+
+void transmit(int id)
+{
+	if (v_tx_start[id] == v_tx_end[id])
+	{
+		*v_UCSRnB[id] &= ~(1 << UDRIE);
+		return;
 	}
+	*v_UDRn[id] = v_tx_buffer[id][v_tx_start[id]];
+	v_tx_start[id] = (v_tx_start[id] + 1) & tx_mask[id];
 }
 
+//only the enabled USARTs take their interrupts, the others are free for the
+//HardwareSerial of the core
+#if UART0_ENABLED
 ISR(USART0_RX_vect)
 {
 	receive(0);
 }
 
+ISR(USART0_UDRE_vect)
+{
+	transmit(0);
+}
+#endif
+
+#if UART1_ENABLED
 ISR(USART1_RX_vect)
 {
 	receive(1);
 }
 
+ISR(USART1_UDRE_vect)
+{
+	transmit(1);
+}
+#endif
+
+#if UART2_ENABLED
 ISR(USART2_RX_vect)
 {
 	receive(2);
 }
 
+ISR(USART2_UDRE_vect)
+{
+	transmit(2);
+}
+#endif
+
+#if UART3_ENABLED
 ISR(USART3_RX_vect)
 {
 	receive(3);
-}
\ No newline at end of file
+}
+
+ISR(USART3_UDRE_vect)
+{
+	transmit(3);
+}
+#endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <Arduino.h>
+#include "MDBConfig.h"
 
 //registers
 #define TXB8	0
@@ -7,10 +8,9 @@
 #define DOR		3
 #define FE		4
 #define UDRE	5
+#define UDRIE	5
 #define RXC		7
 
-#define UART_BUFFER_SIZE 128
-
 static const char* endl = "\r\n";
 
 class UART
@@ -62,17 +62,28 @@ public:
 	size_t write(uint8_t data);
 	inline size_t write(int data) { return write((uint8_t)data); }
 	size_t write9bit(uint16_t data);
+	//the data register is free, write9bit() would not wait
+	bool txReady();
+	//holds TX low, the USART takes the pin back with on = false
+	void setBreak(bool on);
 	
 	int read();
 	bool readUL(unsigned long *val);
+	//Timer::now() when a word came into the empty buffer: the time the next
+	//word of read() was complete, if none was read since
+	unsigned long rxTime();
 
 	bool error();
 	bool ninthBitSet();
 	inline uint8_t getTXPin() { return m_TXn; }
+	inline uint8_t getNumber() { return m_uart; }
+	//received bytes lost by a hardware overrun or a full receive buffer
+	unsigned int getDropped();
 	
 private:
 	uint8_t m_TXn;
 	uint8_t m_uart;
+	bool m_nine_bit;
 	
 	uint8_t RXENn;
 	uint8_t TXENn;
@@ -0,0 +1,30 @@
+#include "Watchdog.h"
+
+#ifdef MCUSR
+static uint8_t s_reset_flags __attribute__((section(".noinit")));
+
+//.init3 runs before .data and .bss are set up, WDRF has to be cleared before
+//the watchdog can be switched off
+void watchdog_off() __attribute__((naked, used, section(".init3")));
+
+void watchdog_off()
+{
+	s_reset_flags = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+#endif
+
+void Watchdog::begin(uint8_t timeout)
+{
+	wdt_enable(timeout);
+}
+
+uint8_t Watchdog::resetFlags()
+{
+#ifdef MCUSR
+	return s_reset_flags;
+#else
+	return 0;
+#endif
+}
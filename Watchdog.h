@@ -0,0 +1,15 @@
+#pragma once
+#include <Arduino.h>
+#include <avr/wdt.h>
+
+//the hardware watchdog. after a watchdog reset it stays on with the shortest
+//timeout, so it is switched off before the constructors run. the reset flags
+//of MCUSR are kept for resetFlags()
+class Watchdog
+{
+public:
+	static void begin(uint8_t timeout = WDTO_2S);
+	static inline void reset() { wdt_reset(); }
+	//WDRF, BORF, EXTRF or PORF of the last reset, 0 on the host
+	static uint8_t resetFlags();
+};
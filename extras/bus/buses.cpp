@@ -0,0 +1,289 @@
+//runs one to three MDB buses side by side on the host, each with a simulated
+//changer and validator, and reports the transactions per second of virtual
+//time. the host costs no virtual time, so this shows how the buses share the
+//scheduler, not the CPU time of an ATmega2560.
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o buses extras/bus/buses.cpp extras/host/*.cpp
+//      MDBBus.cpp MDBSerial.cpp MDBTimer.cpp Power.cpp CoinChanger.cpp CoinHopper.cpp BillValidator.cpp EscrowPolicy.cpp
+//      MDBDevice.cpp MDBEvent.cpp Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp
+//
+//usage: buses [-s] [-b] [-e] [-d baud] [-n] [-p seconds] [-z] [-t seconds] [-r us]
+//  -s   the validator on the first bus does not answer, it goes offline and
+//       is reset in the background with backoff
+//  -b   every bus starts with a bus reset, the time until all devices are set
+//       up again is printed
+//  -r   time the peripherals take for the first word of an answer, up to
+//       T_RESPONSE is in time
+//  -e   every tenth poll of a validator reports a bill in escrow, the longest
+//       wait of the escrow decision and the deadline misses are printed
+//  -d   debug log on a console with this baud rate, a log line that fills
+//       the UART buffer holds the loop as on the board
+//  -n   no pipeline, every answer is parsed and logged before the next command
+//  -p   the devices are registered and found by Discover(), the validators
+//       are plugged in this many seconds after the start
+//  -z   polls every POLL_INTERVAL ms and sleeps in between with
+//       MDBBus::Sleep(), prints the duty cycle and the wake-ups after their
+//       deadline
+
+#include "Host.h"
+#include "MDBBus.h"
+#include "CoinChanger.h"
+#include "BillValidator.h"
+#include "Logger.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool s_slow = false;
+static unsigned long s_response = 0;
+static bool s_break = false;
+static bool s_escrow = false;
+static unsigned long s_baud = 0;
+static bool s_pipeline = true;
+static long s_plug = -1;
+static bool s_sleep = false;
+//per bus: polls of the validator, escrow commands
+static unsigned long s_polls[4];
+static unsigned long s_escrows[4];
+//per bus: breaks seen, changer and validator still to report JUST RESET
+static unsigned long s_breaks[4];
+static bool s_just_reset[4][2];
+
+static void answer(HostExchange *ex, const char *bytes)
+{
+	ex->kind = HOST_DATA;
+	ex->response_count = 0;
+	for (const char *p = bytes; *p; )
+	{
+		char *end;
+		ex->response[ex->response_count++] = strtoul(p, &end, 16);
+		p = end;
+	}
+}
+
+//level 2 changer and level 1 validator that have nothing to report but the
+//JUST RESET after a bus reset
+static bool respond(HostBus *bus, const uint8_t *command, int, HostExchange *ex)
+{
+	ex->kind = HOST_ACK;
+	if (s_slow && bus == &host_buses[1] && (command[0] & 0xF8) == 0x30)
+		return false;
+	int n = bus - host_buses;
+	if (bus->breaks != s_breaks[n])
+	{
+		s_breaks[n] = bus->breaks;
+		s_just_reset[n][0] = s_just_reset[n][1] = true;
+	}
+	//nothing at the other addresses, the validator not before it is plugged in
+	if (s_plug >= 0)
+	{
+		uint8_t address = command[0] & 0xF8;
+		if (address != 0x08 && address != 0x30)
+			return false;
+		if (address == 0x30 && millis() < (unsigned long)s_plug * 1000)
+			return false;
+		if ((command[0] & 0x07) == 0)
+			s_just_reset[n][address == 0x30] = true;
+	}
+	switch (command[0])
+	{
+	case 0x0B: 	//poll
+		if (s_just_reset[n][0])
+			answer(ex, "0B");
+		s_just_reset[n][0] = false;
+		break;
+	case 0x33:
+		if (s_just_reset[n][1])
+			answer(ex, "06");
+		else if (s_escrow && ++s_polls[n] % 10 == 0)
+			answer(ex, "91");
+		s_just_reset[n][1] = false;
+		break;
+	case 0x35: 	//escrow
+		s_escrows[n]++;
+		break;
+	case 0x09: 	//setup
+		answer(ex, "02 19 78 05 02 00 3F 01 02 04 0A 14 28 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x31:
+		answer(ex, "01 19 78 00 64 02 01 F4 00 FF FF 05 0A 14 32 00 00 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x37: 	//identification
+		answer(ex, "4A 43 4D 30 30 30 30 30 30 30 30 30 31 32 33 42 49 4C 4C 53 20 20 20 20 20 20 20 01 02");
+		break;
+	case 0x0A: 	//tube status
+		answer(ex, "00 00 0A 0A 0A 0A 0A 00 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x36: 	//stacker
+		answer(ex, "00 10");
+		break;
+	}
+	return true;
+}
+
+//the buses sit on USART1 to USART1 + count - 1
+static void run(int count, unsigned long seconds)
+{
+	MDBSerial *mdb[MDB_BUSES];
+	MDBBus *bus[MDB_BUSES];
+	MDBDevice *validator[MDB_BUSES];
+	for (int i = 0; i < count; i++)
+	{
+		host_buses[i + 1].Clear();
+		host_buses[i + 1].responder = respond;
+		host_buses[i + 1].response_us = s_response;
+		mdb[i] = new MDBSerial(i + 1);
+		bus[i] = new MDBBus(*mdb[i]);
+		validator[i] = new BillValidator(*mdb[i]);
+		if (s_plug >= 0)
+		{
+			bus[i]->Register(*new CoinChanger(*mdb[i]));
+			bus[i]->Register(*validator[i]);
+			bus[i]->Discover();
+		}
+		else
+		{
+			bus[i]->Add(*new CoinChanger(*mdb[i]));
+			bus[i]->Add(*validator[i]);
+		}
+		bus[i]->SetPollInterval(s_sleep ? POLL_INTERVAL : 0);
+		bus[i]->SetPipeline(s_pipeline);
+		bus[i]->ClearStats();
+		if (s_break)
+			bus[i]->HardReset();
+	}
+
+	if (s_break)
+	{
+		unsigned long start = millis();
+		bool resetting = true;
+		while (resetting && millis() - start < 10000)
+		{
+			MDBBus::UpdateAll();
+			yield();
+			resetting = false;
+			for (int i = 0; i < count; i++)
+				resetting |= bus[i]->IsResetting();
+		}
+		printf("  bus reset and init: %lu ms\n", millis() - start);
+		for (int i = 0; i < count; i++)
+			bus[i]->ClearStats();
+	}
+
+	if (s_plug >= 0)
+	{
+		//until every validator is found and set up
+		unsigned long start = millis();
+		bool missing = true;
+		while (missing && millis() - start < 60000)
+		{
+			MDBBus::UpdateAll();
+			yield();
+			missing = false;
+			for (int i = 0; i < count; i++)
+				missing |= !bus[i]->IsPresent(0x30) || validator[i]->GetHealth() != DEVICE_ONLINE;
+		}
+		for (int i = 0; i < count; i++)
+			printf("  bus %d: found%s%s after %lu ms, %lu probes\n", i,
+					bus[i]->IsPresent(0x08) ? " changer" : "", bus[i]->IsPresent(0x30) ? " validator" : "",
+					millis() - start, bus[i]->GetProbes());
+		for (int i = 0; i < count; i++)
+			bus[i]->ClearStats();
+	}
+
+	MDBBus::EnableWatchdog();
+	unsigned long words[MDB_BUSES];
+	for (int i = 0; i < count; i++)
+		words[i] = host_buses[i + 1].words;
+	power.ClearStats();
+	unsigned long start = millis();
+	while (millis() - start < seconds * 1000)
+	{
+		MDBBus::UpdateAll();
+		//the clock of the host only moves in here
+		if (!s_sleep || !MDBBus::Sleep())
+			yield();
+		host_log.clear();
+	}
+
+	unsigned long total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const MDBStats &stats = bus[i]->GetStats();
+		printf("  bus %d: %6.1f transactions/s, %5.1f cycles/s, %u%% load, %lu timeouts\n", i,
+				stats.transactions / (double)seconds, bus[i]->GetCycles() / (double)seconds,
+				bus[i]->GetLoad(), stats.timeouts);
+		printf("  bus %d: words on the wire %.1f%% of the time\n", i,
+				100.0 * (host_buses[i + 1].words - words[i]) * WORD_TIME_US / (seconds * 1e6));
+		total += stats.transactions;
+		const MDBTiming *cc = mdb[i]->GetTiming(0x08);
+		const MDBTiming *bv = mdb[i]->GetTiming(0x30);
+		printf("  bus %d: changer answers in %u us, poll window %u us; validator %u us, %u us, %lu%% errors\n", i,
+				cc->response_us, cc->window_us, bv->response_us, bv->window_us, 100UL * bv->errors / MDB_ERRORS_ALL);
+		if (s_escrow)
+			printf("  bus %d: %lu escrow decisions, longest wait %lu ms, %lu deadline misses\n", i,
+					s_escrows[i + 1], bus[i]->GetLatency(PRIORITY_URGENT), bus[i]->GetDeadlineMisses());
+		if (validator[i]->GetHealth() != DEVICE_ONLINE)
+			printf("  bus %d: validator %s, %lu resets in the background\n", i,
+					validator[i]->GetHealth() == DEVICE_OFFLINE ? "offline" : "not online",
+					validator[i]->GetRecoveries());
+	}
+	printf("  total: %.1f transactions/s\n", total / (double)seconds);
+	if (s_sleep)
+	{
+		const PowerStats &stats = power.GetStats();
+		printf("  sleep: %u%% duty cycle, %lu sleeps, %lu until the deadline, %lu late, latest %lu us after it\n",
+				power.GetDutyCycle(), stats.sleeps, stats.timed, stats.late, stats.latest_us);
+	}
+	printf("  watchdog: longest %lu ms between two feeds\n", host_wdt_longest);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long seconds = 60;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0)
+			s_slow = true;
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			seconds = atol(argv[++i]);
+		else if (strcmp(argv[i], "-b") == 0)
+			s_break = true;
+		else if (strcmp(argv[i], "-e") == 0)
+			s_escrow = true;
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			s_baud = atol(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0)
+			s_pipeline = false;
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			s_plug = atol(argv[++i]);
+		else if (strcmp(argv[i], "-z") == 0)
+			s_sleep = true;
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			s_response = atol(argv[++i]);
+	}
+
+	UART console(0);
+	Logger::SetUART(&console);
+	if (s_baud)
+	{
+		Logger::SetDebug(true);
+		host_console_baud = s_baud;
+	}
+
+	//every run in its own process, buses cannot be removed again
+	for (int count = 1; count <= MDB_BUSES; count++)
+	{
+		printf("%d bus%s%s\n", count, count > 1 ? "es" : "", s_slow ? ", validator on bus 0 not answering" : "");
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			run(count, seconds);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(pid, 0, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,264 @@
+//runs two cashless readers linked with SetPeer() on an MDBBus. each round a
+//card shows up on both readers at the same time, the first one polled gets
+//the session and a vend that its host approves after APPROVE_MS. prints per
+//round how long the other reader stayed enabled after the session began and
+//how long the approval took to reach the application.
+//the readers are simulated, a card on a disabled reader is not read. a
+//changer, a validator and both hoppers fill the bus as in the sketch and
+//never answer, the readers must still get their own POLL windows
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o cashless extras/bus/cashless.cpp extras/host/*.cpp
+//      MDBBus.cpp MDBSerial.cpp MDBTimer.cpp Power.cpp CashlessReader.cpp CoinChanger.cpp CoinHopper.cpp
+//      BillValidator.cpp EscrowPolicy.cpp MDBDevice.cpp MDBEvent.cpp Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp
+//
+//usage: cashless [-n rounds]
+
+#include "Host.h"
+#include "MDBBus.h"
+#include "CashlessReader.h"
+#include "CoinChanger.h"
+#include "CoinHopper.h"
+#include "BillValidator.h"
+#include "Logger.h"
+
+#define APPROVE_MS 		300
+#define SCALING 		5
+#define FUNDS 			0x0190 	//scaled, 20.00 EUR
+
+static void answer(HostExchange *ex, const uint8_t *bytes, int count)
+{
+	ex->kind = HOST_DATA;
+	ex->response_count = count;
+	memcpy(ex->response, bytes, count);
+}
+
+struct SimReader
+{
+	bool just_reset;
+	bool enabled;
+	bool card; 				//waits to be read
+	bool session;
+	bool end; 				//END SESSION in the next poll
+	bool vend;
+	unsigned int price;
+	unsigned long approve_time;
+	unsigned long begin_time; 	//session reported
+	unsigned long disable_time;
+	unsigned long sessions; 	//begun
+	unsigned long refused; 		//ended by the VMC without a vend
+	bool vended;
+};
+
+static SimReader s_readers[2];
+
+static bool reader(SimReader &r, const uint8_t *command, HostExchange *ex)
+{
+	uint8_t out[8];
+	int n = 0;
+	switch (command[0] & 0x07)
+	{
+	case RESET:
+		memset(&r, 0, sizeof(r));
+		r.just_reset = true;
+		break;
+	case SETUP:
+		if (command[1] == CONFIG_DATA)
+		{
+			const uint8_t config[] = { 0x01, 1, 0x19, 0x78, SCALING, 2, 5, 0 };
+			answer(ex, config, 8);
+		}
+		break;
+	case CASHLESS_POLL:
+		if (r.just_reset)
+			out[n++] = 0x00;
+		r.just_reset = false;
+		if (r.card && r.enabled && !r.session)
+		{
+			r.card = false;
+			r.session = true;
+			r.vended = false;
+			r.sessions++;
+			r.begin_time = millis();
+			out[n++] = 0x03;
+			out[n++] = FUNDS >> 8;
+			out[n++] = FUNDS & 0xFF;
+		}
+		if (r.vend && millis() >= r.approve_time)
+		{
+			r.vend = false;
+			out[n++] = 0x05;
+			out[n++] = r.price >> 8;
+			out[n++] = r.price & 0xFF;
+		}
+		if (r.end)
+		{
+			r.end = false;
+			r.session = false;
+			out[n++] = 0x07;
+		}
+		if (n > 0)
+			answer(ex, out, n);
+		break;
+	case VEND:
+		switch (command[1])
+		{
+		case VEND_REQUEST:
+			r.vend = true;
+			r.vended = true;
+			r.price = command[2] << 8 | command[3];
+			r.approve_time = millis() + APPROVE_MS;
+			break;
+		case VEND_CANCEL:
+			r.vend = false;
+			out[0] = 0x06;
+			answer(ex, out, 1);
+			break;
+		case SESSION_COMPLETE:
+			if (!r.vended)
+				r.refused++;
+			r.end = true;
+			break;
+		}
+		break;
+	case READER:
+		if (command[1] == READER_DISABLE && r.enabled)
+			r.disable_time = millis();
+		r.enabled = command[1] == READER_ENABLE;
+		r.card = r.card && r.enabled;
+		break;
+	}
+	return true;
+}
+
+static bool respond(HostBus *, const uint8_t *command, int, HostExchange *ex)
+{
+	ex->kind = HOST_ACK;
+	switch (command[0] & 0xF8)
+	{
+	case CASHLESS_1:
+		return reader(s_readers[0], command, ex);
+	case CASHLESS_2:
+		return reader(s_readers[1], command, ex);
+	}
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 10;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0)
+		rounds = atoi(argv[2]);
+
+	UART console(0);
+	Logger::SetUART(&console);
+	host_bus.Clear();
+	host_bus.responder = respond;
+
+	MDBSerial mdb(1);
+	MDBBus bus(mdb);
+	CoinChanger changer(mdb);
+	BillValidator validator(mdb);
+	CoinHopper hopper1(mdb, HOPPER_1);
+	CoinHopper hopper2(mdb, HOPPER_2);
+	CashlessReader reader1(mdb, CASHLESS_1);
+	CashlessReader reader2(mdb, CASHLESS_2);
+	CashlessReader *readers[] = { &reader1, &reader2 };
+	MDBDevice *devices[] = { &changer, &validator, &hopper1, &hopper2, &reader1, &reader2 };
+	for (unsigned int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+	{
+		if (!bus.Add(*devices[i]))
+		{
+			printf("device %d does not fit on the bus\n", devices[i]->GetAddress());
+			return 1;
+		}
+	}
+	reader1.SetPeer(reader2);
+	bus.Reset();
+
+	unsigned long start = millis();
+	while (millis() - start < 10000 && !(s_readers[0].enabled && s_readers[1].enabled))
+	{
+		bus.Update();
+		yield();
+	}
+	//the readers come last, after the silent devices took their entries
+	if (!mdb.GetTiming(CASHLESS_1) || !mdb.GetTiming(CASHLESS_2))
+	{
+		printf("no timing entry for a reader\n");
+		return 1;
+	}
+
+	unsigned long worst_disable = 0, worst_approval = 0;
+	int both = 0, failed = 0;
+	for (int round = 0; round < rounds; round++)
+	{
+		//the cards show up at another point of the poll cycle each round
+		start = millis() + (round * 37) % POLL_INTERVAL;
+		while (millis() < start)
+		{
+			bus.Update();
+			yield();
+		}
+		s_readers[0].card = s_readers[0].enabled;
+		s_readers[1].card = s_readers[1].enabled;
+		MDBEvent e;
+		events.Clear();
+
+		int winner = -1, sessions = 0;
+		unsigned long approval = 0;
+		bool ended = false;
+		while (millis() - start < 5000 && !ended)
+		{
+			bus.Update();
+			yield();
+			while (events.Pop(e))
+			{
+				int i = e.address == CASHLESS_1 ? 0 : 1;
+				switch (e.type)
+				{
+				case EVENT_SESSION_BEGIN:
+					sessions++;
+					winner = i;
+					readers[i]->Vend(250, 12);
+					break;
+				case EVENT_VEND_APPROVED:
+					approval = millis() - s_readers[i].approve_time;
+					readers[i]->VendSuccess();
+					readers[i]->EndSession();
+					break;
+				case EVENT_SESSION_END:
+					ended = true;
+					break;
+				}
+			}
+		}
+		//the peer comes back before the next round
+		while (millis() - start < 6000 && !(s_readers[0].enabled && s_readers[1].enabled))
+		{
+			bus.Update();
+			yield();
+		}
+
+		if (winner < 0 || !ended)
+		{
+			printf("round %2d: no session\n", round);
+			failed++;
+			continue;
+		}
+		SimReader &peer = s_readers[1 - winner];
+		unsigned long disable = peer.disable_time - s_readers[winner].begin_time;
+		if (peer.disable_time < s_readers[winner].begin_time)
+			disable = 0;
+		both += sessions > 1;
+		if (disable > worst_disable)
+			worst_disable = disable;
+		if (approval > worst_approval)
+			worst_approval = approval;
+		printf("round %2d: reader %d, other reader disabled after %3lu ms, approval after %3lu ms%s\n",
+				round, winner + 1, disable, approval, sessions > 1 ? ", two sessions" : "");
+	}
+	printf("worst: disabled after %lu ms, approval after %lu ms, refused sessions %lu, two sessions %d, failed %d\n",
+			worst_disable, worst_approval, s_readers[0].refused + s_readers[1].refused, both, failed);
+	return both || failed ? 1 : 0;
+}
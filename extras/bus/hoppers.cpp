@@ -0,0 +1,312 @@
+//pays change on an MDBBus once with a changer alone and once with a changer
+//and the two coin hoppers, and prints the virtual time each payout took and
+//the coins every device paid. the peripherals are simulated: the changer pays
+//a coin every CHANGER_COIN_MS, a hopper every HOPPER_COIN_MS.
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o hoppers extras/bus/hoppers.cpp extras/host/*.cpp
+//      MDBBus.cpp MDBSerial.cpp MDBTimer.cpp Power.cpp CoinChanger.cpp CoinHopper.cpp BillValidator.cpp
+//      EscrowPolicy.cpp MDBDevice.cpp MDBEvent.cpp Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp
+//
+//usage: hoppers [-v cents]
+
+#include "Host.h"
+#include "MDBBus.h"
+#include "CoinChanger.h"
+#include "CoinHopper.h"
+#include "Logger.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHANGER_COIN_MS 	250
+#define HOPPER_COIN_MS 		125
+#define SCALING 			5
+
+static void answer(HostExchange *ex, const uint8_t *bytes, int count)
+{
+	ex->kind = HOST_DATA;
+	ex->response_count = count;
+	memcpy(ex->response, bytes, count);
+}
+
+//a peripheral that pays coins one after the other, types in scaled credit
+struct SimPayer
+{
+	uint8_t credit[16];
+	uint8_t tubes[16];
+	uint8_t paid[16]; 		//by the running payout
+	uint8_t queue[64]; 		//types still to pay
+	int queued;
+	int done; 				//of the queue
+	unsigned long start;
+	unsigned long coin_ms;
+	unsigned long polled; 	//scaled value reported by the value poll
+	unsigned long coins;
+	bool just_reset;
+
+	void payout(unsigned long scaled)
+	{
+		queued = done = 0;
+		polled = 0;
+		memset(paid, 0, sizeof(paid));
+		for (int i = 15; i >= 0; i--)
+		{
+			while (credit[i] && credit[i] <= scaled && tubes[i] > 0 && queued < 64)
+			{
+				scaled -= credit[i];
+				tubes[i]--;
+				queue[queued++] = i;
+			}
+		}
+		start = millis();
+	}
+
+	//DISPENSE of the changer, the coins are out at once
+	void dispense(uint8_t type, uint8_t count)
+	{
+		for (; count > 0 && tubes[type] > 0; count--)
+		{
+			tubes[type]--;
+			coins++;
+		}
+	}
+
+	//coins out by now
+	void run()
+	{
+		while (done < queued && millis() - start >= (done + 1) * coin_ms)
+		{
+			paid[queue[done++]]++;
+			coins++;
+		}
+	}
+
+	inline bool busy() { run(); return done < queued; }
+
+	unsigned long value()
+	{
+		unsigned long value = 0;
+		for (int i = 0; i < 16; i++)
+			value += (unsigned long)paid[i] * credit[i];
+		return value;
+	}
+};
+
+static SimPayer s_changer;
+static SimPayer s_hoppers[2];
+
+//level 3 changer with alternative payout, DISPENSE takes no time
+static bool changer(const uint8_t *command, int count, HostExchange *ex)
+{
+	SimPayer &p = s_changer;
+	uint8_t out[36];
+	switch (command[0])
+	{
+	case 0x08:
+		p.just_reset = true;
+		break;
+	case 0x0B:
+		if (p.just_reset)
+		{
+			out[0] = JUST_RESET;
+			answer(ex, out, 1);
+		}
+		p.just_reset = false;
+		break;
+	case 0x09:
+	{
+		const uint8_t setup[] = { 3, 0x19, 0x78, SCALING, 2, 0x00, 0x3F };
+		memcpy(out, setup, 7);
+		memcpy(out + 7, p.credit, 16);
+		answer(ex, out, 23);
+		break;
+	}
+	case 0x0D:
+		p.dispense(command[1] & 0x0F, command[1] >> 4);
+		break;
+	case 0x0A:
+		out[0] = out[1] = 0;
+		memcpy(out + 2, p.tubes, 16);
+		answer(ex, out, 18);
+		break;
+	case 0x0F:
+		switch (count > 1 ? command[1] : -1)
+		{
+		case IDENTIFICATION:
+			memset(out, ' ', 29);
+			out[27] = out[28] = 0;
+			out[29] = out[30] = out[31] = 0;
+			out[32] = 0x01; //alternative payout
+			answer(ex, out, 33);
+			break;
+		case PAYOUT:
+			p.payout(command[2]);
+			break;
+		case PAYOUT_STATUS:
+			if (!p.busy())
+			{
+				memcpy(out, p.paid, 16);
+				answer(ex, out, 16);
+			}
+			break;
+		case PAYOUT_VALUE_POLL:
+			if (p.busy())
+			{
+				unsigned long value = p.value();
+				out[0] = value - p.polled;
+				p.polled = value;
+				answer(ex, out, 1);
+			}
+			break;
+		case SEND_DIAGNOSTIC_STATUS:
+			out[0] = 3;
+			out[1] = 0;
+			answer(ex, out, 2);
+			break;
+		}
+		break;
+	}
+	return true;
+}
+
+//hopper with a single coin type, status and setup end after it
+static bool hopper(SimPayer &p, const uint8_t *command, HostExchange *ex)
+{
+	uint8_t out[18];
+	switch (command[0] & 0x07)
+	{
+	case RESET:
+		p.just_reset = true;
+		break;
+	case POLL:
+		if (p.just_reset)
+		{
+			out[0] = JUST_RESET;
+			answer(ex, out, 1);
+		}
+		p.just_reset = false;
+		break;
+	case SETUP:
+	{
+		const uint8_t setup[] = { 1, 0x19, 0x78, SCALING, 2, p.credit[0] };
+		answer(ex, setup, 6);
+		break;
+	}
+	case DISPENSER_STATUS:
+		out[0] = out[1] = 0;
+		out[2] = p.tubes[0];
+		answer(ex, out, 3);
+		break;
+	case HOPPER_PAYOUT:
+		p.payout(command[1] << 8 | command[2]);
+		break;
+	case HOPPER_PAYOUT_STATUS:
+		if (!p.busy())
+		{
+			out[0] = p.paid[0];
+			answer(ex, out, 1);
+		}
+		break;
+	}
+	return true;
+}
+
+static bool s_with_hoppers;
+
+static bool respond(HostBus *, const uint8_t *command, int count, HostExchange *ex)
+{
+	ex->kind = HOST_ACK;
+	switch (command[0] & 0xF8)
+	{
+	case 0x08:
+		return changer(command, count, ex);
+	case HOPPER_1:
+		return s_with_hoppers && hopper(s_hoppers[0], command, ex);
+	case HOPPER_2:
+		return s_with_hoppers && hopper(s_hoppers[1], command, ex);
+	}
+	return false;
+}
+
+//euro coins in the changer, 2 EUR coins in hopper 1 and 1 EUR coins in hopper 2
+static void stock()
+{
+	const uint8_t credit[] = { 1, 2, 4, 10, 20, 40 };
+	const uint8_t tubes[] = { 20, 20, 20, 20, 10, 10 };
+	memset(&s_changer, 0, sizeof(s_changer));
+	memcpy(s_changer.credit, credit, 6);
+	memcpy(s_changer.tubes, tubes, 6);
+	s_changer.coin_ms = CHANGER_COIN_MS;
+	for (int i = 0; i < 2; i++)
+	{
+		memset(&s_hoppers[i], 0, sizeof(s_hoppers[i]));
+		s_hoppers[i].credit[0] = i == 0 ? 40 : 20;
+		s_hoppers[i].tubes[0] = 30;
+		s_hoppers[i].coin_ms = HOPPER_COIN_MS;
+	}
+}
+
+static void run(bool with_hoppers, unsigned long value)
+{
+	s_with_hoppers = with_hoppers;
+	MDBSerial mdb(1);
+	MDBBus bus(mdb);
+	CoinChanger cc(mdb);
+	CoinHopper hopper1(mdb, HOPPER_1);
+	CoinHopper hopper2(mdb, HOPPER_2);
+	bus.Add(cc);
+	if (with_hoppers)
+	{
+		bus.Add(hopper1);
+		bus.Add(hopper2);
+		cc.SetHopper(hopper1);
+		cc.SetHopper(hopper2);
+	}
+	bus.Reset();
+
+	//until every device is set up and knows its coins
+	unsigned long start = millis();
+	while (millis() - start < 10000 && (cc.GetChange() == 0
+			|| (with_hoppers && (hopper1.GetChange() == 0 || hopper2.GetChange() == 0))))
+	{
+		bus.Update();
+		yield();
+	}
+
+	start = millis();
+	bool ok = cc.Dispense(value);
+	unsigned long ms = millis() - start;
+	printf("%-14s paid %4lu of %4lu in %5lu ms%s, coins: changer %lu", with_hoppers ? "with hoppers" : "changer alone",
+			cc.GetPayoutValue(), value, ms, ok ? "" : " (failed)", s_changer.coins);
+	if (with_hoppers)
+		printf(", hopper 1 %lu, hopper 2 %lu", s_hoppers[0].coins, s_hoppers[1].coins);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long value = 1235;
+	if (argc > 2 && strcmp(argv[1], "-v") == 0)
+		value = atol(argv[2]);
+
+	UART console(0);
+	Logger::SetUART(&console);
+	host_bus.Clear();
+	host_bus.responder = respond;
+
+	//each in its own process, both start at virtual time 0
+	for (int i = 0; i < 2; i++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			stock();
+			run(i == 1, value);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(pid, 0, 0);
+	}
+	return 0;
+}
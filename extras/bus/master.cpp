@@ -0,0 +1,150 @@
+//runs a changer and a validator once on an MDBBus and once on a
+//BusMaster<CoinChanger, BillValidator> and compares the transactions of the
+//virtual time and the CPU time of the host per Update(). both have to send
+//the same commands, only the calls in between differ.
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o master extras/bus/master.cpp extras/host/*.cpp
+//      MDBBus.cpp MDBSerial.cpp MDBTimer.cpp Power.cpp CoinChanger.cpp CoinHopper.cpp BillValidator.cpp EscrowPolicy.cpp
+//      MDBDevice.cpp MDBEvent.cpp Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp
+//
+//usage: master [-t seconds]
+
+#include "Host.h"
+#include "MDBBus.h"
+#include "BusMaster.h"
+#include "Logger.h"
+#include <chrono>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void answer(HostExchange *ex, const char *bytes)
+{
+	ex->kind = HOST_DATA;
+	ex->response_count = 0;
+	for (const char *p = bytes; *p; )
+	{
+		char *end;
+		ex->response[ex->response_count++] = strtoul(p, &end, 16);
+		p = end;
+	}
+}
+
+//level 2 changer and level 1 validator that report JUST RESET after RESET,
+//every tenth validator poll has a bill in escrow. the commands are summed
+//up to compare the two runs
+static unsigned long s_sum;
+static unsigned long s_polls;
+static bool s_just_reset[2];
+
+static bool respond(HostBus *, const uint8_t *command, int count, HostExchange *ex)
+{
+	for (int i = 0; i < count; i++)
+		s_sum = s_sum * 31 + command[i];
+	ex->kind = HOST_ACK;
+	switch (command[0])
+	{
+	case 0x08:
+	case 0x30:
+		s_just_reset[command[0] == 0x30] = true;
+		break;
+	case 0x0B:
+		if (s_just_reset[0])
+			answer(ex, "0B");
+		s_just_reset[0] = false;
+		break;
+	case 0x33:
+		if (s_just_reset[1])
+			answer(ex, "06");
+		else if (++s_polls % 10 == 0)
+			answer(ex, "91");
+		s_just_reset[1] = false;
+		break;
+	case 0x09:
+		answer(ex, "02 19 78 05 02 00 3F 01 02 04 0A 14 28 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x31:
+		answer(ex, "01 19 78 00 64 02 01 F4 00 FF FF 05 0A 14 32 00 00 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x37:
+		answer(ex, "4A 43 4D 30 30 30 30 30 30 30 30 30 31 32 33 42 49 4C 4C 53 20 20 20 20 20 20 20 01 02");
+		break;
+	case 0x0A:
+		answer(ex, "00 00 0A 0A 0A 0A 0A 00 00 00 00 00 00 00 00 00 00 00");
+		break;
+	case 0x36:
+		answer(ex, "00 10");
+		break;
+	}
+	return true;
+}
+
+//steps the bus until the virtual time is over, only the time in Update()
+//counts
+template <class Bus>
+static void run(const char *name, Bus &bus, MDBSerial &mdb, unsigned long seconds)
+{
+	bus.SetPollInterval(0);
+	bus.Reset();
+	unsigned long updates = 0;
+	std::chrono::steady_clock::duration cpu(0);
+	while (millis() < seconds * 1000)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bus.Update();
+		cpu += std::chrono::steady_clock::now() - start;
+		updates++;
+		yield();
+	}
+	double ns = std::chrono::duration<double, std::nano>(cpu).count();
+	printf("%-10s %6lu transactions, %5lu cycles, %7lu updates, %6.1f ns per update, commands %08lx\n",
+			name, mdb.GetStats().transactions, bus.GetCycles(), updates, ns / updates, s_sum & 0xFFFFFFFF);
+}
+
+static void mdb_bus(unsigned long seconds)
+{
+	MDBSerial mdb(1);
+	MDBBus bus(mdb);
+	CoinChanger changer(mdb);
+	BillValidator validator(mdb);
+	validator.SetChanger(changer);
+	bus.SetPipeline(false);
+	bus.Add(changer);
+	bus.Add(validator);
+	run("MDBBus", bus, mdb, seconds);
+}
+
+static void bus_master(unsigned long seconds)
+{
+	MDBSerial mdb(1);
+	BusMaster<CoinChanger, BillValidator> bus(mdb);
+	run("BusMaster", bus, mdb, seconds);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long seconds = 60;
+	if (argc > 2 && strcmp(argv[1], "-t") == 0)
+		seconds = atol(argv[2]);
+
+	UART console(0);
+	Logger::SetUART(&console);
+	host_bus.Clear();
+	host_bus.responder = respond;
+
+	//each in its own process, both start at virtual time 0
+	void (*runs[])(unsigned long) = { mdb_bus, bus_master };
+	for (int i = 0; i < 2; i++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			runs[i](seconds);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(pid, 0, 0);
+	}
+	return 0;
+}
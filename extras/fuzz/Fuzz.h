@@ -0,0 +1,64 @@
+#pragma once
+
+//shared helpers of the libFuzzer targets, each target defines LLVMFuzzerTestOneInput
+
+#include "Host.h"
+#include "Logger.h"
+
+//virtual time one input may take, a parser that runs longer is treated as hung
+#define FUZZ_MAX_TIME 		120000UL
+
+//length bytes from 0xFB up select ACK, NAK, timeout, UART error and checksum error
+#define FUZZ_CHECKSUM 		0xFB
+#define FUZZ_ERROR 			0xFC
+#define FUZZ_TIMEOUT 		0xFD
+#define FUZZ_NAK 			0xFE
+#define FUZZ_ACK 			0xFF
+
+static UART s_fuzz_console(0);
+
+static inline void fuzz_begin()
+{
+	Logger::SetUART(&s_fuzz_console);
+	Logger::SetDebug(true);
+	host_log.clear();
+	host_bus.Clear();
+}
+
+//every exchange answers whatever command the driver sends next
+static inline void fuzz_exchanges(const uint8_t *data, size_t size)
+{
+	while (size > 0)
+	{
+		HostExchange ex;
+		uint8_t len = *data++;
+		size--;
+		ex.any_command = true;
+		ex.command_count = 0;
+		ex.response_count = 0;
+		ex.kind = HOST_DATA;
+		switch (len)
+		{
+		case FUZZ_ACK: 		ex.kind = HOST_ACK; break;
+		case FUZZ_NAK: 		ex.kind = HOST_NAK; break;
+		case FUZZ_TIMEOUT: 	ex.kind = HOST_TIMEOUT; break;
+		case FUZZ_ERROR: 	ex.kind = HOST_ERROR; break;
+		case FUZZ_CHECKSUM: ex.kind = HOST_CHECKSUM; break;
+		default:
+			ex.response_count = min((size_t)(len % (HOST_FRAME_MAX + 1)), size);
+			memcpy(ex.response, data, ex.response_count);
+			data += ex.response_count;
+			size -= ex.response_count;
+		}
+		host_bus.Push(ex);
+	}
+}
+
+static inline void fuzz_end(unsigned long start)
+{
+	if (millis() - start > FUZZ_MAX_TIME)
+	{
+		fprintf(stderr, "parser took %lu ms of bus time\n", millis() - start);
+		abort();
+	}
+}
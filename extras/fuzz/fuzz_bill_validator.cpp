@@ -0,0 +1,23 @@
+//drives every BillValidator response parser: reset, setup, poll, stacker
+//and the recycler status and payout commands
+
+#include "Fuzz.h"
+#include "BillValidator.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+	fuzz_begin();
+	fuzz_exchanges(data + 1, size - 1);
+
+	unsigned long start = millis();
+	MDBSerial mdb(1);
+	BillValidator validator(mdb);
+	validator.Reset();
+	validator.Dispense(data[0] * 100UL);
+	while (!host_bus.Empty())
+		validator.Update(data[0] * 100UL);
+	fuzz_end(start);
+	return 0;
+}
@@ -0,0 +1,40 @@
+//drives every CashlessReader response parser: reset, config, poll records
+//and the answers to a vend, with two readers linked as peers
+
+#include "Fuzz.h"
+#include "CashlessReader.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+	fuzz_begin();
+	fuzz_exchanges(data + 1, size - 1);
+
+	unsigned long start = millis();
+	MDBSerial mdb(1);
+	CashlessReader reader1(mdb, CASHLESS_1);
+	CashlessReader reader2(mdb, CASHLESS_2);
+	CashlessReader *readers[] = { &reader1, &reader2 };
+	reader1.SetPeer(reader2);
+	reader1.Reset();
+	reader2.Reset();
+	for (int i = 0; i < 8 && !host_bus.Empty(); i++)
+	{
+		CashlessReader *reader = readers[i & 1];
+		reader->Update();
+		if (reader->GetSession() == SESSION_IDLE)
+			reader->Vend(data[0] * 5, i);
+		if (reader->GetSession() == SESSION_APPROVED)
+			data[0] & 1 ? reader->VendSuccess() : reader->VendFailure();
+		if (reader->GetSession() == SESSION_IDLE)
+			reader->EndSession();
+	}
+	while (!host_bus.Empty())
+	{
+		reader1.Update();
+		reader2.Update();
+	}
+	fuzz_end(start);
+	return 0;
+}
@@ -0,0 +1,26 @@
+//drives every CoinChanger response parser: reset, setup, identification,
+//poll, tube status, diagnostic status and both payout paths
+
+#include "Fuzz.h"
+#include "CoinChanger.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+	fuzz_begin();
+	fuzz_exchanges(data + 1, size - 1);
+
+	unsigned long start = millis();
+	MDBSerial mdb(1);
+	CoinChanger changer(mdb);
+	unsigned long change;
+	changer.Reset();
+	for (int i = 0; i < 4 && !host_bus.Empty(); i++)
+		changer.Update(change);
+	changer.Dispense(data[0] * 5);
+	while (!host_bus.Empty())
+		changer.Update(change);
+	fuzz_end(start);
+	return 0;
+}
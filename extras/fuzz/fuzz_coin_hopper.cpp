@@ -0,0 +1,26 @@
+//drives every CoinHopper response parser: reset, setup, dispenser status,
+//poll and the payout status
+
+#include "Fuzz.h"
+#include "CoinHopper.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+	fuzz_begin();
+	fuzz_exchanges(data + 1, size - 1);
+
+	unsigned long start = millis();
+	MDBSerial mdb(1);
+	CoinHopper hopper(mdb, data[0] & 1 ? HOPPER_2 : HOPPER_1);
+	hopper.Reset();
+	for (int i = 0; i < 4 && !host_bus.Empty(); i++)
+		hopper.Update();
+	if (hopper.Payout(data[0] * 5) > 0)
+		hopper.WaitPayout();
+	while (!host_bus.Empty())
+		hopper.Update();
+	fuzz_end(start);
+	return 0;
+}
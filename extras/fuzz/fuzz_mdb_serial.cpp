@@ -0,0 +1,35 @@
+//feeds raw 9 bit words into the receive buffer and parses them with
+//MDBSerial::GetResponse without a command
+
+#include "Fuzz.h"
+#include "MDBSerial.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (size < 1)
+		return 0;
+	fuzz_begin();
+
+	unsigned long start = millis();
+	MDBSerial mdb(1);
+	UART uart(1);
+	uart.flush();
+	uart.ninthBitSet();
+	//every pair of bytes is one word: mode bit, UART error flag and 8 data bits
+	for (size_t i = 1; i + 1 < size; i += 2)
+	{
+		if (data[i] & 0x02)
+			host_receive_error(1);
+		host_receive(1, (data[i] & 0x01) << 8 | data[i + 1]);
+	}
+
+	uint8_t buffer[DATA_MAX];
+	int count;
+	int answer = mdb.GetResponse(buffer, &count);
+	if (answer > 0 && (count < 0 || count > DATA_MAX))
+		abort();
+	mdb.GetResponse();
+	uart.flush();
+	fuzz_end(start);
+	return 0;
+}
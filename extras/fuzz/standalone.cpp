@@ -0,0 +1,46 @@
+//runs a fuzz target without libFuzzer, for compilers that do not ship it:
+//  target file...    runs each file once
+//  target -r N       runs N random inputs
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char **argv)
+{
+	if (argc > 2 && strcmp(argv[1], "-r") == 0)
+	{
+		long runs = atol(argv[2]);
+		srand(argc > 3 ? atoi(argv[3]) : 1);
+		std::vector<uint8_t> data;
+		for (long r = 0; r < runs; r++)
+		{
+			data.resize(rand() % 512);
+			for (size_t i = 0; i < data.size(); i++)
+				data[i] = rand();
+			LLVMFuzzerTestOneInput(data.data(), data.size());
+		}
+		printf("%ld random inputs done\n", runs);
+		return 0;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		FILE *f = fopen(argv[i], "rb");
+		if (!f)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> data;
+		int c;
+		while ((c = fgetc(f)) != EOF)
+			data.push_back(c);
+		fclose(f);
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+	}
+	return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+//minimal Arduino API for building the library on a host, time is a virtual clock
+//that only moves in delay(), yield() and host_advance()
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define PSTR(s) (s)
+#define PROGMEM
+typedef const char *PGM_P;
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+
+class String
+{
+public:
+	String(const char *s = "") : m_str(s) {}
+	const char *c_str() const { return m_str.c_str(); }
+private:
+	std::string m_str;
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void host_advance(unsigned long us);
+
+#define bitSet(v, b) ((v) |= (1UL << (b)))
+#define bitClear(v, b) ((v) &= ~(1UL << (b)))
+#define bitRead(v, b) (((v) >> (b)) & 1)
+
+template <class A, class B>
+inline A min(A a, B b) { return a < (A)b ? a : (A)b; }
+template <class A, class B>
+inline A max(A a, B b) { return a > (A)b ? a : (A)b; }
+#define constrain(v, lo, hi) ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v))
+
+#define HIGH 	1
+#define LOW 	0
+#define INPUT 	0
+#define OUTPUT 	1
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+//nothing interrupts the host code, the status register is only saved and restored
+extern uint8_t SREG;
+inline void cli() {}
+inline void sei() {}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+//RAM backed EEPROM of the ATmega2560
+class EEPROMClass
+{
+public:
+	EEPROMClass() { memset(m_data, 0xFF, sizeof(m_data)); }
+
+	uint8_t read(int idx) { return m_data[idx]; }
+	void write(int idx, uint8_t val) { m_data[idx] = val; m_writes++; }
+	void update(int idx, uint8_t val) { if (m_data[idx] != val) write(idx, val); }
+	uint16_t length() { return sizeof(m_data); }
+
+	template <class T> T &get(int idx, T &t)
+	{
+		memcpy(&t, m_data + idx, sizeof(T));
+		return t;
+	}
+
+	template <class T> const T &put(int idx, const T &t)
+	{
+		const uint8_t *p = (const uint8_t *)&t;
+		for (unsigned int i = 0; i < sizeof(T); i++)
+			update(idx + i, p[i]);
+		return t;
+	}
+
+	unsigned long m_writes = 0;
+
+private:
+	uint8_t m_data[4096];
+};
+
+extern EEPROMClass EEPROM;
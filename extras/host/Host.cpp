@@ -0,0 +1,430 @@
+#include "Host.h"
+#include "UART.h"
+#include "MDBSerial.h"
+#include "Timer.h"
+#include "Power.h"
+#include <EEPROM.h>
+
+EEPROMClass EEPROM;
+HostBus host_buses[4];
+HostBus &host_bus = host_buses[1];
+std::string host_log;
+bool host_echo = false;
+uint8_t host_console = 0;
+bool host_loopback = false;
+unsigned long host_console_baud = 0;
+bool host_wdt_enabled = false;
+uint8_t SREG = 0;
+unsigned long host_wdt_last = 0;
+unsigned long host_wdt_longest = 0;
+
+static unsigned long s_micros = 0;
+static bool s_timer_armed = false;
+static unsigned long s_timer_at = 0;
+
+//moves the clock, the compare interrupt of the timer runs at its exact time
+static void advance(unsigned long us)
+{
+	unsigned long end = s_micros + us;
+	while (s_timer_armed && (long)(end - s_timer_at) >= 0)
+	{
+		if ((long)(s_timer_at - s_micros) > 0)
+			s_micros = s_timer_at;
+		s_timer_armed = false;
+		MDBTimer::Dispatch();
+	}
+	s_micros = end;
+}
+
+unsigned long millis() { return s_micros / 1000; }
+unsigned long micros() { return s_micros; }
+void delay(unsigned long ms) { advance(ms * 1000); }
+void delayMicroseconds(unsigned int us) { advance(us); }
+void host_advance(unsigned long us) { advance(us); }
+
+void Timer::begin() {}
+unsigned long Timer::now() { return s_micros; }
+
+void Timer::arm(unsigned long at)
+{
+	s_timer_armed = true;
+	s_timer_at = at;
+}
+
+void Timer::disarm() { s_timer_armed = false; }
+
+static unsigned long s_console_free = 0; 	//the last byte of the console is out
+
+static void capture(const char *str)
+{
+	if (host_console_baud)
+	{
+		unsigned long byte_us = 10000000UL / host_console_baud;
+		for (const char *p = str; *p; p++)
+		{
+			if ((long)(s_console_free - s_micros) < 0)
+				s_console_free = s_micros;
+			s_console_free += byte_us;
+			long wait = (long)(s_console_free - s_micros) - (long)(UART0_TX_BUFFER * byte_us);
+			if (wait > 0)
+				advance(wait);
+		}
+	}
+	host_log += str;
+	if (host_echo)
+		fputs(str, stdout);
+}
+
+struct HostWord
+{
+	uint16_t data;
+	unsigned long at; 	//virtual time the word is complete
+};
+
+//receive buffers of the four USARTs, filled by host_receive() and the buses
+static std::deque<HostWord> s_rx[4];
+static bool s_ninthBitSet[4];
+static bool s_error[4];
+static std::deque<uint8_t> s_tx[4];
+static unsigned long s_tx_free[4]; 	//the last word written is out
+
+void host_receive(uint8_t uart, uint16_t data)
+{
+	HostWord word = { data, s_micros };
+	s_rx[uart % 4].push_back(word);
+	if (data & 0x100)
+		s_ninthBitSet[uart % 4] = true;
+}
+
+void host_receive_error(uint8_t uart)
+{
+	s_error[uart % 4] = true;
+}
+
+bool host_transmitted(uint8_t uart, uint8_t *data)
+{
+	if (s_tx[uart % 4].empty())
+		return false;
+	*data = s_tx[uart % 4].front();
+	s_tx[uart % 4].pop_front();
+	return true;
+}
+
+//the peripheral starts its answer once the command is on the wire, also while
+//the VMC is busy elsewhere and reads it later
+static void deliver(uint8_t uart)
+{
+	std::deque<uint16_t> words;
+	bool error = false;
+	if (!host_buses[uart].Answer(words, &error))
+		return;
+	if (error)
+		s_error[uart] = true;
+	host_buses[uart].words += words.size();
+	unsigned long at = s_tx_free[uart];
+	at += host_buses[uart].response_us ? host_buses[uart].response_us : HOST_RESPONSE_US;
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		at += WORD_TIME_US;
+		HostWord word = { words[i], at };
+		s_rx[uart].push_back(word);
+	}
+}
+
+static size_t ready(uint8_t uart)
+{
+	deliver(uart);
+	size_t n = 0;
+	while (n < s_rx[uart].size() && s_rx[uart][n].at <= s_micros)
+		n++;
+	return n;
+}
+
+//moves the clock to the next word on a bus, a free transmitter or a timer
+//deadline, at most HOST_YIELD_US
+void yield()
+{
+	unsigned long next = s_micros + HOST_YIELD_US;
+	if (s_timer_armed && (long)(s_timer_at - s_micros) > 0 && (long)(s_timer_at - next) < 0)
+		next = s_timer_at;
+	for (int i = 0; i < 4; i++)
+	{
+		if (!s_rx[i].empty() && s_rx[i].front().at > s_micros && s_rx[i].front().at < next)
+			next = s_rx[i].front().at;
+		unsigned long tx = s_tx_free[i] - WORD_TIME_US;
+		if (s_tx_free[i] > s_micros + WORD_TIME_US && tx < next)
+			next = tx;
+	}
+	advance(next - s_micros);
+}
+
+//the overflow of timer 0 that counts millis() on the board
+#define HOST_TICK_US 		1024
+
+//idle sleep: the next interrupt is the tick, the timer deadline in advance()
+//or a word that comes in, the receive interrupt wakes the loop. an answer
+//is only there once the VMC looked for it after its command, a peripheral
+//on the host cannot tell where a command ends
+void host_sleep()
+{
+	unsigned long next = (s_micros / HOST_TICK_US + 1) * HOST_TICK_US;
+	if (s_timer_armed && (long)(s_timer_at - s_micros) > 0 && (long)(s_timer_at - next) < 0)
+		next = s_timer_at;
+	bool word = false;
+	for (int i = 0; i < 4; i++)
+	{
+		if (s_rx[i].empty())
+			continue;
+		if (s_rx[i].front().at <= s_micros)
+		{
+			Power::Wake();
+			return;
+		}
+		if (s_rx[i].front().at <= next)
+		{
+			next = s_rx[i].front().at;
+			word = true;
+		}
+	}
+	advance(next - s_micros);
+	if (word)
+		Power::Wake();
+}
+
+UART::UART(uint8_t uart) : m_uart(uart % 4), m_nine_bit(false) {}
+UART::~UART() {}
+void UART::clear() {}
+bool UART::begin(uint32_t, bool) { return true; }
+void UART::end() {}
+int UART::available() { return ready(m_uart); }
+unsigned long UART::rxTime() { return s_rx[m_uart].empty() ? s_micros : s_rx[m_uart].front().at; }
+int UART::peek() { return ready(m_uart) == 0 ? -1 : s_rx[m_uart].front().data; }
+
+void UART::flush()
+{
+	s_rx[m_uart].clear();
+}
+
+int UART::read()
+{
+	if (ready(m_uart) == 0)
+		return -1;
+	int c = s_rx[m_uart].front().data;
+	s_rx[m_uart].pop_front();
+	return c;
+}
+
+bool UART::error()
+{
+	deliver(m_uart);
+	bool val = s_error[m_uart];
+	s_error[m_uart] = false;
+	return val;
+}
+
+unsigned int UART::getDropped() { return 0; }
+
+bool UART::ninthBitSet()
+{
+	bool val = s_ninthBitSet[m_uart];
+	s_ninthBitSet[m_uart] = false;
+	return val;
+}
+
+void UART::setBreak(bool on)
+{
+	if (on)
+		host_buses[m_uart].Break();
+}
+
+bool UART::txReady() { return s_tx_free[m_uart] <= s_micros + WORD_TIME_US; }
+
+//only the console is captured, bytes sent on the bus are dropped
+size_t UART::write(uint8_t data)
+{
+	if (m_uart != host_console)
+	{
+		if (host_loopback)
+			s_tx[m_uart].push_back(data);
+		return 1;
+	}
+	char str[2] = { (char)data, 0 };
+	capture(str);
+	return 1;
+}
+
+//the bus gets every word, the UART holds one word besides the one going out
+size_t UART::write9bit(uint16_t data)
+{
+	if (!txReady())
+		advance(s_tx_free[m_uart] - WORD_TIME_US - s_micros);
+	s_tx_free[m_uart] = max(s_micros, s_tx_free[m_uart]) + WORD_TIME_US;
+	host_buses[m_uart].Transmit(data);
+	return 1;
+}
+
+//text printed on a looped back UART goes out with the frames, as on the board
+static void text(uint8_t uart, const char *str)
+{
+	if (uart == host_console || !host_loopback)
+	{
+		capture(str);
+		return;
+	}
+	for (const char *p = str; *p; p++)
+		s_tx[uart % 4].push_back(*p);
+}
+
+void UART::print(const char *c) { text(m_uart, c); }
+void UART::print(const String s) { text(m_uart, s.c_str()); }
+void UART::print(const __FlashStringHelper *fsh) { text(m_uart, reinterpret_cast<const char *>(fsh)); }
+
+void UART::print(const int i)
+{
+	char str[16];
+	sprintf(str, "%d", i);
+	text(m_uart, str);
+}
+
+void UART::print(const long l)
+{
+	char str[16];
+	sprintf(str, "%ld", l);
+	text(m_uart, str);
+}
+
+void UART::print(const unsigned long lu)
+{
+	char str[16];
+	sprintf(str, "%lu", lu);
+	text(m_uart, str);
+}
+
+void UART::print(const float f)
+{
+	char str[32];
+	sprintf(str, "%.2f", f);
+	text(m_uart, str);
+}
+
+void UART::print(const double d) { print((float)d); }
+
+void HostBus::Clear()
+{
+	m_exchanges.clear();
+	m_in_frame = false;
+	m_frame_count = 0;
+	frames = 0;
+	mismatches = 0;
+	underruns = 0;
+	breaks = 0;
+	words = 0;
+}
+
+void HostBus::Push(const HostExchange &ex)
+{
+	m_exchanges.push_back(ex);
+}
+
+static void dump(const char *prefix, const uint8_t *data, int count)
+{
+	printf("%s", prefix);
+	for (int i = 0; i < count; i++)
+		printf(" %02X", data[i]);
+	printf("\n");
+}
+
+void HostBus::Break()
+{
+	m_in_frame = false;
+	m_frame_count = 0;
+	breaks++;
+}
+
+//a command starts with the mode bit, words without it outside of a command
+//are the ACK, NAK or RET of the VMC to an answer
+void HostBus::Transmit(uint16_t word)
+{
+	words++;
+	if (word & 0x100)
+	{
+		m_in_frame = true;
+		m_frame_count = 0;
+	}
+	if (m_in_frame && m_frame_count < HOST_FRAME_MAX)
+		m_frame[m_frame_count++] = word;
+}
+
+bool HostBus::Answer(std::deque<uint16_t> &words, bool *error)
+{
+	if (!m_in_frame)
+		return false;
+	m_in_frame = false;
+	if (m_frame_count < 2)
+		return false;
+
+	//the last word is the checksum of the VMC
+	uint8_t sum = 0;
+	for (int i = 0; i < m_frame_count - 1; i++)
+		sum += m_frame[i];
+	command(m_frame, m_frame_count - 1);
+	if (sum != m_frame[m_frame_count - 1])
+		mismatches++;
+
+	switch (m_current.kind)
+	{
+	case HOST_ACK:
+		words.push_back(ACK);
+		return true;
+	case HOST_NAK:
+		words.push_back(0x100 | NAK);
+		return true;
+	case HOST_TIMEOUT:
+		return true;
+	case HOST_ERROR:
+		*error = true;
+		return true;
+	}
+	if (verbose)
+		dump("  PER:", m_current.response, m_current.response_count);
+	sum = 0;
+	for (int i = 0; i < m_current.response_count; i++)
+	{
+		words.push_back(m_current.response[i]);
+		sum += m_current.response[i];
+	}
+	if (m_current.kind == HOST_CHECKSUM)
+	{
+		if (words.empty())
+			words.push_back(0x00);
+		sum += 1;
+	}
+	words.push_back(0x100 | sum);
+	return true;
+}
+
+void HostBus::command(const uint8_t *data, int count)
+{
+	frames++;
+	if (verbose)
+		dump("VMC:", data, count);
+	if (m_exchanges.empty())
+	{
+		m_current.kind = HOST_TIMEOUT;
+		m_current.response_count = 0;
+		if (!responder)
+			underruns++;
+		else if (!responder(this, data, count, &m_current))
+			m_current.kind = HOST_TIMEOUT;
+		return;
+	}
+	m_current = m_exchanges.front();
+	m_exchanges.pop_front();
+	if (!m_current.any_command && (m_current.command_count != count ||
+			memcmp(m_current.command, data, count) != 0))
+	{
+		mismatches++;
+		if (verbose)
+			dump("  expected:", m_current.command, m_current.command_count);
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+//host side stand-ins for the hardware: a virtual clock that also drives the
+//timer, a UART that captures everything written to it and MDB buses that
+//answer from a list of frames.
+//the real MDBSerial runs on top: the words the VMC sends go to the HostBus of
+//the UART, the answer comes back word by word at 9600 baud
+
+#include <Arduino.h>
+#include <string>
+#include <deque>
+
+#define HOST_DATA 		0
+#define HOST_ACK 		1
+#define HOST_NAK 		2
+#define HOST_TIMEOUT 	3
+#define HOST_ERROR 		4
+#define HOST_CHECKSUM 	5
+
+#define HOST_FRAME_MAX 	40
+
+//time a peripheral takes for the first word of its answer, in us
+#define HOST_RESPONSE_US 	1000
+//longest step of the virtual clock in yield()
+#define HOST_YIELD_US 		1000
+
+//one command of the VMC and the answer of the peripheral
+struct HostExchange
+{
+	bool any_command;
+	uint8_t command[HOST_FRAME_MAX];
+	int command_count;
+
+	int kind;
+	uint8_t response[HOST_FRAME_MAX];
+	int response_count;
+};
+
+class HostBus;
+
+//answers a command when no exchange is queued, a simulated peripheral.
+//returns false if no device has the address, the command then times out
+typedef bool (*HostResponder)(HostBus *bus, const uint8_t *command, int count, HostExchange *ex);
+
+class HostBus
+{
+public:
+	void Clear();
+	void Push(const HostExchange &ex);
+	inline bool Empty() { return m_exchanges.empty(); }
+	inline size_t Pending() { return m_exchanges.size(); }
+
+	//called by the host UART: every 9 bit word the VMC sends, and the answer
+	//to the last complete command once the VMC listens
+	void Transmit(uint16_t word);
+	bool Answer(std::deque<uint16_t> &words, bool *error);
+	//the VMC pulled the line low, every peripheral resets
+	void Break();
+
+	unsigned long frames;
+	unsigned long mismatches;
+	unsigned long underruns;
+	unsigned long breaks;
+	unsigned long words; 		//on the wire, both ways
+	bool verbose;
+	HostResponder responder;
+	unsigned long response_us; 	//first word of an answer, 0 for HOST_RESPONSE_US
+
+private:
+	void command(const uint8_t *data, int count);
+
+	std::deque<HostExchange> m_exchanges;
+	HostExchange m_current;
+	uint8_t m_frame[HOST_FRAME_MAX];
+	int m_frame_count;
+	bool m_in_frame;
+};
+
+//queues a 9 bit word or a framing error on the receive side of a UART
+void host_receive(uint8_t uart, uint16_t data);
+void host_receive_error(uint8_t uart);
+
+//takes the next byte written to a UART other than the console, bytes are only
+//kept while host_loopback is set
+bool host_transmitted(uint8_t uart, uint8_t *data);
+
+//one bus per UART, host_bus is the one on USART1
+extern HostBus host_buses[4];
+extern HostBus &host_bus;
+extern std::string host_log;
+extern bool host_echo;
+extern uint8_t host_console;
+extern bool host_loopback;
+//0 for a console that takes text at once, else its baud rate: a write into
+//the full UART0_TX_BUFFER waits on the virtual clock like on the board
+extern unsigned long host_console_baud;
@@ -0,0 +1,16 @@
+#pragma once
+
+//the host has no sleep: sleep_cpu() moves the virtual clock to the next
+//interrupt, the word of a bus that is complete, the timer deadline or the
+//millis() tick
+
+#include <Arduino.h>
+
+#define SLEEP_MODE_IDLE 	0
+
+void host_sleep();
+
+static inline void set_sleep_mode(uint8_t) {}
+static inline void sleep_enable() {}
+static inline void sleep_disable() {}
+static inline void sleep_cpu() { host_sleep(); }
@@ -0,0 +1,38 @@
+#pragma once
+
+//the host has no watchdog: host_wdt_longest is the longest time in ms
+//between two wdt_reset() since wdt_enable(), a real one fires beyond its timeout
+
+#include <Arduino.h>
+
+#define WDTO_15MS 	0
+#define WDTO_30MS 	1
+#define WDTO_60MS 	2
+#define WDTO_120MS 	3
+#define WDTO_250MS 	4
+#define WDTO_500MS 	5
+#define WDTO_1S 	6
+#define WDTO_2S 	7
+#define WDTO_4S 	8
+#define WDTO_8S 	9
+
+extern bool host_wdt_enabled;
+extern unsigned long host_wdt_last;
+extern unsigned long host_wdt_longest;
+
+static inline void wdt_reset()
+{
+	unsigned long now = millis();
+	if (host_wdt_enabled && now - host_wdt_last > host_wdt_longest)
+		host_wdt_longest = now - host_wdt_last;
+	host_wdt_last = now;
+}
+
+static inline void wdt_enable(uint8_t)
+{
+	host_wdt_enabled = true;
+	host_wdt_last = millis();
+	host_wdt_longest = 0;
+}
+
+static inline void wdt_disable() { host_wdt_enabled = false; }
@@ -0,0 +1,96 @@
+//simulates resets of the VMC on the host and checks what the flight recorder
+//in Recorder.cpp keeps. the ring lives in .noinit and so in memory the host
+//never clears, a reset only constructs the recorder again and boots it
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o reset extras/recorder/reset.cpp extras/host/*.cpp
+//      MDBSerial.cpp MDBTimer.cpp Power.cpp Logger.cpp Recorder.cpp Watchdog.cpp
+//
+//usage: reset [-v]
+
+#include "Host.h"
+#include "MDBSerial.h"
+#include "Logger.h"
+#include "Recorder.h"
+
+static int s_failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if (!ok)
+		s_failures++;
+}
+
+//.data and .bss come back, .noinit does not
+static void reset()
+{
+	recorder = Recorder();
+	host_log.clear();
+	recorder.Begin();
+}
+
+static void exchange(MDBSerial &mdb, uint8_t cmd, int kind, uint8_t answer)
+{
+	HostExchange ex;
+	ex.any_command = false;
+	ex.command[0] = cmd;
+	ex.command_count = 1;
+	ex.kind = kind;
+	ex.response[0] = answer;
+	ex.response_count = 1;
+	host_bus.Push(ex);
+	mdb.SendCommand(cmd & 0xF8, cmd & 0x07);
+	mdb.GetResponse();
+}
+
+static bool logged(const char *text)
+{
+	return host_log.find(text) != std::string::npos;
+}
+
+int main(int argc, char **argv)
+{
+	host_echo = argc > 1 && strcmp(argv[1], "-v") == 0;
+	UART uart(0);
+	Logger::SetUART(&uart);
+	MDBSerial mdb(1);
+	mdb.begin();
+
+	//power on: the RAM holds whatever it holds, nothing is dumped
+	recorder.Begin();
+	check(!logged("## RECORDER") && recorder.GetCount() == 1, "power on");
+
+	for (int i = 0; i < 2 * RECORDER_RECORDS; i++)
+		status << F("POLL ") << i << endl;
+	exchange(mdb, 0x0B, HOST_ACK, 0);
+	exchange(mdb, 0x33, HOST_DATA, 0x06);
+	exchange(mdb, 0x0B, HOST_TIMEOUT, 0);
+	warning << F("CC: NO RESPONSE") << endl;
+	debug << F("NOT KEPT") << endl;
+	//the watchdog fires in the middle of this line
+	error << F("HALF A LINE ") << 42;
+	check(recorder.GetCount() == RECORDER_RECORDS, "ring full");
+
+	reset();
+	check(logged("## RECORDER, BOOT 2 ##"), "dump on boot");
+	check(logged(" TX1 0B\r\n") && logged(" RX1 ACK\r\n"), "command and ACK");
+	check(logged(" TX1 33\r\n") && logged(" RX1 06\r\n"), "data answer");
+	check(logged(" RX1 -2\r\n"), "timeout");
+	check(logged(" W CC: NO RESPONSE\r\n"), "warning");
+	check(logged(" L POLL 31\r\n") && !logged(" POLL 10\r\n"), "last records only");
+	check(!logged("NOT KEPT") && !logged("HALF A LINE"), "debug and open line left out");
+	Record record;
+	check(recorder.Get(recorder.GetCount() - 1, &record) && record.type == RECORD_BOOT, "boot record");
+
+	//a reset right after the dump keeps both boots
+	reset();
+	check(logged("## RECORDER, BOOT 3 ##") && logged(" BOOT 00\r\n") && logged(" W CC: NO RESPONSE\r\n"),
+			"second reset");
+
+	//a line longer than a record is cut
+	warning << F("A LINE THAT IS LONGER THAN A RECORD") << endl;
+	reset();
+	check(logged(" W A LINE THAT IS LONGER TH..\r\n"), "long line");
+	return s_failures ? 1 : 0;
+}
@@ -0,0 +1,359 @@
+#include "RemoteClient.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+//same as _crc16_update of avr-libc
+static uint16_t crc16_update(uint16_t crc, uint8_t a)
+{
+	crc ^= a;
+	for (int i = 0; i < 8; ++i)
+		crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+	return crc;
+}
+
+static unsigned long get(const uint8_t *p)
+{
+	return (unsigned long)p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static speed_t speed(int baud)
+{
+	switch (baud)
+	{
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 230400: return B230400;
+	}
+	return B115200;
+}
+
+RemoteClient::RemoteClient()
+{
+	timeout = 200;
+	attempts = 3;
+	dispense_timeout = 30000;
+	crc_errors = 0;
+	lost_events = 0;
+	m_fd = -1;
+	m_seq = time(0); //a restarted client must not look like a retry
+	m_request_count = 0;
+	m_event_seen = false;
+	m_event_seq = 0;
+	m_replied = false;
+	m_reply_count = 0;
+}
+
+RemoteClient::~RemoteClient()
+{
+	Close();
+}
+
+bool RemoteClient::Open(const char *path, int baud)
+{
+	Close();
+	m_fd = open(path, O_RDWR | O_NOCTTY);
+	if (m_fd < 0)
+		return false;
+	struct termios tio;
+	if (tcgetattr(m_fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed(baud));
+		cfsetospeed(&tio, speed(baud));
+		tio.c_cflag |= CLOCAL | CREAD;
+		tcsetattr(m_fd, TCSANOW, &tio);
+	}
+	m_rx.clear();
+	return true;
+}
+
+void RemoteClient::Close()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+int RemoteClient::Call(uint8_t cmd, const uint8_t *data, int count, uint8_t *reply, int *reply_count)
+{
+	if (count > REMOTE_PAYLOAD_MAX)
+		return -1;
+	int n = 0;
+	m_request[n++] = REMOTE_SYNC;
+	m_request[n++] = count;
+	m_request[n++] = ++m_seq;
+	m_request[n++] = cmd;
+	for (int i = 0; i < count; i++)
+		m_request[n++] = data[i];
+	uint16_t crc = 0xFFFF;
+	for (int i = 1; i < n; i++)
+		crc = crc16_update(crc, m_request[i]);
+	m_request[n++] = crc & 0xff;
+	m_request[n++] = crc >> 8;
+	m_request_count = n;
+
+	int wait_ms = cmd == REMOTE_DISPENSE ? dispense_timeout : timeout;
+	for (int i = 0; i < attempts; i++)
+	{
+		send(m_request, m_request_count);
+		int status = wait(wait_ms, reply, reply_count);
+		if (status >= 0)
+			return status;
+	}
+	return -1;
+}
+
+int RemoteClient::Retry(uint8_t *reply, int *reply_count)
+{
+	if (m_request_count == 0)
+		return -1;
+	send(m_request, m_request_count);
+	return wait(timeout, reply, reply_count);
+}
+
+void RemoteClient::send(const uint8_t *frame, int count)
+{
+	m_replied = false;
+	while (count > 0)
+	{
+		int n = write(m_fd, frame, count);
+		if (n <= 0)
+			return;
+		frame += n;
+		count -= n;
+	}
+}
+
+//returns the status byte of the reply to the pending request or -1
+int RemoteClient::wait(int timeout, uint8_t *reply, int *reply_count)
+{
+	long end = now_ms() + timeout;
+	while (!m_replied)
+	{
+		long left = end - now_ms();
+		if (left <= 0 || !receive(left))
+			return -1;
+	}
+	if (m_reply_count < 1)
+		return -1;
+	if (reply)
+		memcpy(reply, m_reply + 1, m_reply_count - 1);
+	if (reply_count)
+		*reply_count = m_reply_count - 1;
+	return m_reply[0];
+}
+
+//reads what is there within timeout ms, false if nothing came in
+bool RemoteClient::receive(int timeout)
+{
+	struct pollfd pfd = { m_fd, POLLIN, 0 };
+	if (poll(&pfd, 1, timeout) <= 0)
+		return false;
+	uint8_t buffer[256];
+	int n = read(m_fd, buffer, sizeof(buffer));
+	if (n <= 0)
+		return false;
+	m_rx.insert(m_rx.end(), buffer, buffer + n);
+	parse();
+	return true;
+}
+
+//bytes outside a frame are log text, a SYNC byte with a bad frame behind it
+//is skipped and the search goes on with the next byte
+void RemoteClient::parse()
+{
+	while (!m_rx.empty())
+	{
+		if (m_rx[0] != REMOTE_SYNC)
+		{
+			log += (char)m_rx[0];
+			m_rx.pop_front();
+			continue;
+		}
+		if (m_rx.size() < 2)
+			return;
+		int length = m_rx[1];
+		if (length > REMOTE_PAYLOAD_MAX)
+		{
+			m_rx.pop_front();
+			continue;
+		}
+		if ((int)m_rx.size() < length + REMOTE_OVERHEAD)
+			return;
+
+		uint8_t buffer[REMOTE_PAYLOAD_MAX + REMOTE_OVERHEAD];
+		for (int i = 0; i < length + REMOTE_OVERHEAD; i++)
+			buffer[i] = m_rx[i];
+		uint16_t crc = 0xFFFF;
+		for (int i = 1; i < length + 4; i++)
+			crc = crc16_update(crc, buffer[i]);
+		if ((crc & 0xff) != buffer[length + 4] || (crc >> 8) != buffer[length + 5])
+		{
+			crc_errors++;
+			m_rx.pop_front();
+			continue;
+		}
+		m_rx.erase(m_rx.begin(), m_rx.begin() + length + REMOTE_OVERHEAD);
+		frame(buffer);
+	}
+}
+
+void RemoteClient::frame(const uint8_t *frame)
+{
+	int length = frame[1];
+	uint8_t seq = frame[2];
+	uint8_t cmd = frame[3];
+	const uint8_t *data = &frame[4];
+
+	if (cmd == REMOTE_EVENT && length >= 8)
+	{
+		if (m_event_seen && seq != (uint8_t)(m_event_seq + 1))
+			lost_events += (uint8_t)(seq - m_event_seq - 1);
+		m_event_seen = true;
+		m_event_seq = seq;
+
+		RemoteEvent event;
+		event.seq = seq;
+		event.type = data[0];
+		event.address = data[1];
+		event.item = data[2];
+		event.routing = data[3];
+		event.value = get(&data[4]);
+		event.bus = length > 8 ? data[8] : 0;
+		m_events.push_back(event);
+	}
+	//replies to older requests show up after a retry, they are dropped
+	else if (m_request_count > 0 && seq == m_request[2] && cmd == (m_request[3] | REMOTE_REPLY))
+	{
+		memcpy(m_reply, data, length);
+		m_reply_count = length;
+		m_replied = true;
+	}
+}
+
+bool RemoteClient::NextEvent(RemoteEvent *event, int timeout)
+{
+	long end = now_ms() + timeout;
+	while (m_events.empty())
+	{
+		long left = end - now_ms();
+		if (left <= 0 || !receive(left))
+			return false;
+	}
+	*event = m_events.front();
+	m_events.pop_front();
+	return true;
+}
+
+int RemoteClient::Ping(int *version)
+{
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	int status = Call(REMOTE_PING, 0, 0, reply, &count);
+	if (version)
+		*version = count > 0 ? reply[0] : 0;
+	return status;
+}
+
+int RemoteClient::Enable(int device, int flags)
+{
+	uint8_t data[] = { (uint8_t)device, (uint8_t)flags };
+	return Call(REMOTE_ENABLE, data, 2);
+}
+
+int RemoteClient::Dispense(unsigned long value, unsigned long *paid)
+{
+	uint8_t data[] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	int status = Call(REMOTE_DISPENSE, data, 4, reply, &count);
+	if (paid)
+		*paid = count >= 4 ? get(reply) : 0;
+	return status;
+}
+
+int RemoteClient::Escrow(bool accept)
+{
+	uint8_t data[] = { (uint8_t)accept };
+	return Call(REMOTE_ESCROW, data, 1);
+}
+
+int RemoteClient::Status(RemoteStatus *status)
+{
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	int result = Call(REMOTE_STATUS, 0, 0, reply, &count);
+	if (result != REMOTE_OK || count + 1 != REMOTE_STATUS_SIZE)
+		return result == REMOTE_OK ? -1 : result;
+	status->changer_credit = get(&reply[0]);
+	status->validator_credit = get(&reply[4]);
+	status->changer_change = get(&reply[8]);
+	status->recycler_change = get(&reply[12]);
+	status->escrow_type = reply[16] == 0xFF ? -1 : reply[16];
+	status->flags = reply[17];
+	return result;
+}
+
+int RemoteClient::Stats(RemoteStats *stats)
+{
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	int result = Call(REMOTE_STATS, 0, 0, reply, &count);
+	if (result != REMOTE_OK || count + 1 != REMOTE_STATS_SIZE)
+		return result == REMOTE_OK ? -1 : result;
+	stats->frames = get(&reply[0]);
+	stats->dropped = get(&reply[4]);
+	stats->retries = get(&reply[8]);
+	stats->events = get(&reply[12]);
+	stats->events_dropped = get(&reply[16]);
+	stats->console_dropped = get(&reply[20]);
+	stats->mdb_dropped = get(&reply[24]);
+	return result;
+}
+
+//the text comes before the reply, it is in the log once the reply is there
+int RemoteClient::Audit(std::string *dex, unsigned int *crc)
+{
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	size_t from = log.size();
+	int result = Call(REMOTE_AUDIT, 0, 0, reply, &count);
+	if (result != REMOTE_OK || count + 1 != REMOTE_AUDIT_SIZE)
+		return result == REMOTE_OK ? -1 : result;
+	size_t begin = log.find("DXS*", from);
+	size_t end = log.find("DXE*", begin);
+	if (begin == std::string::npos || end == std::string::npos)
+		return -1;
+	end = log.find('\n', end);
+	*dex = log.substr(begin, end == std::string::npos ? std::string::npos : end + 1 - begin);
+	if (crc)
+		*crc = get(&reply[0]);
+	return result;
+}
+
+int RemoteClient::Memory(RemoteMemory *memory)
+{
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	int result = Call(REMOTE_MEMORY, 0, 0, reply, &count);
+	if (result != REMOTE_OK || count + 1 != REMOTE_MEMORY_SIZE)
+		return result == REMOTE_OK ? -1 : result;
+	memory->stack_peak = get(&reply[0]);
+	memory->heap = get(&reply[4]);
+	memory->free = get(&reply[8]);
+	memory->min_free = get(&reply[12]);
+	return result;
+}
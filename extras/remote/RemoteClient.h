@@ -0,0 +1,109 @@
+#pragma once
+
+//host side of the protocol in RemoteProtocol.h for Linux and macOS serial ports
+
+#include "RemoteProtocol.h"
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+struct RemoteStatus
+{
+	unsigned long changer_credit;
+	unsigned long validator_credit;
+	unsigned long changer_change;
+	unsigned long recycler_change;
+	int escrow_type; //-1 without a bill in escrow
+	uint8_t flags;
+};
+
+struct RemoteStats
+{
+	unsigned long frames;
+	unsigned long dropped;
+	unsigned long retries;
+	unsigned long events;
+	unsigned long events_dropped;
+	unsigned long console_dropped;
+	unsigned long mdb_dropped;
+};
+
+struct RemoteMemory
+{
+	unsigned long stack_peak;
+	unsigned long heap;
+	unsigned long free;
+	unsigned long min_free;
+};
+
+struct RemoteEvent
+{
+	uint8_t seq;
+	uint8_t type;
+	uint8_t address;
+	uint8_t item;
+	uint8_t routing;
+	unsigned long value;
+	uint8_t bus;
+};
+
+class RemoteClient
+{
+public:
+	RemoteClient();
+	~RemoteClient();
+
+	bool Open(const char *path, int baud = 115200);
+	void Close();
+
+	//sends a request and waits for the reply, a lost reply is asked for again
+	//with the same seq so the device does not run the command twice.
+	//returns the status byte or -1 when the device did not answer
+	int Call(uint8_t cmd, const uint8_t *data = 0, int count = 0, uint8_t *reply = 0, int *reply_count = 0);
+	//sends the last request again as if its reply was lost
+	int Retry(uint8_t *reply = 0, int *reply_count = 0);
+
+	int Ping(int *version = 0);
+	int Enable(int device, int flags);
+	int Dispense(unsigned long value, unsigned long *paid = 0);
+	int Escrow(bool accept);
+	int Status(RemoteStatus *status);
+	int Stats(RemoteStats *stats);
+	int Memory(RemoteMemory *memory);
+	//the audit export from DXS to DXE out of the log text, and its crc
+	int Audit(std::string *dex, unsigned int *crc = 0);
+
+	//waits up to timeout ms, events that came in during a call are kept
+	bool NextEvent(RemoteEvent *event, int timeout);
+
+	//wait for a reply in ms and number of attempts per call
+	int timeout;
+	int attempts;
+	//payouts take a while, the device answers when the coins are out
+	int dispense_timeout;
+
+	std::string log; 				//text between the frames
+	unsigned long crc_errors;
+	unsigned long lost_events; 		//gaps in the event seq
+
+private:
+	void send(const uint8_t *frame, int count);
+	int wait(int timeout, uint8_t *reply, int *reply_count);
+	bool receive(int timeout);
+	void parse();
+	void frame(const uint8_t *frame);
+
+	int m_fd;
+	uint8_t m_seq;
+	uint8_t m_request[REMOTE_PAYLOAD_MAX + REMOTE_OVERHEAD];
+	int m_request_count;
+
+	std::deque<uint8_t> m_rx;
+	std::deque<RemoteEvent> m_events;
+	bool m_event_seen;
+	uint8_t m_event_seq;
+
+	bool m_replied;
+	uint8_t m_reply[REMOTE_PAYLOAD_MAX];
+	int m_reply_count;
+};
@@ -0,0 +1,253 @@
+//runs Remote against RemoteClient over a pseudo terminal: the device side is a
+//child process with the host shim, its console UART bridged to the pty master,
+//the client opens the pty slave like a real serial port
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -Iextras/remote -I. -o loopback extras/remote/loopback.cpp extras/remote/RemoteClient.cpp
+//      extras/host/*.cpp Remote.cpp CoinChanger.cpp CoinHopper.cpp BillValidator.cpp EscrowPolicy.cpp
+//      MDBSerial.cpp MDBTimer.cpp Power.cpp MDBDevice.cpp MDBEvent.cpp Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp Memory.cpp
+//
+//usage: loopback [-n pings]
+
+#include "Host.h"
+#include "Remote.h"
+#include "RemoteClient.h"
+#include "Logger.h"
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CONSOLE_UART 	0
+
+static void queue(const char *command, const char *response)
+{
+	HostExchange ex;
+	ex.any_command = false;
+	ex.command_count = 0;
+	for (const char *p = command; *p; )
+	{
+		char *end;
+		ex.command[ex.command_count++] = strtoul(p, &end, 16);
+		p = end;
+	}
+	ex.kind = HOST_DATA;
+	ex.response_count = 0;
+	if (strcmp(response, "ACK") == 0)
+		ex.kind = HOST_ACK;
+	else
+	{
+		for (const char *p = response; *p; )
+		{
+			char *end;
+			ex.response[ex.response_count++] = strtoul(p, &end, 16);
+			p = end;
+		}
+	}
+	host_bus.Push(ex);
+}
+
+//level 3 changer with 5, 10, 20, 50 cent, 1 and 2 euro coins, see coin_changer.trace
+static void changer_reset(CoinChanger &changer)
+{
+	queue("0B", "ACK");
+	queue("0B", "ACK");
+	queue("08", "ACK");
+	queue("0B", "0B");
+	queue("09", "03 19 78 05 02 00 3F 01 02 04 0A 14 28 00 00 00 00 00 00 00 00 00 00");
+	queue("0F 00", "43 47 45 30 30 30 30 30 30 30 30 30 30 30 31 43 48 41 4E 47 45 52 30 31 20 20 20 01 00 00 00 00 03");
+	queue("0F 01 00 00 00 03", "ACK");
+	queue("0A", "00 00 0A 0A 0A 0A 0A 00 00 00 00 00 00 00 00 00 00 00");
+	changer.Reset();
+}
+
+//the device: bridges the pty master to the console UART and runs Remote
+static int device(int fd)
+{
+	MDBSerial mdb(1);
+	CoinChanger changer(mdb);
+	BillValidator validator(mdb);
+	UART uart(CONSOLE_UART);
+	Remote remote(uart, changer, validator, &mdb);
+
+	host_console = 3; //the console UART carries the frames
+	Logger::SetUART(&uart); //and the log text, as on the board
+	host_loopback = true;
+	changer_reset(changer);
+
+	//a 1 euro coin is reported once the client is there
+	queue("0B", "54 0B");
+	queue("0A", "00 00 0A 0A 0A 0A 0B 00 00 00 00 00 00 00 00 00 00 00");
+	queue("0F 05", "03 00");
+	queue("0C FF FF FF FF", "ACK");
+	//alternative payout of 1.50
+	queue("0A", "00 00 0A 0A 0A 0A 0B 00 00 00 00 00 00 00 00 00 00 00");
+	queue("0F 02 1E", "ACK");
+	queue("0F 04", "14");
+	queue("0F 04", "ACK");
+	queue("0F 03", "00 00 00 01 01 00 00 00 00 00 00 00 00 00 00 00");
+
+	bool connected = false;
+	double worst = 0;
+	unsigned long updates = 0;
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		poll(&pfd, 1, 1);
+		if (pfd.revents & (POLLHUP | POLLERR))
+			break;
+		if (pfd.revents & POLLIN)
+		{
+			uint8_t buffer[256];
+			int n = read(fd, buffer, sizeof(buffer));
+			if (n <= 0)
+				break;
+			for (int i = 0; i < n; i++)
+				host_receive(CONSOLE_UART, buffer[i]);
+			if (!connected)
+			{
+				unsigned long change;
+				changer.Update(change);
+				connected = true;
+			}
+		}
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		host_advance(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+		last = now;
+
+		bool work = uart.available() > 0 || !events.Empty();
+		remote.Update();
+		if (work)
+		{
+			double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - now).count();
+			if (us > worst)
+				worst = us;
+			updates++;
+		}
+
+		uint8_t c;
+		while (host_transmitted(CONSOLE_UART, &c))
+			if (write(fd, &c, 1) != 1)
+				break;
+	}
+	fprintf(stderr, "device: %lu updates with work, slowest %.1f us\n", updates, worst);
+	return host_bus.mismatches || host_bus.underruns || !host_bus.Empty() ? 1 : 0;
+}
+
+static int s_failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+	if (!ok)
+		s_failures++;
+}
+
+static void client(const char *path, long pings)
+{
+	RemoteClient remote;
+	if (!remote.Open(path))
+	{
+		check(false, "open pty");
+		return;
+	}
+
+	int version = 0;
+	check(remote.Ping(&version) == REMOTE_OK && version == REMOTE_VERSION, "ping");
+
+	RemoteEvent event;
+	bool coin = false;
+	while (!coin && remote.NextEvent(&event, 500))
+		coin = event.type == EVENT_COIN_ACCEPTED && event.address == 0x08 && event.value == 100;
+	check(coin, "coin event");
+
+	RemoteStatus status;
+	check(remote.Status(&status) == REMOTE_OK && status.changer_credit == 100 && status.escrow_type == -1
+			&& (status.flags & REMOTE_CHANGER_ENABLED) && (status.flags & REMOTE_VALIDATOR_ENABLED), "status");
+
+	check(remote.Enable(REMOTE_CHANGER, 0) == REMOTE_OK, "disable changer");
+	check(remote.Enable(REMOTE_VALIDATOR, REMOTE_ACCEPT | REMOTE_MANUAL_ESCROW) == REMOTE_OK, "manual escrow");
+	check(remote.Status(&status) == REMOTE_OK && !(status.flags & REMOTE_CHANGER_ENABLED)
+			&& (status.flags & REMOTE_ESCROW_MANUAL), "status flags");
+	check(remote.Enable(7, 0) == REMOTE_FAILED, "unknown device");
+	check(remote.Escrow(true) == REMOTE_FAILED, "escrow without bill");
+	check(remote.Call(0x3F) == REMOTE_UNKNOWN, "unknown command");
+
+	unsigned long paid = 0;
+	check(remote.Dispense(150, &paid) == REMOTE_OK && paid == 150, "dispense");
+	//the reply got lost: the device answers again without paying twice
+	uint8_t reply[REMOTE_PAYLOAD_MAX];
+	int count = 0;
+	check(remote.Retry(reply, &count) == REMOTE_OK && count == 4 && reply[0] == 150, "retry");
+
+	bool complete = false;
+	while (!complete && remote.NextEvent(&event, 500))
+		complete = event.type == EVENT_PAYOUT_COMPLETE && event.value == 150;
+	check(complete, "payout event");
+
+	//noise and a corrupted frame are dropped, the next request goes through
+	uint8_t noise[] = { 0x00, REMOTE_SYNC, 0x00, 0x01, REMOTE_PING, 0x12, 0x34, 0x55 };
+	int fd = open(path, O_RDWR | O_NOCTTY);
+	check(fd >= 0 && write(fd, noise, sizeof(noise)) == sizeof(noise), "send noise");
+	if (fd >= 0)
+		close(fd);
+	check(remote.Ping() == REMOTE_OK, "ping after noise");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	long ok = 0;
+	for (long i = 0; i < pings; i++)
+		ok += remote.Ping() == REMOTE_OK;
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	check(ok == pings, "pings");
+	if (pings > 0)
+		printf("%ld pings, %.1f us round trip\n", pings, sec * 1e6 / pings);
+
+	RemoteStats stats;
+	check(remote.Stats(&stats) == REMOTE_OK && stats.retries == 1 && stats.dropped >= 1
+			&& stats.events >= 2 && stats.events_dropped == 0 && stats.console_dropped == 0
+			&& stats.mdb_dropped == 0, "stats");
+	RemoteMemory memory;
+	check(remote.Memory(&memory) == REMOTE_OK, "memory");
+	std::string dex;
+	unsigned int crc = 0;
+	char g85[16];
+	check(remote.Audit(&dex, &crc) == REMOTE_OK, "audit");
+	snprintf(g85, sizeof(g85), "G85*%04X", crc);
+	check(dex.find(g85) != std::string::npos && dex.find("CA11*") != std::string::npos, "audit export");
+	check(remote.crc_errors == 0 && remote.lost_events == 0, "clean link");
+	printf("device: %lu frames, %lu dropped, %lu retries, %lu events\n",
+			stats.frames, stats.dropped, stats.retries, stats.events);
+}
+
+int main(int argc, char **argv)
+{
+	long pings = 1000;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0)
+		pings = atol(argv[2]);
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+	{
+		perror("pty");
+		return 2;
+	}
+	const char *path = ptsname(master);
+
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(device(master));
+
+	client(path, pings);
+
+	//the device ends when the slave side is closed
+	int status = 0;
+	alarm(5);
+	waitpid(pid, &status, 0);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "device used every bus exchange");
+	close(master);
+	return s_failures ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+//replays recorded MDB traces against CoinChanger and BillValidator on the host
+//
+//build from the repository root:
+//  g++ -std=gnu++11 -O2 -Iextras/host -I. -o replay extras/replay/replay.cpp extras/host/*.cpp
+//      MDBSerial.cpp MDBTimer.cpp Power.cpp CoinChanger.cpp CoinHopper.cpp BillValidator.cpp EscrowPolicy.cpp MDBDevice.cpp MDBEvent.cpp
+//      Logger.cpp Recorder.cpp Watchdog.cpp Audit.cpp
+//
+//usage: replay [-v] [-n repeat] file.trace...
+//
+//trace format, one statement per line, '#' starts a comment:
+//  0B -> 48 05          the VMC sends 0B, the peripheral answers with data 48 05
+//  * -> ACK             any command, answered with ACK, NAK, -- (timeout),
+//                       ERR (uart error) or CHK (checksum error)
+//  cc reset|update|dispense <value>
+//  bv reset|update <change>|dispense <value>
+//  bv changer           enable bills by the coins the changer can pay out
+//  bv price <value>     cheapest product for the escrow policy
+//  expect cc credit|dispensed <value>
+//  expect bv credit|dispensed <value>
+//  expect log <text>    text was logged since the last cc/bv statement
+//  expect event <name> [value]
+//                       event was queued since the last cc/bv statement,
+//                       name is the EVENT_ define in lower case without prefix
+//  expect drained       every exchange has been used
+
+#include "Host.h"
+#include "CoinChanger.h"
+#include "BillValidator.h"
+#include "Logger.h"
+#include "MDBEvent.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+struct Step
+{
+	std::string file;
+	int line;
+	std::vector<std::string> words;
+	std::string rest;
+	HostExchange exchange;
+	bool is_exchange;
+};
+
+static bool s_verbose = false;
+
+static const char *s_event_names[] = { "", "coin_accepted", "coin_rejected", "coins_dispensed", "slug",
+		"bill_escrowed", "bill_stacked", "bill_returned", "bill_to_recycler", "bill_rejected",
+		"payout_progress", "payout_complete", "fault", "reset", "health", "device_found" };
+static const size_t s_event_count = sizeof(s_event_names) / sizeof(s_event_names[0]);
+
+static int event_type(const std::string &name)
+{
+	for (size_t i = 1; i < s_event_count; i++)
+		if (name == s_event_names[i])
+			return i;
+	return -1;
+}
+
+static bool parse_bytes(std::istringstream &in, uint8_t *data, int *count)
+{
+	std::string word;
+	*count = 0;
+	while (in >> word)
+	{
+		if (*count >= HOST_FRAME_MAX)
+			return false;
+		char *end;
+		unsigned long val = strtoul(word.c_str(), &end, 16);
+		if (*end || val > 0xFF)
+			return false;
+		data[(*count)++] = val;
+	}
+	return true;
+}
+
+static bool parse_exchange(const std::string &text, HostExchange *ex)
+{
+	size_t arrow = text.find("->");
+	std::istringstream cmd(text.substr(0, arrow));
+	std::istringstream resp(text.substr(arrow + 2));
+
+	std::string first;
+	cmd >> first;
+	ex->any_command = first == "*";
+	if (!ex->any_command)
+	{
+		std::istringstream all(text.substr(0, arrow));
+		if (!parse_bytes(all, ex->command, &ex->command_count))
+			return false;
+	}
+
+	std::string kind;
+	std::istringstream peek(text.substr(arrow + 2));
+	peek >> kind;
+	ex->response_count = 0;
+	ex->kind = HOST_DATA;
+	if (kind == "ACK")
+		ex->kind = HOST_ACK;
+	else if (kind == "NAK")
+		ex->kind = HOST_NAK;
+	else if (kind == "--")
+		ex->kind = HOST_TIMEOUT;
+	else if (kind == "ERR")
+		ex->kind = HOST_ERROR;
+	else if (kind == "CHK")
+		ex->kind = HOST_CHECKSUM;
+	else
+		return parse_bytes(resp, ex->response, &ex->response_count);
+	return true;
+}
+
+static bool load(const char *file, std::vector<Step> &steps)
+{
+	std::ifstream in(file);
+	if (!in)
+	{
+		fprintf(stderr, "%s: cannot open\n", file);
+		return false;
+	}
+	std::string text;
+	int line = 0;
+	while (std::getline(in, text))
+	{
+		line++;
+		size_t comment = text.find('#');
+		if (comment != std::string::npos)
+			text.erase(comment);
+		std::istringstream words(text);
+		Step step;
+		step.file = file;
+		step.line = line;
+		std::string word;
+		while (words >> word)
+			step.words.push_back(word);
+		if (step.words.empty())
+			continue;
+
+		step.is_exchange = text.find("->") != std::string::npos;
+		if (step.is_exchange && !parse_exchange(text, &step.exchange))
+		{
+			fprintf(stderr, "%s:%d: bad exchange\n", file, line);
+			return false;
+		}
+		if (step.words[0] == "expect" && step.words.size() > 2 && step.words[1] == "log")
+		{
+			size_t pos = text.find("log") + 3;
+			step.rest = text.substr(text.find_first_not_of(" \t", pos));
+			step.rest.erase(step.rest.find_last_not_of(" \t\r") + 1);
+		}
+		steps.push_back(step);
+	}
+	return true;
+}
+
+static unsigned long number(const Step &step, size_t idx)
+{
+	return idx < step.words.size() ? strtoul(step.words[idx].c_str(), 0, 0) : 0;
+}
+
+static int fail(const Step &step, const char *what, unsigned long want, unsigned long got)
+{
+	fprintf(stderr, "%s:%d: %s: expected %lu, got %lu\n", step.file.c_str(), step.line, what, want, got);
+	return 1;
+}
+
+//runs all steps once with fresh devices, returns the number of failed expectations
+static int run(const std::vector<Step> &steps)
+{
+	MDBSerial mdb(1);
+	CoinChanger changer(mdb);
+	BillValidator validator(mdb);
+	int failures = 0;
+	std::vector<MDBEvent> queued;
+
+	host_bus.Clear();
+	events.Clear();
+	host_bus.verbose = s_verbose;
+	host_log.clear();
+
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		const Step &step = steps[i];
+		const std::string &w0 = step.words[0];
+		const std::string w1 = step.words.size() > 1 ? step.words[1] : "";
+		const std::string w2 = step.words.size() > 2 ? step.words[2] : "";
+
+		if (step.is_exchange)
+		{
+			host_bus.Push(step.exchange);
+			continue;
+		}
+
+		if (w0 == "cc" || w0 == "bv")
+		{
+			host_log.clear();
+			queued.clear();
+		}
+
+		if (w0 == "cc" && w1 == "reset")
+			changer.Reset();
+		else if (w0 == "cc" && w1 == "update")
+		{
+			unsigned long change;
+			changer.Update(change);
+		}
+		else if (w0 == "cc" && w1 == "dispense")
+			changer.Dispense(number(step, 2));
+		else if (w0 == "bv" && w1 == "reset")
+			validator.Reset();
+		else if (w0 == "bv" && w1 == "update")
+			validator.Update(number(step, 2));
+		else if (w0 == "bv" && w1 == "dispense")
+			validator.Dispense(number(step, 2));
+		else if (w0 == "bv" && w1 == "changer")
+			validator.SetChanger(changer);
+		else if (w0 == "bv" && w1 == "price")
+			validator.SetMinPrice(number(step, 2));
+		else if (w0 == "expect" && w1 == "cc" && w2 == "credit")
+		{
+			if (changer.GetCredit() != number(step, 3))
+				failures += fail(step, "cc credit", number(step, 3), changer.GetCredit());
+		}
+		else if (w0 == "expect" && w1 == "cc" && w2 == "dispensed")
+		{
+			unsigned long val = changer.GetDispensedValue();
+			if (val != number(step, 3))
+				failures += fail(step, "cc dispensed", number(step, 3), val);
+		}
+		else if (w0 == "expect" && w1 == "bv" && w2 == "credit")
+		{
+			if (validator.GetCredit() != number(step, 3))
+				failures += fail(step, "bv credit", number(step, 3), validator.GetCredit());
+		}
+		else if (w0 == "expect" && w1 == "bv" && w2 == "dispensed")
+		{
+			unsigned long val = validator.GetDispensedValue();
+			if (val != number(step, 3))
+				failures += fail(step, "bv dispensed", number(step, 3), val);
+		}
+		else if (w0 == "expect" && w1 == "log")
+		{
+			if (host_log.find(step.rest) == std::string::npos)
+			{
+				fprintf(stderr, "%s:%d: log does not contain \"%s\"\n", step.file.c_str(), step.line, step.rest.c_str());
+				failures++;
+			}
+		}
+		else if (w0 == "expect" && w1 == "event" && event_type(w2) > 0)
+		{
+			bool found = false;
+			for (size_t e = 0; e < queued.size() && !found; e++)
+				found = queued[e].type == event_type(w2) && (step.words.size() < 4 || queued[e].value == number(step, 3));
+			if (!found)
+			{
+				fprintf(stderr, "%s:%d: no %s event", step.file.c_str(), step.line, w2.c_str());
+				if (step.words.size() >= 4)
+					fprintf(stderr, " with value %lu", number(step, 3));
+				fprintf(stderr, ", got:");
+				for (size_t e = 0; e < queued.size(); e++)
+					fprintf(stderr, " %s(%lu)", s_event_names[queued[e].type % s_event_count], queued[e].value);
+				fprintf(stderr, "\n");
+				failures++;
+			}
+		}
+		else if (w0 == "expect" && w1 == "drained")
+		{
+			if (!host_bus.Empty())
+				failures += fail(step, "pending exchanges", 0, host_bus.Pending());
+		}
+		else
+		{
+			fprintf(stderr, "%s:%d: unknown statement\n", step.file.c_str(), step.line);
+			failures++;
+		}
+
+		MDBEvent e;
+		while (events.Pop(e))
+			queued.push_back(e);
+	}
+
+	if (host_bus.mismatches || host_bus.underruns)
+	{
+		fprintf(stderr, "%s: %lu command mismatches, %lu commands without answer\n",
+				steps.empty() ? "" : steps[0].file.c_str(), host_bus.mismatches, host_bus.underruns);
+		failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	long repeat = 1;
+	int failures = 0;
+	std::vector<const char *> files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-v") == 0)
+			s_verbose = true;
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			repeat = atol(argv[++i]);
+		else
+			files.push_back(argv[i]);
+	}
+	if (files.empty())
+	{
+		fprintf(stderr, "usage: %s [-v] [-n repeat] file.trace...\n", argv[0]);
+		return 2;
+	}
+
+	UART uart(0);
+	Logger::SetUART(&uart);
+	Logger::SetDebug(true);
+	host_echo = s_verbose;
+
+	for (size_t f = 0; f < files.size(); f++)
+	{
+		std::vector<Step> steps;
+		if (!load(files[f], steps))
+			return 2;
+
+		int file_failures = run(steps);
+		unsigned long frames = host_bus.frames;
+
+		//only time the clean runs, the first one already reported any failure
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (long r = 1; r < repeat && file_failures == 0; r++)
+			run(steps);
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		printf("%s: %s, %lu frames", files[f], file_failures ? "FAIL" : "ok", frames);
+		if (repeat > 1 && sec > 0)
+			printf(", %.0f frames/s, %.2f us/frame", frames * (repeat - 1) / sec, sec * 1e6 / (frames * (repeat - 1)));
+		printf("\n");
+		failures += file_failures;
+	}
+	return failures ? 1 : 0;
+}